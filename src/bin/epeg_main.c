@@ -3,15 +3,199 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "epeg_main.h"
 
+/* one image of a directory being clustered, which is also a node of a
+ * BK-tree over the hashes, so that the near ones can be found without
+ * comparing every pair: */
+typedef struct _cluster_item cluster_item;
+struct _cluster_item
+{
+   char *path;
+   unsigned long long int hash;
+   int dist, child, sibling;
+   int parent, next;
+};
+
+/* union-find root, halving the path on the way: */
+static int cluster_root(cluster_item *items, int i)
+{
+   while (items[i].parent != i) {
+	   items[i].parent = items[items[i].parent].parent;
+	   i = items[i].parent;
+   }
+   return i;
+}
+
+/* join item n with everything already in the tree within maxdist of it,
+ * then add it to the tree: */
+static void cluster_add(cluster_item *items, int *stack, int n, int maxdist)
+{
+   int top, i, c, d, a, b;
+
+   items[n].child = -1;
+   items[n].sibling = -1;
+   items[n].parent = n;
+   items[n].next = -1;
+   if (n == 0) {
+	   return;
+   }
+
+   stack[0] = 0;
+   for ((top = 1); (top > 0); ) {
+	   i = stack[--top];
+	   d = epeg_phash_distance(items[i].hash, items[n].hash);
+	   if (d <= maxdist) {
+		   a = cluster_root(items, i);
+		   b = cluster_root(items, n);
+		   if (a != b) {
+			   items[b].parent = a;
+		   }
+	   }
+	   /* by the triangle inequality only children at a distance within
+	    * maxdist of d can hold any matches: */
+	   for ((c = items[i].child); (c >= 0); c = items[c].sibling) {
+		   if ((items[c].dist >= (d - maxdist)) &&
+		       (items[c].dist <= (d + maxdist))) {
+			   stack[top++] = c;
+		   }
+	   }
+   }
+
+   for ((i = 0); ; ) {
+	   d = epeg_phash_distance(items[i].hash, items[n].hash);
+	   for ((c = items[i].child); (c >= 0); c = items[c].sibling) {
+		   if (items[c].dist == d) {
+			   break;
+		   }
+	   }
+	   if (c < 0) {
+		   items[n].dist = d;
+		   items[n].sibling = items[i].child;
+		   items[i].child = n;
+		   return;
+	   }
+	   i = c;
+   }
+}
+
+/* print the groups of near duplicate JPEGs in a directory: */
+static int cluster(const char *dir, int maxdist)
+{
+   cluster_item *items;
+   struct dirent *de;
+   struct stat st;
+   DIR *d;
+   int *stack, *head, *last;
+   int n, alloc, i, r;
+
+   d = opendir(dir);
+   if (!d) {
+	   printf("cannot open %s\n", dir);
+	   return -1;
+   }
+   items = NULL;
+   n = 0;
+   alloc = 0;
+   while ((de = readdir(d))) {
+	   Epeg_Image *im;
+	   char *path;
+
+	   path = (char *)malloc(strlen(dir) + strlen(de->d_name) + 2);
+	   if (!path) {
+		   break;
+	   }
+	   sprintf(path, "%s/%s", dir, de->d_name);
+	   if ((stat(path, &st) != 0) || (!S_ISREG(st.st_mode))) {
+		   free(path);
+		   continue;
+	   }
+	   if (n == alloc) {
+		   cluster_item *tmp;
+
+		   alloc = ((alloc) ? (alloc * 2) : 256);
+		   tmp = (cluster_item *)realloc(items, alloc * sizeof(cluster_item));
+		   if (!tmp) {
+			   free(path);
+			   break;
+		   }
+		   items = tmp;
+	   }
+	   /* whatever is not a JPEG gets turned away by the open: */
+	   im = epeg_file_open(path);
+	   if ((!im) || (epeg_phash(im, &(items[n].hash)) != 0)) {
+		   if (im) {
+			   epeg_close(im);
+		   }
+		   free(path);
+		   continue;
+	   }
+	   epeg_close(im);
+	   items[n].path = path;
+	   n++;
+   }
+   closedir(d);
+
+   stack = (int *)malloc((n + 1) * sizeof(int));
+   head = (int *)malloc((n + 1) * sizeof(int));
+   last = (int *)malloc((n + 1) * sizeof(int));
+   if ((!stack) || (!head) || (!last)) {
+	   printf("out of memory\n");
+	   exit(-1);
+   }
+   for ((i = 0); (i < n); i++) {
+	   cluster_add(items, stack, i, maxdist);
+   }
+
+   /* chain each group together from its first item, in directory order,
+    * and print those with more than one: */
+   for ((i = 0); (i < n); i++) {
+	   head[i] = -1;
+   }
+   for ((i = 0); (i < n); i++) {
+	   r = cluster_root(items, i);
+	   if (head[r] >= 0) {
+		   items[last[r]].next = i;
+	   } else {
+		   head[r] = i;
+	   }
+	   last[r] = i;
+   }
+   for ((i = 0); (i < n); i++) {
+	   if ((head[cluster_root(items, i)] != i) || (items[i].next < 0)) {
+		   continue;
+	   }
+	   for ((r = i); (r >= 0); r = items[r].next) {
+		   printf("%016llx %s\n", items[r].hash, items[r].path);
+	   }
+	   printf("\n");
+   }
+
+   for ((i = 0); (i < n); i++) {
+	   free(items[i].path);
+   }
+   free(items);
+   free(stack);
+   free(head);
+   free(last);
+   return 0;
+}
+
 /* main function: */
 int main(int argc, char **argv)
 {
    Epeg_Image *im;
 
+   if ((argc >= 3) && (argc <= 4) && (strcmp(argv[1], "--cluster") == 0)) {
+	   return cluster(argv[2], ((argc == 4) ? atoi(argv[3]) : 10));
+   }
    if (argc != 3) {
 	   printf("Usage: %s input.jpg thumb.jpg\n", argv[0]);
+	   printf("       %s --cluster directory [max_distance]\n", argv[0]);
 	   exit(0);
    }
    im = epeg_file_open(argv[1]);
@@ -0,0 +1,135 @@
+/* test_abbreviated.c */
+/* checks that abbreviated images read back with the shared tables only */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+
+/* static function; unnecessary to document: */
+static int has_marker(const unsigned char *d, int len, int marker)
+{
+   int i, seg;
+
+   /* the markers before the scan, which is where the tables would be: */
+   for ((i = 2); ((i + 4) <= len) && (d[i] == 0xff); (i += (2 + seg))) {
+      if (d[i + 1] == marker) {
+         return 1;
+      }
+      if (d[i + 1] == 0xda) {
+         break;
+      }
+      seg = ((d[i + 2] << 8) | d[i + 3]);
+   }
+   return 0;
+}
+
+/* static function; unnecessary to document: */
+static unsigned char *encode(unsigned char *src, int size, int abbreviated,
+                             int *out_size)
+{
+   unsigned char *out;
+   Epeg_Image *im;
+
+   im = epeg_memory_open(src, size);
+   if (!im) {
+      return NULL;
+   }
+   out = NULL;
+   *out_size = 0;
+   epeg_decode_size_set(im, 48, 32);
+   epeg_quality_set(im, 75);
+   epeg_encode_abbreviated_set(im, abbreviated);
+   epeg_memory_output_set(im, &out, out_size);
+   if (epeg_encode(im) != 0) {
+      epeg_close(im);
+      free(out);
+      return NULL;
+   }
+   epeg_close(im);
+   return out;
+}
+
+/* main function: */
+int main(void)
+{
+   unsigned char *src, *tables, *full, *abbr;
+   const unsigned char *pixels;
+   Epeg_Image *im;
+   int size, tables_size, full_size, abbr_size, w, h, ret;
+
+   src = test_source_make(96, 64, 90, &size);
+   if (!src) {
+      printf("cannot make the source\n");
+      return 1;
+   }
+   tables = NULL;
+   tables_size = 0;
+   full = encode(src, size, 0, &full_size);
+   abbr = encode(src, size, 1, &abbr_size);
+   if ((!full) || (!abbr) ||
+       (epeg_tables_encode(75, &tables, &tables_size) != 0)) {
+      printf("cannot encode\n");
+      return 1;
+   }
+
+   ret = 0;
+   if ((!has_marker(full, full_size, 0xdb)) ||
+       (!has_marker(full, full_size, 0xc4))) {
+      printf("the full image has no tables\n");
+      ret = 1;
+   }
+   if ((has_marker(abbr, abbr_size, 0xdb)) ||
+       (has_marker(abbr, abbr_size, 0xc4))) {
+      printf("the abbreviated image has tables\n");
+      ret = 1;
+   }
+   if ((!has_marker(tables, tables_size, 0xdb)) ||
+       (!has_marker(tables, tables_size, 0xc4))) {
+      printf("the tables-only stream has no tables\n");
+      ret = 1;
+   }
+   if ((full_size - abbr_size) < 400) {
+      printf("abbreviated %d bytes, full %d bytes\n", abbr_size, full_size);
+      ret = 1;
+   }
+
+   /* the shared tables make it the same image as the full one: */
+   im = epeg_memory_open_with_tables(abbr, abbr_size, tables, tables_size);
+   if (!im) {
+      printf("cannot open the abbreviated image with the tables\n");
+      return 1;
+   }
+   epeg_size_get(im, &w, &h);
+   epeg_decode_colorspace_set(im, EPEG_RGB8);
+   pixels = epeg_pixels_get(im, 0, 0, w, h);
+   if ((w != 48) || (h != 32) || (!pixels)) {
+      printf("abbreviated image %dx%d, %s\n", w, h,
+             (pixels ? "decoded" : "not decoded"));
+      ret = 1;
+   } else {
+      ret |= test_pattern_check("abbreviated", pixels, w, h, 24);
+      epeg_pixels_free(im, pixels);
+   }
+   epeg_close(im);
+
+   /* without them it cannot be decoded: */
+   im = epeg_memory_open(abbr, abbr_size);
+   if (im) {
+      pixels = epeg_pixels_get(im, 0, 0, 48, 32);
+      if (pixels) {
+         printf("the abbreviated image decoded without tables\n");
+         epeg_pixels_free(im, pixels);
+         ret = 1;
+      }
+      epeg_close(im);
+   }
+
+   free(tables);
+   free(abbr);
+   free(full);
+   free(src);
+   return ret;
+}
+
+/* EOF */
@@ -0,0 +1,127 @@
+/* test_batch.c */
+/* checks that scanline batches and file output leave the JPEG as it is */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+
+#define FILE_OUT "test_batch.jpg"
+
+/* static function; unnecessary to document: */
+static unsigned char *encode(unsigned char *src, int size, int rows,
+                             const char *file, int *out_size)
+{
+   unsigned char *out;
+   Epeg_Image *im;
+   FILE *f;
+   long len;
+   int ret;
+
+   im = epeg_memory_open(src, size);
+   if (!im) {
+      return NULL;
+   }
+   out = NULL;
+   *out_size = 0;
+   epeg_decode_size_set(im, 100, 75);
+   epeg_quality_set(im, 80);
+   epeg_encode_batch_set(im, rows);
+   if (file) {
+      epeg_file_output_set(im, file);
+   } else {
+      epeg_memory_output_set(im, &out, out_size);
+   }
+   ret = epeg_encode(im);
+   epeg_close(im);
+   if (ret != 0) {
+      free(out);
+      return NULL;
+   }
+   if (!file) {
+      return out;
+   }
+
+   /* what went to the file: */
+   f = fopen(file, "rb");
+   if (!f) {
+      return NULL;
+   }
+   fseek(f, 0L, SEEK_END);
+   len = ftell(f);
+   rewind(f);
+   out = malloc((size_t)((len > 0) ? len : 1));
+   if ((!out) || (len <= 0) || (fread(out, 1, (size_t)len, f) != (size_t)len)) {
+      fclose(f);
+      free(out);
+      return NULL;
+   }
+   fclose(f);
+   remove(file);
+   *out_size = (int)len;
+   return out;
+}
+
+/* main function: */
+int main(void)
+{
+   static const int batches[] = { 1, 7, 16, 0 };
+   unsigned char *src, *ref, *out;
+   const unsigned char *pixels;
+   Epeg_Image *im;
+   int size, ref_size, out_size, i, ret;
+
+   src = test_source_make(400, 300, 90, &size);
+   if (!src) {
+      printf("cannot make the source\n");
+      return 1;
+   }
+   ret = 0;
+
+   /* one row per call is what the encoder always did: */
+   ref = encode(src, size, 1, NULL, &ref_size);
+   if (!ref) {
+      printf("cannot encode one row at a time\n");
+      return 1;
+   }
+   for ((i = 0); (i < (int)(sizeof(batches) / sizeof(batches[0]))); i++) {
+      out = encode(src, size, batches[i], NULL, &out_size);
+      if ((!out) || (out_size != ref_size) ||
+          (memcmp(out, ref, (size_t)ref_size) != 0)) {
+         printf("batches of %d rows: not the same JPEG\n", batches[i]);
+         ret = 1;
+      }
+      free(out);
+
+      out = encode(src, size, batches[i], FILE_OUT, &out_size);
+      if ((!out) || (out_size != ref_size) ||
+          (memcmp(out, ref, (size_t)ref_size) != 0)) {
+         printf("batches of %d rows: the file is not the same JPEG\n",
+                batches[i]);
+         ret = 1;
+      }
+      free(out);
+   }
+
+   im = epeg_memory_open(ref, ref_size);
+   if (!im) {
+      printf("cannot open the output\n");
+      return 1;
+   }
+   epeg_decode_colorspace_set(im, EPEG_RGB8);
+   pixels = epeg_pixels_get(im, 0, 0, 100, 75);
+   if (!pixels) {
+      printf("cannot decode the output\n");
+      ret = 1;
+   } else {
+      ret |= test_pattern_check("output", pixels, 100, 75, 24);
+      epeg_pixels_free(im, pixels);
+   }
+   epeg_close(im);
+
+   free(ref);
+   free(src);
+   return ret;
+}
+
+/* EOF */
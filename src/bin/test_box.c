@@ -0,0 +1,171 @@
+/* test_box.c */
+/* checks that decodes below an eighth average the image down */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+
+#define W 2048
+#define H 1536
+
+/* static function; unnecessary to document: */
+static unsigned char *checker_make(int *size)
+{
+   unsigned char *pixels, *jpg;
+   Epeg_Image *im;
+   int x, y, ret;
+
+   /* black and white blocks of 8x8, one for each DCT block, whose DC
+    * values alternate: */
+   pixels = malloc((size_t)W * H);
+   if (!pixels) {
+      return NULL;
+   }
+   for ((y = 0); (y < H); y++) {
+      for ((x = 0); (x < W); x++) {
+         pixels[(y * W) + x] = (unsigned char)((((x / 8) + (y / 8)) & 1) ?
+                                               255 : 0);
+      }
+   }
+   jpg = NULL;
+   *size = 0;
+   im = epeg_encoder_new();
+   if (!im) {
+      free(pixels);
+      return NULL;
+   }
+   epeg_quality_set(im, 95);
+   epeg_memory_output_set(im, &jpg, size);
+   ret = epeg_encode_pixels(im, pixels, EPEG_GRAY8, W, H, 0);
+   epeg_close(im);
+   free(pixels);
+   if (ret != 0) {
+      free(jpg);
+      return NULL;
+   }
+   return jpg;
+}
+
+/* static function; unnecessary to document: */
+static int check_flat(unsigned char *src, int size, int w, int h)
+{
+   const unsigned char *pixels;
+   Epeg_Image *im;
+   int i, ret;
+
+   im = epeg_memory_open(src, size);
+   if (!im) {
+      return 1;
+   }
+   epeg_decode_size_set(im, w, h);
+   epeg_decode_colorspace_set(im, EPEG_GRAY8);
+   pixels = epeg_pixels_get(im, 0, 0, w, h);
+   if (!pixels) {
+      printf("checker at %dx%d: cannot decode\n", w, h);
+      epeg_close(im);
+      return 1;
+   }
+   /* averaged, not picked out of the blocks: */
+   ret = 0;
+   for ((i = 0); (i < (w * h)); i++) {
+      if (abs((int)pixels[i] - 128) > 16) {
+         printf("checker at %dx%d: pixel %d,%d is %d, not about 128\n", w, h,
+                (i % w), (i / w), pixels[i]);
+         ret = 1;
+         break;
+      }
+   }
+   epeg_pixels_free(im, pixels);
+   epeg_close(im);
+   return ret;
+}
+
+/* static function; unnecessary to document: */
+static int check_truncated(unsigned char *src, int size, int w, int h)
+{
+   const unsigned char *pixels;
+   Epeg_Image *im;
+   int rows, ret;
+
+   im = epeg_memory_open(src, (size / 2));
+   if (!im) {
+      return 1;
+   }
+   epeg_decode_size_set(im, w, h);
+   epeg_decode_colorspace_set(im, EPEG_RGB8);
+   epeg_decode_tolerant_set(im, 1);
+   pixels = epeg_pixels_get(im, 0, 0, w, h);
+   rows = epeg_decode_rows_valid_get(im);
+   ret = 0;
+   /* the valid rows count in rows of the averaged image: */
+   if ((!pixels) || (rows <= 0) || (rows >= h)) {
+      printf("truncated at %dx%d: %d valid rows\n", w, h, rows);
+      ret = 1;
+   } else if (memcmp((pixels + ((size_t)(h - 1) * (size_t)w * 3)),
+                     (pixels + ((size_t)(rows - 1) * (size_t)w * 3)),
+                     ((size_t)w * 3)) != 0) {
+      printf("truncated at %dx%d: the last row is not row %d\n", w, h,
+             (rows - 1));
+      ret = 1;
+   }
+   if (pixels) {
+      epeg_pixels_free(im, pixels);
+   }
+   epeg_close(im);
+   return ret;
+}
+
+/* main function: */
+int main(void)
+{
+   unsigned char *src, *out;
+   Epeg_Image *im;
+   int size, out_size, ret;
+
+   src = checker_make(&size);
+   if (!src) {
+      printf("cannot make the checker\n");
+      return 1;
+   }
+   ret = 0;
+   /* boxes of 2, 4 and 8 of the eighth, and 8 then picked from: */
+   ret |= check_flat(src, size, (W / 16), (H / 16));
+   ret |= check_flat(src, size, (W / 32), (H / 32));
+   ret |= check_flat(src, size, (W / 64), (H / 64));
+   ret |= check_flat(src, size, 20, 15);
+   free(src);
+
+   src = test_source_make(W, H, 90, &size);
+   if (!src) {
+      printf("cannot make the source\n");
+      return 1;
+   }
+   ret |= test_decode_check("pattern", epeg_memory_open(src, size), (W / 16),
+                            (H / 16), 24);
+   ret |= test_decode_check("pattern", epeg_memory_open(src, size), 50, 37,
+                            24);
+   ret |= check_truncated(src, size, (W / 32), (H / 32));
+
+   /* and thumbnails saved at those sizes: */
+   im = epeg_memory_open(src, size);
+   if (!im) {
+      return 1;
+   }
+   out = NULL;
+   out_size = 0;
+   epeg_decode_size_set(im, 32, 24);
+   epeg_memory_output_set(im, &out, &out_size);
+   if (epeg_encode(im) != 0) {
+      printf("cannot encode\n");
+      ret = 1;
+   }
+   epeg_close(im);
+   ret |= test_image_check("saved", (out ? epeg_memory_open(out, out_size) :
+                                     NULL), 32, 24, 24);
+   free(out);
+   free(src);
+   return ret;
+}
+
+/* EOF */
@@ -0,0 +1,132 @@
+/* test_callback_input.c */
+/* checks that images pulled through a callback decode as from memory */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+
+/* the bytes handed to the callback: */
+typedef struct _Source Source;
+struct _Source {
+   const unsigned char *data;
+   int size, pos;
+   int smallest, fail_after;
+};
+
+/* static function; unnecessary to document: */
+static int source_read(void *data, unsigned char *buf, int size)
+{
+   Source *s = data;
+   int n;
+
+   if (size < s->smallest) {
+      s->smallest = size;
+   }
+   if ((s->fail_after > 0) && (s->pos >= s->fail_after)) {
+      return -1;
+   }
+   /* an odd amount at a time, as a socket would: */
+   n = ((size > 7) ? ((size / 2) + 1) : size);
+   if (n > (s->size - s->pos)) {
+      n = (s->size - s->pos);
+   }
+   memcpy(buf, (s->data + s->pos), (size_t)n);
+   s->pos += n;
+   return n;
+}
+
+/* static function; unnecessary to document: */
+static int check(const unsigned char *src, int size, int buffer_size)
+{
+   Source s;
+   Epeg_Image *im;
+   char what[64];
+
+   memset(&s, 0, sizeof(s));
+   s.data = src;
+   s.size = size;
+   s.smallest = (1 << 30);
+   snprintf(what, sizeof(what), "buffers of %d", buffer_size);
+   im = epeg_callback_open(source_read, &s, buffer_size);
+   if (!im) {
+      printf("%s: cannot open\n", what);
+      return 1;
+   }
+   /* the header is at the front; the scan is not needed for it: */
+   if (s.pos >= size) {
+      printf("%s: all %d bytes read for the header\n", what, s.pos);
+      epeg_close(im);
+      return 1;
+   }
+   if (s.smallest < 2) {
+      printf("%s: asked for %d bytes\n", what, s.smallest);
+      epeg_close(im);
+      return 1;
+   }
+   return test_decode_check(what, im, 160, 120, 24);
+}
+
+/* main function: */
+int main(void)
+{
+   unsigned char *src, *out;
+   const void *pixels;
+   Epeg_Image *im;
+   Source s;
+   int size, out_size, ret;
+
+   src = test_source_make(640, 480, 90, &size);
+   if (!src) {
+      printf("cannot make the source\n");
+      return 1;
+   }
+   ret = 0;
+   ret |= check(src, size, 1);
+   ret |= check(src, size, 100);
+   ret |= check(src, size, 0);
+
+   /* and they encode as any other image: */
+   memset(&s, 0, sizeof(s));
+   s.data = src;
+   s.size = size;
+   im = epeg_callback_open(source_read, &s, 512);
+   out = NULL;
+   out_size = 0;
+   if (im) {
+      epeg_decode_size_set(im, 64, 48);
+      epeg_memory_output_set(im, &out, &out_size);
+      if (epeg_encode(im) != 0) {
+         printf("cannot encode\n");
+         ret = 1;
+      }
+      epeg_close(im);
+   }
+   ret |= test_image_check("encoded", (out ? epeg_memory_open(out, out_size) :
+                                       NULL), 64, 48, 24);
+   free(out);
+
+   /* a read error half way fails the decode: */
+   memset(&s, 0, sizeof(s));
+   s.data = src;
+   s.size = size;
+   s.fail_after = (size / 2);
+   im = epeg_callback_open(source_read, &s, 256);
+   if (!im) {
+      printf("cannot open the failing source\n");
+      return 1;
+   }
+   epeg_decode_size_set(im, 160, 120);
+   pixels = epeg_pixels_get(im, 0, 0, 160, 120);
+   if (pixels) {
+      printf("a failing read decoded\n");
+      epeg_pixels_free(im, pixels);
+      ret = 1;
+   }
+   epeg_close(im);
+
+   free(src);
+   return ret;
+}
+
+/* EOF */
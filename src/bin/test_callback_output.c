@@ -0,0 +1,124 @@
+/* test_callback_output.c */
+/* checks that streaming the output to a callback gives the same JPEG */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+
+/* the bytes seen by the callback: */
+typedef struct _Sink Sink;
+struct _Sink {
+   unsigned char *data;
+   int size, alloc;
+   int calls, biggest, fail_at;
+};
+
+/* static function; unnecessary to document: */
+static int sink_write(void *data, const unsigned char *buf, int size)
+{
+   Sink *sink = data;
+   unsigned char *p;
+
+   sink->calls++;
+   if ((sink->fail_at > 0) && (sink->calls >= sink->fail_at)) {
+      return 1;
+   }
+   if (size > sink->biggest) {
+      sink->biggest = size;
+   }
+   if ((sink->size + size) > sink->alloc) {
+      sink->alloc = ((sink->size + size) * 2);
+      p = realloc(sink->data, (size_t)sink->alloc);
+      if (!p) {
+         return 1;
+      }
+      sink->data = p;
+   }
+   memcpy((sink->data + sink->size), buf, (size_t)size);
+   sink->size += size;
+   return 0;
+}
+
+/* static function; unnecessary to document: */
+static int encode(unsigned char *src, int size, unsigned char **out,
+                  int *out_size, Sink *sink, int chunk)
+{
+   Epeg_Image *im;
+   int ret;
+
+   im = epeg_memory_open(src, size);
+   if (!im) {
+      return 1;
+   }
+   epeg_decode_size_set(im, 320, 240);
+   epeg_quality_set(im, 90);
+   if (sink) {
+      epeg_callback_output_set(im, sink_write, sink, chunk);
+   } else {
+      epeg_memory_output_set(im, out, out_size);
+   }
+   ret = epeg_encode(im);
+   epeg_close(im);
+   return ret;
+}
+
+/* main function: */
+int main(void)
+{
+   static const int chunks[] = { 1, 100, 4096, 0 };
+   unsigned char *src, *ref;
+   Sink sink;
+   int size, ref_size, i, ret;
+
+   src = test_source_make(640, 480, 95, &size);
+   ref = NULL;
+   ref_size = 0;
+   if ((!src) || (encode(src, size, &ref, &ref_size, NULL, 0) != 0)) {
+      printf("cannot make the reference\n");
+      return 1;
+   }
+   ret = 0;
+
+   for ((i = 0); (i < (int)(sizeof(chunks) / sizeof(chunks[0]))); i++) {
+      memset(&sink, 0, sizeof(sink));
+      if (encode(src, size, NULL, NULL, &sink, chunks[i]) != 0) {
+         printf("chunks of %d: encode failed\n", chunks[i]);
+         ret = 1;
+      } else if ((sink.size != ref_size) ||
+                 (memcmp(sink.data, ref, (size_t)ref_size) != 0)) {
+         printf("chunks of %d: %d bytes streamed, not the %d of the JPEG\n",
+                chunks[i], sink.size, ref_size);
+         ret = 1;
+      } else if (sink.biggest > ((chunks[i] > 0) ? chunks[i] : 16384)) {
+         printf("chunks of %d: handed %d bytes at once\n", chunks[i],
+                sink.biggest);
+         ret = 1;
+      } else if ((chunks[i] == 100) && (sink.calls < (ref_size / 100))) {
+         printf("chunks of %d: only %d calls\n", chunks[i], sink.calls);
+         ret = 1;
+      }
+      free(sink.data);
+   }
+
+   /* a callback that fails aborts the save: */
+   memset(&sink, 0, sizeof(sink));
+   sink.fail_at = 3;
+   if (encode(src, size, NULL, NULL, &sink, 256) == 0) {
+      printf("a failing callback did not fail the encode\n");
+      ret = 1;
+   }
+   if (sink.calls != 3) {
+      printf("%d calls after the failing one\n", (sink.calls - 3));
+      ret = 1;
+   }
+   free(sink.data);
+
+   ret |= test_image_check("output", epeg_memory_open(ref, ref_size), 320,
+                           240, 24);
+   free(ref);
+   free(src);
+   return ret;
+}
+
+/* EOF */
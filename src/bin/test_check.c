@@ -0,0 +1,152 @@
+/* test_check.c */
+/* checks that the marker check tells JPEGs from what is wrong with them */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+
+#define FILE_IN "test_check.jpg"
+
+/* static function; unnecessary to document: */
+static int segment_find(const unsigned char *src, int size, int marker)
+{
+   int pos;
+
+   /* the generated source has nothing between its segments: */
+   for ((pos = 2); ((pos + 4) <= size); ) {
+      if (src[pos + 1] == marker) {
+         return pos;
+      }
+      if (src[pos + 1] == 0xda) {
+         break;
+      }
+      pos += (2 + ((src[pos + 2] << 8) | src[pos + 3]));
+   }
+   return -1;
+}
+
+/* static function; unnecessary to document: */
+static int check(const char *what, const unsigned char *data, int size,
+                 int eoi, Epeg_Check expect)
+{
+   Epeg_Check got;
+   FILE *f;
+   int ret;
+
+   ret = 0;
+   got = epeg_memory_check(data, size, eoi);
+   if (got != expect) {
+      printf("%s, eoi %d: %d in memory, not %d\n", what, eoi, (int)got,
+             (int)expect);
+      ret = 1;
+   }
+   /* and the same from a file, which is read a block at a time: */
+   f = fopen(FILE_IN, "wb");
+   if ((!f) || (fwrite(data, 1, (size_t)size, f) != (size_t)size)) {
+      printf("%s: cannot write the file\n", what);
+      if (f) {
+         fclose(f);
+      }
+      return 1;
+   }
+   fclose(f);
+   got = epeg_file_check(FILE_IN, eoi);
+   if (got != expect) {
+      printf("%s, eoi %d: %d in a file, not %d\n", what, eoi, (int)got,
+             (int)expect);
+      ret = 1;
+   }
+   remove(FILE_IN);
+   return ret;
+}
+
+/* main function: */
+int main(void)
+{
+   static const unsigned char png[] = {
+      0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n', 0, 0, 0, 13
+   };
+   static const unsigned char empty[] = {
+      0xff, 0xd8, 0xff, 0xd9
+   };
+   unsigned char *src, *buf;
+   Epeg_Image *im;
+   int size, pos, len, ret;
+
+   src = test_source_make(320, 240, 90, &size);
+   buf = (src ? malloc((size_t)size + 10000) : NULL);
+   if (!buf) {
+      printf("cannot make the source\n");
+      return 1;
+   }
+   ret = 0;
+   ret |= check("intact", src, size, 0, EPEG_CHECK_OK);
+   ret |= check("intact", src, size, 1, EPEG_CHECK_OK);
+
+   /* a big APP segment puts the scan past the first block of the file: */
+   memcpy(buf, src, 2);
+   buf[2] = 0xff;
+   buf[3] = 0xe2;
+   buf[4] = (unsigned char)(6000 >> 8);
+   buf[5] = (unsigned char)(6000 & 0xff);
+   memset((buf + 6), 'x', 5998);
+   memcpy((buf + 6002), (src + 2), (size_t)(size - 2));
+   ret |= check("big segment", buf, (size + 6000), 1, EPEG_CHECK_OK);
+
+   /* padding after the end of the image: */
+   memcpy(buf, src, (size_t)size);
+   memset((buf + size), 0, 5000);
+   ret |= check("padded", buf, (size + 5000), 1, EPEG_CHECK_OK);
+
+   /* what is not a JPEG at all: */
+   ret |= check("png", png, (int)sizeof(png), 0, EPEG_CHECK_NOT_JPEG);
+   ret |= check("nothing", src, 0, 0, EPEG_CHECK_NOT_JPEG);
+   ret |= check("no scan", empty, (int)sizeof(empty), 0, EPEG_CHECK_NO_SCAN);
+
+   /* cut off in the header, and in the scan: */
+   ret |= check("cut header", src, 30, 0, EPEG_CHECK_TRUNCATED);
+   ret |= check("cut scan", src, (size / 2), 0, EPEG_CHECK_OK);
+   ret |= check("cut scan", src, (size / 2), 1, EPEG_CHECK_NO_EOI);
+
+   /* a scan without a frame header before it: */
+   pos = segment_find(src, size, 0xc0);
+   if (pos < 0) {
+      printf("no frame header in the source\n");
+      return 1;
+   }
+   len = (2 + ((src[pos + 2] << 8) | src[pos + 3]));
+   memcpy(buf, src, (size_t)pos);
+   memcpy((buf + pos), (src + pos + len), (size_t)(size - pos - len));
+   ret |= check("no frame", buf, (size - len), 0, EPEG_CHECK_NO_FRAME);
+
+   /* bad markers: a second start of image, and a segment too short to hold
+    * its own length: */
+   memcpy(buf, src, (size_t)size);
+   buf[3] = 0xd8;
+   ret |= check("two SOI", buf, size, 0, EPEG_CHECK_BAD_MARKER);
+   memcpy(buf, src, (size_t)size);
+   buf[4] = 0;
+   buf[5] = 1;
+   ret |= check("short segment", buf, size, 0, EPEG_CHECK_BAD_MARKER);
+
+   if (epeg_file_check(FILE_IN, 0) != EPEG_CHECK_IO) {
+      printf("a missing file was not an I/O error\n");
+      ret = 1;
+   }
+   /* and opening runs the same check: */
+   im = epeg_memory_open((unsigned char *)png, (int)sizeof(png));
+   if (im) {
+      printf("a png opened\n");
+      epeg_close(im);
+      ret = 1;
+   }
+   ret |= test_image_check("intact", epeg_memory_open(src, size), 320, 240,
+                           24);
+
+   free(buf);
+   free(src);
+   return ret;
+}
+
+/* EOF */
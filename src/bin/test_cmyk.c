@@ -0,0 +1,221 @@
+/* test_cmyk.c */
+/* checks that CMYK, YCCK and colour sources decode to the right colours */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <jpeglib.h>
+#include "test_common.h"
+
+#define LUMA(r, g, b) ((((77 * (r)) + (150 * (g)) + (29 * (b))) + 128) >> 8)
+
+/* static function; unnecessary to document: */
+static unsigned char *cmyk_pixels_make(int w, int h, int k, int inverted)
+{
+   unsigned char *pixels, *p;
+   unsigned char flip;
+   int x, y;
+
+   /* the Adobe way, 255 being no ink, or plain ink amounts: */
+   flip = (unsigned char)((inverted) ? 0x00 : 0xff);
+   pixels = malloc((size_t)w * (size_t)h * 4);
+   if (!pixels) {
+      return NULL;
+   }
+   p = pixels;
+   for ((y = 0); (y < h); y++) {
+      for ((x = 0); (x < w); x++) {
+         p[0] = (unsigned char)(TEST_RED(x, w) ^ flip);
+         p[1] = (unsigned char)(TEST_GREEN(y, h) ^ flip);
+         p[2] = (unsigned char)(TEST_BLUE ^ flip);
+         p[3] = (unsigned char)(k ^ flip);
+         p += 4;
+      }
+   }
+   return pixels;
+}
+
+/* static function; unnecessary to document: */
+static unsigned char *cmyk_source_make(int w, int h, int k, int *size)
+{
+   unsigned char *pixels, *jpg;
+   Epeg_Image *im;
+   int ret;
+
+   /* libjpeg marks CMYK that it writes as Adobe's: */
+   pixels = cmyk_pixels_make(w, h, k, 1);
+   im = (pixels ? epeg_encoder_new() : NULL);
+   if (!im) {
+      free(pixels);
+      return NULL;
+   }
+   jpg = NULL;
+   *size = 0;
+   epeg_quality_set(im, 95);
+   epeg_memory_output_set(im, &jpg, size);
+   ret = epeg_encode_pixels(im, pixels, EPEG_CMYK, w, h, 0);
+   epeg_close(im);
+   free(pixels);
+   if (ret != 0) {
+      free(jpg);
+      return NULL;
+   }
+   return jpg;
+}
+
+/* static function; unnecessary to document: */
+static unsigned char *jpeg_source_make(int w, int h, int k,
+                                       J_COLOR_SPACE space, int adobe,
+                                       int *size)
+{
+   struct jpeg_compress_struct cinfo;
+   struct jpeg_error_mgr jerr;
+   unsigned char *pixels, *jpg;
+   unsigned long len;
+   JSAMPROW row;
+
+   /* what epeg cannot write itself: YCCK, and CMYK without the Adobe
+    * marker, which then holds plain ink amounts: */
+   pixels = cmyk_pixels_make(w, h, k, adobe);
+   if (!pixels) {
+      return NULL;
+   }
+   jpg = NULL;
+   len = 0;
+   cinfo.err = jpeg_std_error(&jerr);
+   jpeg_create_compress(&cinfo);
+   jpeg_mem_dest(&cinfo, &jpg, &len);
+   cinfo.image_width = (JDIMENSION)w;
+   cinfo.image_height = (JDIMENSION)h;
+   cinfo.input_components = 4;
+   cinfo.in_color_space = JCS_CMYK;
+   jpeg_set_defaults(&cinfo);
+   jpeg_set_colorspace(&cinfo, space);
+   jpeg_set_quality(&cinfo, 95, TRUE);
+   cinfo.write_Adobe_marker = ((adobe) ? TRUE : FALSE);
+   jpeg_start_compress(&cinfo, TRUE);
+   while (cinfo.next_scanline < cinfo.image_height) {
+      row = (pixels + ((size_t)cinfo.next_scanline * (size_t)w * 4));
+      jpeg_write_scanlines(&cinfo, &row, 1);
+   }
+   jpeg_finish_compress(&cinfo);
+   jpeg_destroy_compress(&cinfo);
+   free(pixels);
+   *size = (int)len;
+   return jpg;
+}
+
+/* static function; unnecessary to document: */
+static int check(const char *what, unsigned char *src, int size, int w,
+                 int h, int k, Epeg_Colorspace format)
+{
+   const unsigned char *pixels, *p;
+   unsigned char *out;
+   Epeg_Image *im;
+   int out_size, bpp, x, y, r, g, b, space, ret;
+
+   im = (src ? epeg_memory_open(src, size) : NULL);
+   if (!im) {
+      printf("%s: cannot open\n", what);
+      return 1;
+   }
+   epeg_decode_size_set(im, w, h);
+   epeg_decode_colorspace_set(im, format);
+   pixels = epeg_pixels_get(im, 0, 0, w, h);
+   if (!pixels) {
+      printf("%s: cannot decode\n", what);
+      epeg_close(im);
+      return 1;
+   }
+   /* the pattern, darkened by the black: */
+   bpp = ((format == EPEG_GRAY8) ? 1 : 3);
+   ret = 0;
+   for ((y = 0); ((y < h) && (ret == 0)); y++) {
+      for ((x = 0); (x < w); x++) {
+         p = (pixels + ((((size_t)y * (size_t)w) + (size_t)x) * bpp));
+         r = ((TEST_RED(x, w) * k) / 255);
+         g = ((TEST_GREEN(y, h) * k) / 255);
+         b = ((TEST_BLUE * k) / 255);
+         if (bpp == 1) {
+            r = (g = (b = LUMA(r, g, b)));
+         }
+         if (((bpp == 1) && (abs((int)p[0] - r) > 24)) ||
+             ((bpp == 3) && (!test_pixel_near(p, r, g, b, 24)))) {
+            printf("%s: pixel %d,%d is %d, not about %d,%d,%d\n", what, x, y,
+                   p[0], r, g, b);
+            ret = 1;
+            break;
+         }
+      }
+   }
+   epeg_pixels_free(im, pixels);
+   epeg_close(im);
+
+   /* and saved, it is a JPEG in that colorspace, not CMYK: */
+   im = epeg_memory_open(src, size);
+   if (!im) {
+      return 1;
+   }
+   out = NULL;
+   out_size = 0;
+   epeg_decode_size_set(im, w, h);
+   epeg_decode_colorspace_set(im, format);
+   epeg_memory_output_set(im, &out, &out_size);
+   if (epeg_encode(im) != 0) {
+      printf("%s: cannot encode\n", what);
+      ret = 1;
+   }
+   epeg_close(im);
+   im = (out ? epeg_memory_open(out, out_size) : NULL);
+   space = -1;
+   if (im) {
+      epeg_colorspace_get(im, &space);
+      epeg_close(im);
+   }
+   if (space != (int)format) {
+      printf("%s: saved with colorspace %d\n", what, space);
+      ret = 1;
+   }
+   free(out);
+   return ret;
+}
+
+/* main function: */
+int main(void)
+{
+   unsigned char *src;
+   int size, ret;
+
+   ret = 0;
+   /* only the luma of a colour source: */
+   src = test_source_make(320, 240, 90, &size);
+   ret |= check("rgb", src, size, 320, 240, 255, EPEG_GRAY8);
+   ret |= check("rgb, scaled", src, size, 80, 60, 255, EPEG_GRAY8);
+   free(src);
+
+   /* no black, and half of it: */
+   src = cmyk_source_make(320, 240, 255, &size);
+   ret |= check("cmyk", src, size, 320, 240, 255, EPEG_GRAY8);
+   ret |= check("cmyk, scaled", src, size, 80, 60, 255, EPEG_GRAY8);
+   ret |= check("cmyk", src, size, 320, 240, 255, EPEG_RGB8);
+   ret |= check("cmyk, scaled", src, size, 80, 60, 255, EPEG_RGB8);
+   free(src);
+   src = cmyk_source_make(320, 240, 128, &size);
+   ret |= check("cmyk, half black", src, size, 160, 120, 128, EPEG_GRAY8);
+   ret |= check("cmyk, half black", src, size, 160, 120, 128, EPEG_RGB8);
+   free(src);
+
+   /* the same colours from YCCK, and from CMYK that is not inverted: */
+   src = jpeg_source_make(320, 240, 128, JCS_YCCK, 1, &size);
+   ret |= check("ycck", src, size, 160, 120, 128, EPEG_GRAY8);
+   ret |= check("ycck", src, size, 160, 120, 128, EPEG_RGB8);
+   free(src);
+   src = jpeg_source_make(320, 240, 128, JCS_CMYK, 0, &size);
+   ret |= check("plain cmyk", src, size, 160, 120, 128, EPEG_GRAY8);
+   ret |= check("plain cmyk", src, size, 160, 120, 128, EPEG_RGB8);
+   free(src);
+
+   return ret;
+}
+
+/* EOF */
@@ -0,0 +1,216 @@
+/* test_common.c */
+/* test images shared by the test programs */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "test_common.h"
+
+/**
+ * Make the test pattern as RGB8 pixels.
+ * @param w The width of the pattern.
+ * @param h The height of the pattern.
+ * @return The pixels, to be freed with free(), or NULL on failure.
+ *
+ * Red goes up from left to right and green from top to bottom, over a
+ * constant blue, so that any pixel of a scaled or cropped decode tells
+ * where in the image it came from.
+ */
+unsigned char *test_pattern_make(int w, int h)
+{
+   unsigned char *pixels, *p;
+   int x, y;
+
+   pixels = malloc((size_t)w * (size_t)h * 3);
+   if (!pixels) {
+      return NULL;
+   }
+   p = pixels;
+   for ((y = 0); (y < h); y++) {
+      for ((x = 0); (x < w); x++) {
+         *p++ = (unsigned char)TEST_RED(x, w);
+         *p++ = (unsigned char)TEST_GREEN(y, h);
+         *p++ = TEST_BLUE;
+      }
+   }
+   return pixels;
+}
+
+/**
+ * Make a JPEG of the test pattern in memory.
+ * @param w The width of the image.
+ * @param h The height of the image.
+ * @param quality The quality to encode at.
+ * @param size A pointer to the size of the JPEG.
+ * @return The JPEG, to be freed with free(), or NULL on failure.
+ */
+unsigned char *test_source_make(int w, int h, int quality, int *size)
+{
+   unsigned char *pixels, *jpg;
+   Epeg_Image *im;
+   int ret;
+
+   pixels = test_pattern_make(w, h);
+   if (!pixels) {
+      return NULL;
+   }
+   jpg = NULL;
+   *size = 0;
+   im = epeg_encoder_new();
+   if (!im) {
+      free(pixels);
+      return NULL;
+   }
+   epeg_quality_set(im, quality);
+   epeg_memory_output_set(im, &jpg, size);
+   ret = epeg_encode_pixels(im, pixels, EPEG_RGB8, w, h, 0);
+   epeg_close(im);
+   free(pixels);
+   if (ret != 0) {
+      free(jpg);
+      return NULL;
+   }
+   return jpg;
+}
+
+/**
+ * Compare a pixel with a colour.
+ * @param p A pointer to the RGB8 pixel.
+ * @param r The red to compare with.
+ * @param g The green to compare with.
+ * @param b The blue to compare with.
+ * @param tol How far each channel may be off.
+ * @return 1 if the pixel is that colour, otherwise 0.
+ */
+int test_pixel_near(const unsigned char *p, int r, int g, int b, int tol)
+{
+   return ((abs((int)p[0] - r) <= tol) && (abs((int)p[1] - g) <= tol) &&
+           (abs((int)p[2] - b) <= tol));
+}
+
+/**
+ * Check RGB8 pixels against the test pattern at their size.
+ * @param what What the pixels are, for the failure message.
+ * @param rgb A pointer to the pixels.
+ * @param w The width of the pixels.
+ * @param h The height of the pixels.
+ * @param tol How far each channel may be off.
+ * @return 0 if they are the pattern, otherwise 1.
+ */
+int test_pattern_check(const char *what, const unsigned char *rgb, int w,
+                       int h, int tol)
+{
+   const unsigned char *p;
+   int x, y, r, g;
+
+   for ((y = 0); (y < h); y++) {
+      for ((x = 0); (x < w); x++) {
+         p = (rgb + ((((size_t)y * (size_t)w) + (size_t)x) * 3));
+         r = ((w > 1) ? TEST_RED(x, w) : 128);
+         g = ((h > 1) ? TEST_GREEN(y, h) : 128);
+         if (!test_pixel_near(p, r, g, TEST_BLUE, tol)) {
+            printf("%s: pixel %d,%d is %d,%d,%d, not about %d,%d,%d\n", what,
+                   x, y, p[0], p[1], p[2], r, g, TEST_BLUE);
+            return 1;
+         }
+      }
+   }
+   return 0;
+}
+
+/**
+ * Check RGB8 pixels against a part of the test pattern scaled to their size.
+ * @param what What the pixels are, for the failure message.
+ * @param rgb A pointer to the pixels.
+ * @param w The width of the pixels.
+ * @param h The height of the pixels.
+ * @param x The left edge of the part, in pixels of the pattern.
+ * @param y The top edge of the part, in pixels of the pattern.
+ * @param pw The width of the part.
+ * @param ph The height of the part.
+ * @param iw The width of the whole pattern.
+ * @param ih The height of the whole pattern.
+ * @param tol How far each channel may be off.
+ * @return 0 if they are that part of the pattern, otherwise 1.
+ */
+int test_part_check(const char *what, const unsigned char *rgb, int w, int h,
+                    int x, int y, int pw, int ph, int iw, int ih, int tol)
+{
+   const unsigned char *p;
+   int i, j, r, g;
+
+   for ((j = 0); (j < h); j++) {
+      for ((i = 0); (i < w); i++) {
+         p = (rgb + ((((size_t)j * (size_t)w) + (size_t)i) * 3));
+         r = TEST_RED((x + ((i * pw) / w)), iw);
+         g = TEST_GREEN((y + ((j * ph) / h)), ih);
+         if (!test_pixel_near(p, r, g, TEST_BLUE, tol)) {
+            printf("%s: pixel %d,%d is %d,%d,%d, not about %d,%d,%d\n", what,
+                   i, j, p[0], p[1], p[2], r, g, TEST_BLUE);
+            return 1;
+         }
+      }
+   }
+   return 0;
+}
+
+/**
+ * Check that an image decodes to the test pattern when scaled to a size.
+ * @param what What the image is, for the failure message.
+ * @param im A handle to the opened image, or NULL if it did not open.
+ * @param w The width to decode at.
+ * @param h The height to decode at.
+ * @param tol How far each channel may be off.
+ * @return 0 if it is the pattern, otherwise 1.
+ *
+ * The image is closed.
+ */
+int test_decode_check(const char *what, Epeg_Image *im, int w, int h, int tol)
+{
+   const unsigned char *pixels;
+   int ret;
+
+   if (!im) {
+      printf("%s: cannot open\n", what);
+      return 1;
+   }
+   epeg_decode_size_set(im, w, h);
+   epeg_decode_colorspace_set(im, EPEG_RGB8);
+   pixels = epeg_pixels_get(im, 0, 0, w, h);
+   if (!pixels) {
+      printf("%s: cannot decode\n", what);
+      epeg_close(im);
+      return 1;
+   }
+   ret = test_pattern_check(what, pixels, w, h, tol);
+   epeg_pixels_free(im, pixels);
+   epeg_close(im);
+   return ret;
+}
+
+/**
+ * Check that an image is the test pattern at a size.
+ * @param what What the image is, for the failure message.
+ * @param im A handle to the opened image, or NULL if it did not open.
+ * @param w The width the image should have.
+ * @param h The height the image should have.
+ * @param tol How far each channel may be off.
+ * @return 0 if it is the pattern, otherwise 1.
+ *
+ * The image is closed.
+ */
+int test_image_check(const char *what, Epeg_Image *im, int w, int h, int tol)
+{
+   int iw, ih;
+
+   if (im) {
+      epeg_size_get(im, &iw, &ih);
+      if ((iw != w) || (ih != h)) {
+         printf("%s: %dx%d, not %dx%d\n", what, iw, ih, w, h);
+         epeg_close(im);
+         return 1;
+      }
+   }
+   return test_decode_check(what, im, w, h, tol);
+}
+
+/* EOF */
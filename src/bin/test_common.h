@@ -0,0 +1,27 @@
+/* test_common.h */
+
+#ifndef _TEST_COMMON_H
+#define _TEST_COMMON_H 1
+
+#include "Epeg.h"
+
+/* the red and green of the test pattern at a pixel, in 0..255: */
+#define TEST_RED(x, w)   (((x) * 255) / ((w) - 1))
+#define TEST_GREEN(y, h) (((y) * 255) / ((h) - 1))
+#define TEST_BLUE        96
+
+unsigned char *test_pattern_make(int w, int h);
+unsigned char *test_source_make(int w, int h, int quality, int *size);
+int test_pixel_near(const unsigned char *p, int r, int g, int b, int tol);
+int test_pattern_check(const char *what, const unsigned char *rgb, int w,
+					   int h, int tol);
+int test_part_check(const char *what, const unsigned char *rgb, int w, int h,
+					int x, int y, int pw, int ph, int iw, int ih, int tol);
+int test_decode_check(const char *what, Epeg_Image *im, int w, int h,
+					  int tol);
+int test_image_check(const char *what, Epeg_Image *im, int w, int h,
+					 int tol);
+
+#endif /* !_TEST_COMMON_H */
+
+/* EOF */
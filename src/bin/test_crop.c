@@ -0,0 +1,208 @@
+/* test_crop.c */
+/* checks that cropped decodes hold the part of the image that was asked for */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+
+#define W 640
+#define H 480
+
+/* static function; unnecessary to document: */
+static int check(unsigned char *src, int size, int x, int y, int cw, int ch,
+                 int w, int h)
+{
+   const unsigned char *pixels;
+   unsigned char *out;
+   Epeg_Image *im;
+   char what[64];
+   int out_size, ow, oh, ret;
+
+   snprintf(what, sizeof(what), "%dx%d at %d,%d to %dx%d", cw, ch, x, y, w,
+            h);
+   im = epeg_memory_open(src, size);
+   if (!im) {
+      return 1;
+   }
+   epeg_decode_crop_set(im, x, y, cw, ch);
+   epeg_decode_size_set(im, w, h);
+   epeg_decode_colorspace_set(im, EPEG_RGB8);
+   pixels = epeg_pixels_get(im, 0, 0, w, h);
+   if (!pixels) {
+      printf("%s: cannot decode\n", what);
+      epeg_close(im);
+      return 1;
+   }
+   /* what reaches off the image is clipped off the part: */
+   cw = (((x + cw) > W) ? (W - x) : cw);
+   ch = (((y + ch) > H) ? (H - y) : ch);
+   ret = test_part_check(what, pixels, w, h, x, y, cw, ch, W, H, 24);
+   epeg_pixels_free(im, pixels);
+   epeg_close(im);
+
+   /* the same part gets saved: */
+   im = epeg_memory_open(src, size);
+   if (!im) {
+      return 1;
+   }
+   out = NULL;
+   out_size = 0;
+   epeg_decode_crop_set(im, x, y, cw, ch);
+   epeg_decode_size_set(im, w, h);
+   epeg_memory_output_set(im, &out, &out_size);
+   if (epeg_encode(im) != 0) {
+      printf("%s: cannot encode\n", what);
+      ret = 1;
+   }
+   epeg_close(im);
+   im = (out ? epeg_memory_open(out, out_size) : NULL);
+   if (im) {
+      epeg_size_get(im, &ow, &oh);
+      epeg_decode_colorspace_set(im, EPEG_RGB8);
+      pixels = epeg_pixels_get(im, 0, 0, w, h);
+      if ((ow != w) || (oh != h) || (!pixels) ||
+          (test_part_check(what, pixels, w, h, x, y, cw, ch, W, H,
+                           24) != 0)) {
+         printf("%s: saved at %dx%d\n", what, ow, oh);
+         ret = 1;
+      }
+      if (pixels) {
+         epeg_pixels_free(im, pixels);
+      }
+      epeg_close(im);
+   }
+   free(out);
+   return ret;
+}
+
+/* static function; unnecessary to document: */
+static unsigned char *busy_make(int *size)
+{
+   unsigned char *pixels, *jpg;
+   Epeg_Image *im;
+   unsigned int seed;
+   int x, y, ret;
+
+   /* flat grey, but for a patch of noise well off the middle: */
+   pixels = malloc((size_t)W * (size_t)(H / 2));
+   if (!pixels) {
+      return NULL;
+   }
+   seed = 1U;
+   for ((y = 0); (y < (H / 2)); y++) {
+      for ((x = 0); (x < W); x++) {
+         seed = ((seed * 1103515245U) + 12345U);
+         pixels[(y * W) + x] = 128;
+         if ((x >= 520) && (x < 600) && (y >= 100) && (y < 180)) {
+            pixels[(y * W) + x] = (unsigned char)((seed >> 16) & 0xff);
+         }
+      }
+   }
+   jpg = NULL;
+   *size = 0;
+   im = epeg_encoder_new();
+   if (!im) {
+      free(pixels);
+      return NULL;
+   }
+   epeg_quality_set(im, 90);
+   epeg_memory_output_set(im, &jpg, size);
+   ret = epeg_encode_pixels(im, pixels, EPEG_GRAY8, W, (H / 2), 0);
+   epeg_close(im);
+   free(pixels);
+   if (ret != 0) {
+      free(jpg);
+      return NULL;
+   }
+   return jpg;
+}
+
+/* static function; unnecessary to document: */
+static int check_smart(void)
+{
+   const unsigned char *pixels;
+   unsigned char *src;
+   Epeg_Image *im;
+   int size, i, busy, ret;
+
+   src = busy_make(&size);
+   im = (src ? epeg_memory_open(src, size) : NULL);
+   if (!im) {
+      printf("smart: cannot make the image\n");
+      free(src);
+      return 1;
+   }
+   ret = 0;
+   epeg_decode_colorspace_set(im, EPEG_GRAY8);
+   if (epeg_decode_smart_crop_set(im, 80, 80) != 0) {
+      printf("smart: cannot pick a crop\n");
+      ret = 1;
+   }
+   pixels = epeg_pixels_get(im, 0, 0, 80, 80);
+   busy = 0;
+   for ((i = 0); ((pixels) && (i < (80 * 80))); i++) {
+      if (abs((int)pixels[i] - 128) > 32) {
+         busy++;
+      }
+   }
+   /* a middle square would miss the patch altogether, where this takes in
+    * the 27x27 that it comes to, noise that is mostly averaged away: */
+   if ((!pixels) || (busy < 100)) {
+      printf("smart: %d of the pixels are of the patch\n", busy);
+      ret = 1;
+   }
+   if (pixels) {
+      epeg_pixels_free(im, pixels);
+   }
+   epeg_close(im);
+   free(src);
+   return ret;
+}
+
+/* main function: */
+int main(void)
+{
+   const unsigned char *pixels;
+   unsigned char *src;
+   Epeg_Image *im;
+   int size, ret;
+
+   src = test_source_make(W, H, 95, &size);
+   if (!src) {
+      printf("cannot make the source\n");
+      return 1;
+   }
+   ret = 0;
+   ret |= check(src, size, 160, 120, 320, 240, 160, 120);
+   ret |= check(src, size, 160, 120, 320, 240, 320, 240);
+   ret |= check(src, size, 37, 23, 301, 199, 100, 66);
+   ret |= check(src, size, 0, 0, 128, 480, 16, 60);
+   ret |= check(src, size, 400, 300, 300, 250, 120, 90);
+
+   /* a part smaller than the size asked for is taken at its own size: */
+   im = epeg_memory_open(src, size);
+   if (!im) {
+      return 1;
+   }
+   epeg_decode_crop_set(im, 100, 100, 200, 150);
+   epeg_decode_size_set(im, 1000, 1000);
+   epeg_decode_colorspace_set(im, EPEG_RGB8);
+   pixels = epeg_pixels_get(im, 0, 0, 200, 150);
+   if ((!pixels) ||
+       (test_part_check("small part", pixels, 200, 150, 100, 100, 200, 150, W,
+                        H, 24) != 0)) {
+      printf("small part: cannot decode\n");
+      ret = 1;
+   }
+   if (pixels) {
+      epeg_pixels_free(im, pixels);
+   }
+   epeg_close(im);
+
+   ret |= check_smart();
+   free(src);
+   return ret;
+}
+
+/* EOF */
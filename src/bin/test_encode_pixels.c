@@ -0,0 +1,213 @@
+/* test_encode_pixels.c */
+/* checks that epeg_encode_pixels() encodes every input layout it takes */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+
+#define W 80
+#define H 48
+#define PAD 8
+
+/* static function; unnecessary to document: */
+static int luma(const unsigned char *rgb)
+{
+   return (((77 * rgb[0]) + (150 * rgb[1]) + (29 * rgb[2]) + 128) >> 8);
+}
+
+/* static function; unnecessary to document: */
+static unsigned char clamp(int v)
+{
+   return (unsigned char)((v < 0) ? 0 : ((v > 255) ? 255 : v));
+}
+
+/* static function; unnecessary to document: */
+static unsigned char *layout_make(const unsigned char *rgb,
+                                  Epeg_Colorspace format, int *stride)
+{
+   unsigned char *buf, *u, *v;
+   const unsigned char *p;
+   int x, y, bpp, cstride;
+
+   switch (format) {
+      case EPEG_GRAY8:
+      case EPEG_I420:
+         bpp = 1;
+         break;
+      case EPEG_RGBA8:
+         bpp = 4;
+         break;
+      default:
+         bpp = 3;
+         break;
+   }
+   /* rows with padding at the end, which must be skipped: */
+   *stride = ((W * bpp) + PAD);
+   cstride = ((*stride + 1) / 2);
+   buf = calloc(1, ((size_t)*stride * H) + ((size_t)cstride * H));
+   if (!buf) {
+      return NULL;
+   }
+   u = (buf + ((size_t)*stride * H));
+   v = (u + ((size_t)cstride * (H / 2)));
+   for ((y = 0); (y < H); y++) {
+      for ((x = 0); (x < W); x++) {
+         p = (rgb + ((((size_t)y * W) + (size_t)x) * 3));
+         switch (format) {
+            case EPEG_GRAY8:
+            case EPEG_I420:
+               buf[(y * *stride) + x] = (unsigned char)luma(p);
+               if ((format == EPEG_I420) && ((x % 2) == 0) &&
+                   ((y % 2) == 0)) {
+                  u[((y / 2) * cstride) + (x / 2)] =
+                     clamp(128 + (((-43 * p[0]) - (85 * p[1]) +
+                                   (128 * p[2])) / 256));
+                  v[((y / 2) * cstride) + (x / 2)] =
+                     clamp(128 + (((128 * p[0]) - (107 * p[1]) -
+                                   (21 * p[2])) / 256));
+               }
+               break;
+            case EPEG_BGR8:
+               buf[(y * *stride) + (x * 3)] = p[2];
+               buf[(y * *stride) + (x * 3) + 1] = p[1];
+               buf[(y * *stride) + (x * 3) + 2] = p[0];
+               break;
+            case EPEG_RGBA8:
+               memcpy((buf + (y * *stride) + (x * 4)), p, 3);
+               buf[(y * *stride) + (x * 4) + 3] = 255;
+               break;
+            default:
+               memcpy((buf + (y * *stride) + (x * 3)), p, 3);
+               break;
+         }
+      }
+   }
+   return buf;
+}
+
+/* static function; unnecessary to document: */
+static int check(Epeg_Image *enc, const unsigned char *rgb,
+                 Epeg_Colorspace format, const char *what)
+{
+   unsigned char *buf, *out;
+   const unsigned char *pixels;
+   Epeg_Image *im;
+   int stride, out_size, w, h, x, y, ret;
+
+   buf = layout_make(rgb, format, &stride);
+   if (!buf) {
+      return 1;
+   }
+   out = NULL;
+   out_size = 0;
+   epeg_memory_output_set(enc, &out, &out_size);
+   ret = epeg_encode_pixels(enc, buf, format, W, H, stride);
+   free(buf);
+   if ((ret != 0) || (!out)) {
+      printf("%s: encode failed\n", what);
+      free(out);
+      return 1;
+   }
+
+   im = epeg_memory_open(out, out_size);
+   if (!im) {
+      printf("%s: cannot open the output\n", what);
+      free(out);
+      return 1;
+   }
+   epeg_size_get(im, &w, &h);
+   epeg_decode_colorspace_set(im, EPEG_RGB8);
+   pixels = epeg_pixels_get(im, 0, 0, W, H);
+   ret = 0;
+   if ((w != W) || (h != H) || (!pixels)) {
+      printf("%s: output %dx%d, %s\n", what, w, h,
+             (pixels ? "decoded" : "not decoded"));
+      ret = 1;
+   } else if (format == EPEG_GRAY8) {
+      for ((y = 0); (y < H) && (ret == 0); y++) {
+         for ((x = 0); (x < W) && (ret == 0); x++) {
+            if (!test_pixel_near((pixels + (((y * W) + x) * 3)),
+                                 luma(rgb + (((y * W) + x) * 3)),
+                                 luma(rgb + (((y * W) + x) * 3)),
+                                 luma(rgb + (((y * W) + x) * 3)), 12)) {
+               printf("%s: pixel %d,%d is not the luma\n", what, x, y);
+               ret = 1;
+            }
+         }
+      }
+   } else {
+      ret = test_pattern_check(what, pixels, W, H, 16);
+   }
+   if (pixels) {
+      epeg_pixels_free(im, pixels);
+   }
+   epeg_close(im);
+   free(out);
+   return ret;
+}
+
+/* main function: */
+int main(void)
+{
+   unsigned char *rgb, *src, *out;
+   const unsigned char *pixels;
+   Epeg_Image *enc, *im;
+   int size, out_size, ret;
+
+   rgb = test_pattern_make(W, H);
+   enc = epeg_encoder_new();
+   if ((!rgb) || (!enc)) {
+      printf("cannot set up\n");
+      return 1;
+   }
+   epeg_quality_set(enc, 95);
+
+   /* one encoder for all of them, as it can be used any number of times: */
+   ret = 0;
+   ret |= check(enc, rgb, EPEG_RGB8, "RGB8");
+   ret |= check(enc, rgb, EPEG_BGR8, "BGR8");
+   ret |= check(enc, rgb, EPEG_RGBA8, "RGBA8");
+   ret |= check(enc, rgb, EPEG_GRAY8, "GRAY8");
+   ret |= check(enc, rgb, EPEG_I420, "I420");
+   epeg_close(enc);
+
+   /* an opened image can encode other pixels and still save its own: */
+   src = test_source_make(W, H, 95, &size);
+   im = (src ? epeg_memory_open(src, size) : NULL);
+   if (!im) {
+      printf("cannot open the source\n");
+      return 1;
+   }
+   ret |= check(im, rgb, EPEG_BGR8, "BGR8 on an opened image");
+   out = NULL;
+   out_size = 0;
+   epeg_memory_output_set(im, &out, &out_size);
+   if (epeg_encode(im) != 0) {
+      printf("the opened image no longer encodes\n");
+      ret = 1;
+   }
+   epeg_close(im);
+   im = (out ? epeg_memory_open(out, out_size) : NULL);
+   if (!im) {
+      printf("cannot open the re-encoded source\n");
+      return 1;
+   }
+   epeg_decode_colorspace_set(im, EPEG_RGB8);
+   pixels = epeg_pixels_get(im, 0, 0, W, H);
+   if (!pixels) {
+      printf("cannot decode the re-encoded source\n");
+      ret = 1;
+   } else {
+      ret |= test_pattern_check("re-encoded source", pixels, W, H, 16);
+      epeg_pixels_free(im, pixels);
+   }
+   epeg_close(im);
+
+   free(out);
+   free(src);
+   free(rgb);
+   return ret;
+}
+
+/* EOF */
@@ -0,0 +1,85 @@
+/* test_fd.c */
+/* checks that images read from file descriptors decode as from memory */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "test_common.h"
+
+#define FILE_IN "test_fd.dat"
+#define LEAD 1000
+
+/* static function; unnecessary to document: */
+static int check_file(int fd, int cache)
+{
+   Epeg_Image *im;
+   char what[64];
+   int ret;
+
+   snprintf(what, sizeof(what), "cache %d", cache);
+   if (lseek(fd, (off_t)LEAD, SEEK_SET) != (off_t)LEAD) {
+      return 1;
+   }
+   /* twice on the same descriptor, as it is shared: */
+   im = epeg_fd_open(fd, cache);
+   ret = test_image_check(what, im, 240, 180, 24);
+   im = epeg_fd_open(fd, cache);
+   ret |= test_decode_check(what, im, 120, 90, 24);
+   if (lseek(fd, (off_t)0, SEEK_CUR) != (off_t)LEAD) {
+      printf("%s: the offset moved\n", what);
+      ret = 1;
+   }
+   return ret;
+}
+
+/* main function: */
+int main(void)
+{
+   static const int caches[] = {
+      EPEG_CACHE_DEFAULT,
+      EPEG_CACHE_SEQUENTIAL | EPEG_CACHE_WILLNEED,
+      EPEG_CACHE_DONTNEED,
+      EPEG_CACHE_DIRECT
+   };
+   unsigned char *src, lead[LEAD];
+   Epeg_Image *im;
+   int size, fd, p[2], i, ret;
+
+   src = test_source_make(240, 180, 90, &size);
+   if (!src) {
+      printf("cannot make the source\n");
+      return 1;
+   }
+
+   /* the image after some other data, as in an archive: */
+   memset(lead, 0xaa, sizeof(lead));
+   fd = open(FILE_IN, (O_RDWR | O_CREAT | O_TRUNC), 0666);
+   if ((fd < 0) || (write(fd, lead, sizeof(lead)) != (ssize_t)sizeof(lead)) ||
+       (write(fd, src, (size_t)size) != (ssize_t)size)) {
+      printf("cannot write the source\n");
+      return 1;
+   }
+   ret = 0;
+   for ((i = 0); (i < (int)(sizeof(caches) / sizeof(caches[0]))); i++) {
+      ret |= check_file(fd, caches[i]);
+   }
+   close(fd);
+   remove(FILE_IN);
+
+   /* a pipe is read in order: */
+   if ((pipe(p) != 0) || (write(p[1], src, (size_t)size) != (ssize_t)size)) {
+      printf("cannot fill the pipe\n");
+      return 1;
+   }
+   close(p[1]);
+   im = epeg_fd_open(p[0], EPEG_CACHE_DEFAULT);
+   ret |= test_decode_check("pipe", im, 60, 45, 24);
+   close(p[0]);
+
+   free(src);
+   return ret;
+}
+
+/* EOF */
@@ -0,0 +1,125 @@
+/* test_feed.c */
+/* checks that images fed in pieces decode as from memory */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+
+/* static function; unnecessary to document: */
+static int check(const unsigned char *src, int size, int piece, int w, int h)
+{
+   Epeg_Feed_State state;
+   const unsigned char *pixels;
+   unsigned char *out;
+   Epeg_Image *im;
+   char what[64];
+   int pos, n, headers, updates, rows, last, out_size, ret;
+
+   snprintf(what, sizeof(what), "pieces of %d", piece);
+   im = epeg_feed_open();
+   if (!im) {
+      printf("%s: cannot open\n", what);
+      return 1;
+   }
+   headers = 0;
+   updates = 0;
+   last = 0;
+   state = EPEG_FEED_MORE;
+   pos = 0;
+   while (state != EPEG_FEED_COMPLETE) {
+      /* once all data is in, calls with no bytes go on decoding: */
+      n = (((size - pos) < piece) ? (size - pos) : piece);
+      state = epeg_feed(im, ((n > 0) ? (src + pos) : NULL), n);
+      pos += n;
+      if (state == EPEG_FEED_ERROR) {
+         printf("%s: error at byte %d\n", what, pos);
+         epeg_close(im);
+         return 1;
+      }
+      if (state == EPEG_FEED_HEADER) {
+         headers++;
+         epeg_decode_size_set(im, w, h);
+         epeg_decode_colorspace_set(im, EPEG_RGB8);
+      }
+      if (state == EPEG_FEED_ROWS) {
+         updates++;
+      }
+      rows = epeg_feed_rows_get(im);
+      if (rows < last) {
+         printf("%s: %d rows after %d\n", what, rows, last);
+         epeg_close(im);
+         return 1;
+      }
+      last = rows;
+      if ((n == 0) && (state == EPEG_FEED_MORE)) {
+         break;
+      }
+   }
+   /* fed in small pieces, the rows come in as the data does: */
+   if ((state != EPEG_FEED_COMPLETE) || (headers != 1) || (last <= 0) ||
+       ((piece < 100) && (updates < 2))) {
+      printf("%s: state %d, %d headers, %d row updates, %d rows\n", what,
+             (int)state, headers, updates, last);
+      epeg_close(im);
+      return 1;
+   }
+
+   pixels = epeg_pixels_get(im, 0, 0, w, h);
+   if (!pixels) {
+      printf("%s: cannot get the pixels\n", what);
+      epeg_close(im);
+      return 1;
+   }
+   ret = test_pattern_check(what, pixels, w, h, 24);
+   epeg_pixels_free(im, pixels);
+
+   /* and it can be saved: */
+   out = NULL;
+   out_size = 0;
+   epeg_memory_output_set(im, &out, &out_size);
+   if (epeg_encode(im) != 0) {
+      printf("%s: cannot encode\n", what);
+      ret = 1;
+   }
+   epeg_close(im);
+   ret |= test_image_check(what, (out ? epeg_memory_open(out, out_size) :
+                                  NULL), w, h, 24);
+   free(out);
+   return ret;
+}
+
+/* main function: */
+int main(void)
+{
+   unsigned char *src, junk[256];
+   Epeg_Image *im;
+   int size, ret, i;
+
+   src = test_source_make(320, 240, 90, &size);
+   if (!src) {
+      printf("cannot make the source\n");
+      return 1;
+   }
+   ret = 0;
+   ret |= check(src, size, 1, 80, 60);
+   ret |= check(src, size, 97, 160, 120);
+   ret |= check(src, size, 4096, 320, 240);
+   ret |= check(src, size, size, 40, 30);
+
+   /* data that is not a JPEG is an error: */
+   for ((i = 0); (i < (int)sizeof(junk)); i++) {
+      junk[i] = (unsigned char)(i * 7);
+   }
+   im = epeg_feed_open();
+   if ((!im) || (epeg_feed(im, junk, (int)sizeof(junk)) != EPEG_FEED_ERROR)) {
+      printf("junk was not an error\n");
+      ret = 1;
+   }
+   epeg_close(im);
+
+   free(src);
+   return ret;
+}
+
+/* EOF */
@@ -0,0 +1,119 @@
+/* test_fit.c */
+/* checks that the fit modes give the size and part of the image they say */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+
+#define W 640
+#define H 480
+
+/* static function; unnecessary to document: */
+static int check(unsigned char *src, int size, Epeg_Fit fit, int bw, int bh,
+                 int w, int h, int x, int y, int pw, int ph)
+{
+   static const char *const names[] = { "fill", "contain", "cover" };
+   const unsigned char *pixels;
+   unsigned char *out;
+   Epeg_Image *im;
+   char what[64];
+   int out_size, ow, oh, ret;
+
+   snprintf(what, sizeof(what), "%s %dx%d", names[fit], bw, bh);
+   im = epeg_memory_open(src, size);
+   if (!im) {
+      return 1;
+   }
+   out = NULL;
+   out_size = 0;
+   epeg_decode_fit_set(im, bw, bh, fit);
+   epeg_memory_output_set(im, &out, &out_size);
+   ret = 0;
+   if (epeg_encode(im) != 0) {
+      printf("%s: cannot encode\n", what);
+      ret = 1;
+   }
+   epeg_close(im);
+
+   /* the size that the mode works out, holding the part of the image that
+    * it keeps: */
+   im = (out ? epeg_memory_open(out, out_size) : NULL);
+   if (!im) {
+      free(out);
+      return 1;
+   }
+   epeg_size_get(im, &ow, &oh);
+   if ((ow != w) || (oh != h)) {
+      printf("%s: %dx%d, not %dx%d\n", what, ow, oh, w, h);
+      ret = 1;
+   } else {
+      epeg_decode_colorspace_set(im, EPEG_RGB8);
+      pixels = epeg_pixels_get(im, 0, 0, w, h);
+      if ((!pixels) ||
+          (test_part_check(what, pixels, w, h, x, y, pw, ph, W, H, 24) != 0)) {
+         ret = 1;
+      }
+      if (pixels) {
+         epeg_pixels_free(im, pixels);
+      }
+   }
+   epeg_close(im);
+   free(out);
+   return ret;
+}
+
+/* main function: */
+int main(void)
+{
+   const unsigned char *pixels;
+   unsigned char *src;
+   Epeg_Image *im;
+   int size, ret;
+
+   src = test_source_make(W, H, 95, &size);
+   if (!src) {
+      printf("cannot make the source\n");
+      return 1;
+   }
+   ret = 0;
+   /* the whole image, stretched: */
+   ret |= check(src, size, EPEG_FIT_FILL, 200, 200, 200, 200, 0, 0, W, H);
+   /* the whole image, short on one side: */
+   ret |= check(src, size, EPEG_FIT_CONTAIN, 200, 200, 200, 150, 0, 0, W, H);
+   ret |= check(src, size, EPEG_FIT_CONTAIN, 100, 300, 100, 75, 0, 0, W, H);
+   /* the middle, cut to the box: */
+   ret |= check(src, size, EPEG_FIT_COVER, 200, 200, 200, 200, 80, 0, 480,
+                480);
+   ret |= check(src, size, EPEG_FIT_COVER, 300, 100, 300, 100, 0, 133, 640,
+                213);
+   /* and never scaled up: */
+   ret |= check(src, size, EPEG_FIT_CONTAIN, 1000, 500, 640, 480, 0, 0, W,
+                H);
+   ret |= check(src, size, EPEG_FIT_COVER, 1000, 1000, 480, 480, 80, 0, 480,
+                480);
+
+   /* the pixels come the same way: */
+   im = epeg_memory_open(src, size);
+   if (!im) {
+      return 1;
+   }
+   epeg_decode_fit_set(im, 120, 120, EPEG_FIT_COVER);
+   epeg_decode_colorspace_set(im, EPEG_RGB8);
+   pixels = epeg_pixels_get(im, 0, 0, 120, 120);
+   if ((!pixels) ||
+       (test_part_check("cover pixels", pixels, 120, 120, 80, 0, 480, 480, W,
+                        H, 24) != 0)) {
+      printf("cover pixels: cannot decode\n");
+      ret = 1;
+   }
+   if (pixels) {
+      epeg_pixels_free(im, pixels);
+   }
+   epeg_close(im);
+
+   free(src);
+   return ret;
+}
+
+/* EOF */
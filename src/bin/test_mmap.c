@@ -0,0 +1,107 @@
+/* test_mmap.c */
+/* checks that memory-mapped file output writes the same JPEG */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+
+#define FILE_OUT "test_mmap.jpg"
+
+/* static function; unnecessary to document: */
+static unsigned char *file_read(const char *file, int *size)
+{
+   unsigned char *data;
+   FILE *f;
+   long len;
+
+   f = fopen(file, "rb");
+   if (!f) {
+      return NULL;
+   }
+   fseek(f, 0L, SEEK_END);
+   len = ftell(f);
+   rewind(f);
+   data = malloc((size_t)((len > 0) ? len : 1));
+   if ((data) && (len > 0) &&
+       (fread(data, 1, (size_t)len, f) != (size_t)len)) {
+      free(data);
+      data = NULL;
+   }
+   fclose(f);
+   *size = (int)len;
+   return data;
+}
+
+/* static function; unnecessary to document: */
+static int check(unsigned char *src, int size, int w, int h, int atomic)
+{
+   unsigned char *ref, *out;
+   Epeg_Image *im;
+   int ref_size, out_size, ret, mmap;
+
+   /* the same encode to memory and to a mapped file: */
+   ref = NULL;
+   ref_size = 0;
+   out = NULL;
+   for ((mmap = 0); (mmap < 2); mmap++) {
+      im = epeg_memory_open(src, size);
+      if (!im) {
+         free(ref);
+         return 1;
+      }
+      epeg_decode_size_set(im, w, h);
+      epeg_quality_set(im, 95);
+      if (mmap) {
+         remove(FILE_OUT);
+         epeg_file_output_set(im, FILE_OUT);
+         epeg_file_output_mmap_set(im, 1);
+         epeg_file_output_atomic_set(im, atomic);
+      } else {
+         epeg_memory_output_set(im, &ref, &ref_size);
+      }
+      ret = epeg_encode(im);
+      epeg_close(im);
+      if (ret != 0) {
+         printf("%dx%d, mmap %d: encode failed\n", w, h, mmap);
+         free(ref);
+         return 1;
+      }
+   }
+
+   out = file_read(FILE_OUT, &out_size);
+   ret = 0;
+   if ((!ref) || (!out) || (out_size != ref_size) ||
+       (memcmp(out, ref, (size_t)ref_size) != 0)) {
+      printf("%dx%d, atomic %d: the mapped file is %d bytes, not the %d of "
+             "the JPEG\n", w, h, atomic, (out ? out_size : -1), ref_size);
+      ret = 1;
+   }
+   ret |= test_image_check("mapped file", epeg_file_open(FILE_OUT), w, h, 24);
+   remove(FILE_OUT);
+   free(out);
+   free(ref);
+   return ret;
+}
+
+/* main function: */
+int main(void)
+{
+   unsigned char *src;
+   int size, ret;
+
+   src = test_source_make(1600, 1200, 95, &size);
+   if (!src) {
+      printf("cannot make the source\n");
+      return 1;
+   }
+   ret = 0;
+   /* a thumbnail, and an output that has to grow the mapping: */
+   ret |= check(src, size, 160, 120, 0);
+   ret |= check(src, size, 1600, 1200, 0);
+   ret |= check(src, size, 1600, 1200, 1);
+   free(src);
+   return ret;
+}
+
+/* EOF */
@@ -0,0 +1,154 @@
+/* test_passthrough.c */
+/* checks that copying a source through keeps the metadata a re-encode would */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Epeg.h"
+
+#define PAYLOAD "epeg-test-exif-payload"
+
+/* static function; unnecessary to document: */
+static const unsigned char *find(const unsigned char *d, int len,
+                                 const char *what, int what_len)
+{
+   int i;
+
+   for ((i = 0); (i <= (len - what_len)); i++) {
+      if (memcmp((d + i), what, (size_t)what_len) == 0) {
+         return (d + i);
+      }
+   }
+   return NULL;
+}
+
+/* static function; unnecessary to document: */
+static unsigned char *source_make(int *size)
+{
+   static const unsigned char exif[] = "\xff\xe1\x00\x1e" "Exif\0\0" PAYLOAD;
+   unsigned char pixels[64 * 64 * 3], *jpg, *src;
+   Epeg_Image *im;
+   int jpg_size, i, app0;
+
+   for ((i = 0); (i < (64 * 64)); i++) {
+      pixels[(i * 3)] = (unsigned char)((i % 64) * 4);
+      pixels[(i * 3) + 1] = (unsigned char)((i / 64) * 4);
+      pixels[(i * 3) + 2] = 128;
+   }
+   jpg = NULL;
+   jpg_size = 0;
+   im = epeg_encoder_new();
+   if (!im) {
+      return NULL;
+   }
+   epeg_quality_set(im, 75);
+   epeg_memory_output_set(im, &jpg, &jpg_size);
+   if (epeg_encode_pixels(im, pixels, EPEG_RGB8, 64, 64, 0) != 0) {
+      epeg_close(im);
+      return NULL;
+   }
+   epeg_close(im);
+   if ((!jpg) || (jpg_size < 20) || (jpg[2] != 0xff) || (jpg[3] != 0xe0)) {
+      free(jpg);
+      return NULL;
+   }
+
+   /* an Exif marker right after the JFIF one, as cameras write it: */
+   app0 = (4 + ((jpg[4] << 8) | jpg[5]));
+   src = malloc((size_t)jpg_size + sizeof(exif) - 1);
+   if (!src) {
+      free(jpg);
+      return NULL;
+   }
+   memcpy(src, jpg, (size_t)app0);
+   memcpy((src + app0), exif, (sizeof(exif) - 1));
+   memcpy((src + app0 + sizeof(exif) - 1), (jpg + app0),
+          (size_t)(jpg_size - app0));
+   *size = (int)(jpg_size + sizeof(exif) - 1);
+   free(jpg);
+   return src;
+}
+
+/* static function; unnecessary to document: */
+static int check(unsigned char *src, int size, Epeg_Encode_Profile profile,
+                 int passthrough, int markers, int copy)
+{
+   const unsigned char *in_sos, *out_sos;
+   unsigned char *out;
+   Epeg_Image *im;
+   int out_size, copied, ret;
+
+   im = epeg_memory_open(src, size);
+   if (!im) {
+      printf("cannot open the source\n");
+      return 1;
+   }
+   out = NULL;
+   out_size = 0;
+   epeg_encode_profile_set(im, profile);
+   epeg_encode_passthrough_set(im, passthrough);
+   epeg_encode_markers_set(im, markers);
+   epeg_quality_set(im, 75);
+   epeg_memory_output_set(im, &out, &out_size);
+   ret = epeg_encode(im);
+   epeg_close(im);
+   if ((ret != 0) || (!out)) {
+      printf("profile %d, passthrough %d, markers %d: encode failed\n",
+             (int)profile, passthrough, markers);
+      free(out);
+      return 1;
+   }
+
+   /* a copy has the same scans as the source: */
+   in_sos = find(src, size, "\xff\xda", 2);
+   out_sos = find(out, out_size, "\xff\xda", 2);
+   copied = ((in_sos) && (out_sos) &&
+             ((size - (in_sos - src)) == (out_size - (out_sos - out))) &&
+             (memcmp(in_sos, out_sos, (size_t)(size - (in_sos - src))) == 0));
+
+   ret = 0;
+   if (copied != copy) {
+      printf("profile %d, passthrough %d, markers %d: %s\n", (int)profile,
+             passthrough, markers, (copied ? "copied" : "re-encoded"));
+      ret = 1;
+   }
+   if (find(out, out_size, PAYLOAD, (int)strlen(PAYLOAD))) {
+      printf("profile %d, passthrough %d, markers %d: Exif kept\n",
+             (int)profile, passthrough, markers);
+      ret = 1;
+   }
+   if ((find(out, out_size, "JFIF", 5) ? 1 : 0) !=
+       ((markers & EPEG_MARKER_JFIF) ? 1 : 0)) {
+      printf("profile %d, passthrough %d, markers %d: JFIF %s\n",
+             (int)profile, passthrough, markers,
+             ((markers & EPEG_MARKER_JFIF) ? "dropped" : "kept"));
+      ret = 1;
+   }
+   free(out);
+   return ret;
+}
+
+/* main function: */
+int main(void)
+{
+   unsigned char *src;
+   int size, ret;
+
+   src = source_make(&size);
+   if (!src) {
+      printf("cannot make the source\n");
+      return 1;
+   }
+   ret = 0;
+   ret |= check(src, size, EPEG_PROFILE_DEFAULT, 0, EPEG_MARKER_NONE, 0);
+   ret |= check(src, size, EPEG_PROFILE_DEFAULT, 0, EPEG_MARKER_ALL, 0);
+   ret |= check(src, size, EPEG_PROFILE_FASTEST, 0, EPEG_MARKER_NONE, 0);
+   ret |= check(src, size, EPEG_PROFILE_FASTEST, 1, EPEG_MARKER_NONE, 1);
+   ret |= check(src, size, EPEG_PROFILE_FASTEST, 1, EPEG_MARKER_ALL, 1);
+   /* the source has the standard Huffman tables, not optimised ones: */
+   ret |= check(src, size, EPEG_PROFILE_BALANCED, 1, EPEG_MARKER_ALL, 0);
+   free(src);
+   return ret;
+}
+
+/* EOF */
@@ -0,0 +1,166 @@
+/* test_phash.c */
+/* checks that perceptual hashes tell alike images from different ones */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+
+/* static function; unnecessary to document: */
+static unsigned char *picture_make(int w, int h, unsigned int seed,
+                                   int quality, int *size)
+{
+   unsigned char *pixels, *jpg;
+   Epeg_Image *im;
+   int lattice[9][9], x, y, i, j, fx, fy, top, bottom, ret;
+
+   /* smooth random shapes, which unlike the gradient of the pattern give
+    * all the low frequencies that the hash is made of something to hold: */
+   for ((i = 0); (i < 9); i++) {
+      for ((j = 0); (j < 9); j++) {
+         seed = ((seed * 1103515245U) + 12345U);
+         lattice[i][j] = (int)((seed >> 16) & 0xff);
+      }
+   }
+   pixels = malloc((size_t)w * (size_t)h);
+   if (!pixels) {
+      return NULL;
+   }
+   for ((y = 0); (y < h); y++) {
+      i = ((y * 8) / h);
+      fy = (((y * 8 * 256) / h) - (i * 256));
+      for ((x = 0); (x < w); x++) {
+         j = ((x * 8) / w);
+         fx = (((x * 8 * 256) / w) - (j * 256));
+         top = ((lattice[i][j] * (256 - fx)) + (lattice[i][j + 1] * fx));
+         bottom = ((lattice[i + 1][j] * (256 - fx)) +
+                   (lattice[i + 1][j + 1] * fx));
+         pixels[(y * w) + x] = (unsigned char)(((top * (256 - fy)) +
+                                                (bottom * fy)) >> 16);
+      }
+   }
+   jpg = NULL;
+   *size = 0;
+   im = epeg_encoder_new();
+   if (!im) {
+      free(pixels);
+      return NULL;
+   }
+   epeg_quality_set(im, quality);
+   epeg_memory_output_set(im, &jpg, size);
+   ret = epeg_encode_pixels(im, pixels, EPEG_GRAY8, w, h, 0);
+   epeg_close(im);
+   free(pixels);
+   if (ret != 0) {
+      free(jpg);
+      return NULL;
+   }
+   return jpg;
+}
+
+/* static function; unnecessary to document: */
+static int hash(const char *what, unsigned char *src, int size,
+                unsigned long long int *h)
+{
+   Epeg_Image *im;
+   int ret;
+
+   im = (src ? epeg_memory_open(src, size) : NULL);
+   if (!im) {
+      printf("%s: cannot open\n", what);
+      return 1;
+   }
+   /* the decode settings have no say in the hash: */
+   epeg_decode_size_set(im, 37, 29);
+   epeg_decode_colorspace_set(im, EPEG_RGBA8);
+   ret = epeg_phash(im, h);
+   epeg_close(im);
+   if (ret != 0) {
+      printf("%s: cannot hash\n", what);
+   }
+   return ret;
+}
+
+/* static function; unnecessary to document: */
+static int source_read(void *data, unsigned char *buf, int size)
+{
+   (void)data;
+   (void)buf;
+   (void)size;
+   return 0;
+}
+
+/* main function: */
+int main(void)
+{
+   unsigned long long int a, a2, b, c;
+   unsigned char *src, *small, *other;
+   Epeg_Image *im;
+   int size, small_size, other_size, ret;
+
+   src = picture_make(1024, 768, 1U, 90, &size);
+   small = picture_make(400, 300, 1U, 50, &small_size);
+   other = picture_make(1024, 768, 2U, 90, &other_size);
+   if ((!src) || (!small) || (!other)) {
+      printf("cannot make the pictures\n");
+      return 1;
+   }
+   ret = 0;
+   if ((hash("picture", src, size, &a) != 0) ||
+       (hash("picture again", src, size, &a2) != 0) ||
+       (hash("smaller", small, small_size, &b) != 0) ||
+       (hash("other", other, other_size, &c) != 0)) {
+      return 1;
+   }
+
+   /* the same picture, then scaled and recompressed, then another one: */
+   if (a != a2) {
+      printf("the same image hashed to %llx and %llx\n", a, a2);
+      ret = 1;
+   }
+   if (epeg_phash_distance(a, b) > 10) {
+      printf("the smaller copy is %d away\n", epeg_phash_distance(a, b));
+      ret = 1;
+   }
+   if (epeg_phash_distance(a, c) < 20) {
+      printf("a different image is only %d away\n",
+             epeg_phash_distance(a, c));
+      ret = 1;
+   }
+   if ((epeg_phash_distance(0ULL, ~0ULL) != 64) ||
+       (epeg_phash_distance(0x5ULL, 0x3ULL) != 2)) {
+      printf("the distance does not count bits\n");
+      ret = 1;
+   }
+
+   /* the image decodes as usual afterwards: */
+   free(src);
+   src = test_source_make(640, 480, 90, &size);
+   im = (src ? epeg_memory_open(src, size) : NULL);
+   if (im) {
+      epeg_decode_size_set(im, 128, 96);
+      epeg_decode_colorspace_set(im, EPEG_RGB8);
+      if (epeg_phash(im, &a2) != 0) {
+         printf("cannot hash before decoding\n");
+         ret = 1;
+      }
+      ret |= test_decode_check("after hashing", im, 128, 96, 24);
+   }
+
+   /* which cannot be done with an image that is only read once: */
+   im = epeg_callback_open(source_read, NULL, 0);
+   if ((im) && (epeg_phash(im, &a2) == 0)) {
+      printf("a callback image was hashed\n");
+      ret = 1;
+   }
+   if (im) {
+      epeg_close(im);
+   }
+
+   free(other);
+   free(small);
+   free(src);
+   return ret;
+}
+
+/* EOF */
@@ -0,0 +1,194 @@
+/* test_placeholder.c */
+/* checks that placeholders show the colours and layout of the image */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+
+#define SOLID_R 200
+#define SOLID_G 40
+#define SOLID_B 120
+
+/* static function; unnecessary to document: */
+static unsigned char *solid_make(int *size)
+{
+   unsigned char *pixels, *jpg;
+   Epeg_Image *im;
+   int i, ret;
+
+   pixels = malloc((size_t)320 * 240 * 3);
+   if (!pixels) {
+      return NULL;
+   }
+   for ((i = 0); (i < (320 * 240)); i++) {
+      pixels[(i * 3)] = SOLID_R;
+      pixels[(i * 3) + 1] = SOLID_G;
+      pixels[(i * 3) + 2] = SOLID_B;
+   }
+   jpg = NULL;
+   *size = 0;
+   im = epeg_encoder_new();
+   if (!im) {
+      free(pixels);
+      return NULL;
+   }
+   epeg_quality_set(im, 95);
+   epeg_memory_output_set(im, &jpg, size);
+   ret = epeg_encode_pixels(im, pixels, EPEG_RGB8, 320, 240, 0);
+   epeg_close(im);
+   free(pixels);
+   if (ret != 0) {
+      free(jpg);
+      return NULL;
+   }
+   return jpg;
+}
+
+/* static function; unnecessary to document: */
+static int base83(const char *s, int n)
+{
+   static const char digits[] =
+      "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+      "#$%*+,-.:;=?@[]^_{|}~";
+   const char *d;
+   int v, i;
+
+   v = 0;
+   for ((i = 0); (i < n); i++) {
+      d = strchr(digits, s[i]);
+      if ((!d) || (!s[i])) {
+         return -1;
+      }
+      v = ((v * 83) + (int)(d - digits));
+   }
+   return v;
+}
+
+/* static function; unnecessary to document: */
+static int check(const char *what, Epeg_Image *im, int w, int h)
+{
+   Epeg_Placeholder ph;
+   int ret;
+
+   if ((!im) || (epeg_placeholder_get(im, &ph) != 0)) {
+      printf("%s: no placeholder\n", what);
+      if (im) {
+         epeg_close(im);
+      }
+      return 1;
+   }
+   epeg_close(im);
+   ret = 0;
+   if ((ph.w != w) || (ph.h != h)) {
+      printf("%s: a preview of %dx%d, not %dx%d\n", what, ph.w, ph.h, w, h);
+      return 1;
+   }
+   /* blurred, which leaves a gradient as it is: */
+   ret |= test_pattern_check(what, ph.preview, w, h, 40);
+   /* 4x3 or 3x4 components, which makes for 28 characters: */
+   if ((strlen(ph.blurhash) != 28) ||
+       (base83(ph.blurhash, 1) != ((w > h) ? (3 + (2 * 9)) : (2 + (3 * 9))))) {
+      printf("%s: blurhash %s\n", what, ph.blurhash);
+      ret = 1;
+   }
+   return ret;
+}
+
+/* main function: */
+int main(void)
+{
+   Epeg_Placeholder ph;
+   unsigned char *src, *out;
+   unsigned int total;
+   Epeg_Image *im;
+   int size, out_size, dc, i, ret;
+
+   ret = 0;
+   src = test_source_make(640, 480, 90, &size);
+   if (!src) {
+      printf("cannot make the source\n");
+      return 1;
+   }
+   ret |= check("landscape", epeg_memory_open(src, size), 32, 24);
+
+   /* from the pixels of a thumbnail just saved: */
+   im = epeg_memory_open(src, size);
+   if (!im) {
+      return 1;
+   }
+   out = NULL;
+   out_size = 0;
+   epeg_decode_size_set(im, 160, 120);
+   epeg_memory_output_set(im, &out, &out_size);
+   if (epeg_encode(im) != 0) {
+      printf("cannot encode\n");
+      ret = 1;
+   }
+   ret |= check("after encoding", im, 32, 24);
+   ret |= test_image_check("saved", (out ? epeg_memory_open(out, out_size) :
+                                     NULL), 160, 120, 24);
+   free(out);
+   free(src);
+
+   src = test_source_make(480, 640, 90, &size);
+   if (!src) {
+      return 1;
+   }
+   ret |= check("portrait", epeg_memory_open(src, size), 24, 32);
+
+   /* planar pixels have no colours to count: */
+   im = epeg_memory_open(src, size);
+   if (im) {
+      const void *pixels;
+
+      epeg_decode_size_set(im, 60, 80);
+      epeg_decode_colorspace_set(im, EPEG_I420);
+      pixels = epeg_pixels_get(im, 0, 0, 60, 80);
+      if ((pixels) && (epeg_placeholder_get(im, &ph) == 0)) {
+         printf("a placeholder came from I420 pixels\n");
+         ret = 1;
+      }
+      if (pixels) {
+         epeg_pixels_free(im, pixels);
+      }
+      epeg_close(im);
+   }
+   free(src);
+
+   /* one colour fills one bin, and is the dominant one and the average: */
+   src = solid_make(&size);
+   im = (src ? epeg_memory_open(src, size) : NULL);
+   if ((!im) || (epeg_placeholder_get(im, &ph) != 0)) {
+      printf("solid: no placeholder\n");
+      return 1;
+   }
+   epeg_close(im);
+   total = 0U;
+   for ((i = 0); (i < 64); i++) {
+      total += ph.histogram[i];
+   }
+   i = (((SOLID_R >> 6) << 4) | ((SOLID_G >> 6) << 2) | (SOLID_B >> 6));
+   if ((total == 0U) || (ph.histogram[i] != total)) {
+      printf("solid: %u of %u pixels in bin %d\n", ph.histogram[i], total,
+             i);
+      ret = 1;
+   }
+   if (!test_pixel_near(ph.color, SOLID_R, SOLID_G, SOLID_B, 8)) {
+      printf("solid: the colour is %d,%d,%d\n", ph.color[0], ph.color[1],
+             ph.color[2]);
+      ret = 1;
+   }
+   dc = base83((ph.blurhash + 2), 4);
+   if ((dc < 0) ||
+       (abs(((dc >> 16) & 0xff) - SOLID_R) > 8) ||
+       (abs(((dc >> 8) & 0xff) - SOLID_G) > 8) ||
+       (abs((dc & 0xff) - SOLID_B) > 8)) {
+      printf("solid: blurhash %s has the average %06x\n", ph.blurhash, dc);
+      ret = 1;
+   }
+   free(src);
+   return ret;
+}
+
+/* EOF */
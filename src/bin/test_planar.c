@@ -0,0 +1,162 @@
+/* test_planar.c */
+/* checks that the planar YUV outputs hold the planes of the image */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+
+/* JFIF YCbCr of the test pattern, in 0..255: */
+#define PATTERN_Y(r, g) \
+	((((299 * (r)) + (587 * (g)) + (114 * TEST_BLUE)) + 500) / 1000)
+#define PATTERN_CB(r, g) \
+	(128 + (((-169 * (r)) - (331 * (g)) + (500 * TEST_BLUE)) / 1000))
+#define PATTERN_CR(r, g) \
+	(128 + (((500 * (r)) - (419 * (g)) - (81 * TEST_BLUE)) / 1000))
+
+/* static function; unnecessary to document: */
+static int sample_check(const char *what, const char *plane, int got, int x,
+                        int y, int w, int h, int c)
+{
+   int r, g, want;
+
+   /* the rectangle may reach past the image, where the edge repeats: */
+   x = ((x < w) ? x : (w - 1));
+   y = ((y < h) ? y : (h - 1));
+   r = TEST_RED(x, w);
+   g = TEST_GREEN(y, h);
+   want = ((c == 0) ? PATTERN_Y(r, g) :
+           ((c == 1) ? PATTERN_CB(r, g) : PATTERN_CR(r, g)));
+   if (abs(got - want) > 24) {
+      printf("%s: %s sample at %d,%d is %d, not about %d\n", what, plane, x,
+             y, got, want);
+      return 1;
+   }
+   return 0;
+}
+
+/* static function; unnecessary to document: */
+static int check(unsigned char *src, int size, Epeg_Colorspace format,
+                 int dw, int dh, int x, int y, int w, int h)
+{
+   static const char *const names[] = { "I420", "NV12", "YUV444P" };
+   const unsigned char *pixels, *u, *v;
+   Epeg_Image *im;
+   char what[64];
+   int s, cw, ch, cstep, i, j, ret;
+
+   snprintf(what, sizeof(what), "%s of %dx%d at %d,%d", names[format -
+            EPEG_I420], w, h, x, y);
+   im = epeg_memory_open(src, size);
+   if (!im) {
+      printf("%s: cannot open\n", what);
+      return 1;
+   }
+   epeg_decode_size_set(im, dw, dh);
+   epeg_decode_colorspace_set(im, format);
+   pixels = epeg_pixels_get(im, x, y, w, h);
+   if (!pixels) {
+      printf("%s: cannot decode\n", what);
+      epeg_close(im);
+      return 1;
+   }
+
+   /* where the chroma planes start, and how their samples are spaced: */
+   s = ((format == EPEG_YUV444P) ? 1 : 2);
+   cw = ((w + s - 1) / s);
+   ch = ((h + s - 1) / s);
+   u = (pixels + ((size_t)w * (size_t)h));
+   if (format == EPEG_NV12) {
+      v = (u + 1);
+      cstep = 2;
+   } else {
+      v = (u + ((size_t)cw * (size_t)ch));
+      cstep = 1;
+   }
+
+   ret = 0;
+   for ((j = 0); ((j < h) && (ret == 0)); j++) {
+      for ((i = 0); ((i < w) && (ret == 0)); i++) {
+         ret = sample_check(what, "Y", pixels[(j * w) + i], (x + i), (y + j),
+                            dw, dh, 0);
+      }
+   }
+   for ((j = 0); ((j < ch) && (ret == 0)); j++) {
+      for ((i = 0); ((i < cw) && (ret == 0)); i++) {
+         ret = sample_check(what, "U", u[((j * cw) + i) * cstep],
+                            (x + (i * s)), (y + (j * s)), dw, dh, 1);
+         ret |= sample_check(what, "V", v[((j * cw) + i) * cstep],
+                             (x + (i * s)), (y + (j * s)), dw, dh, 2);
+      }
+   }
+   epeg_pixels_free(im, pixels);
+   epeg_close(im);
+   return ret;
+}
+
+/* static function; unnecessary to document: */
+static int check_all(unsigned char *src, int size, Epeg_Colorspace format)
+{
+   int ret;
+
+   ret = 0;
+   ret |= check(src, size, format, 320, 240, 0, 0, 320, 240);
+   ret |= check(src, size, format, 160, 120, 0, 0, 160, 120);
+   /* odd sizes, and an odd rectangle hanging off the bottom right: */
+   ret |= check(src, size, format, 161, 121, 0, 0, 161, 121);
+   ret |= check(src, size, format, 160, 120, 33, 17, 91, 67);
+   ret |= check(src, size, format, 160, 120, 150, 110, 15, 15);
+   return ret;
+}
+
+/* main function: */
+int main(void)
+{
+   static const Epeg_Colorspace formats[] = {
+      EPEG_I420, EPEG_NV12, EPEG_YUV444P
+   };
+   unsigned char *src420, *src444, *out;
+   Epeg_Image *im;
+   int size420, size444, out_size, i, ret;
+
+   /* 4:2:0, which libjpeg can hand over as it is stored, and 4:4:4, which
+    * has to be subsampled: */
+   src420 = test_source_make(320, 240, 80, &size420);
+   src444 = test_source_make(320, 240, 95, &size444);
+   if ((!src420) || (!src444)) {
+      printf("cannot make the sources\n");
+      return 1;
+   }
+   ret = 0;
+   for ((i = 0); (i < (int)(sizeof(formats) / sizeof(formats[0]))); i++) {
+      ret |= check_all(src420, size420, formats[i]);
+      ret |= check_all(src444, size444, formats[i]);
+   }
+
+   /* thumbnails saved from the planes are the image still: */
+   for ((i = 0); (i < (int)(sizeof(formats) / sizeof(formats[0]))); i++) {
+      im = epeg_memory_open(src420, size420);
+      if (!im) {
+         return 1;
+      }
+      out = NULL;
+      out_size = 0;
+      epeg_decode_size_set(im, 120, 90);
+      epeg_decode_colorspace_set(im, formats[i]);
+      epeg_memory_output_set(im, &out, &out_size);
+      if (epeg_encode(im) != 0) {
+         printf("format %d: cannot encode\n", (int)formats[i]);
+         ret = 1;
+      }
+      epeg_close(im);
+      ret |= test_image_check("saved", (out ? epeg_memory_open(out, out_size) :
+                                        NULL), 120, 90, 24);
+      free(out);
+   }
+
+   free(src444);
+   free(src420);
+   return ret;
+}
+
+/* EOF */
@@ -0,0 +1,164 @@
+/* test_rgb565.c */
+/* checks that the 16 and 32 bit outputs hold the colours of the image */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+
+/* static function; unnecessary to document: */
+static unsigned char *rgb_unpack(const void *pixels, Epeg_Colorspace format,
+                                 int w, int h)
+{
+   const unsigned short *s16;
+   const unsigned char *s32;
+   unsigned char *rgb, *p;
+   int i;
+
+   rgb = malloc((size_t)w * (size_t)h * 3);
+   if (!rgb) {
+      return NULL;
+   }
+   s16 = pixels;
+   s32 = pixels;
+   p = rgb;
+   for ((i = 0); (i < (w * h)); i++) {
+      if (format == EPEG_RGB565) {
+         /* the top bits repeated into the bottom ones, for a full range: */
+         p[0] = (unsigned char)(((s16[i] >> 8) & 0xf8) | (s16[i] >> 13));
+         p[1] = (unsigned char)(((s16[i] >> 3) & 0xfc) |
+                                ((s16[i] >> 9) & 0x03));
+         p[2] = (unsigned char)(((s16[i] << 3) & 0xf8) |
+                                ((s16[i] >> 2) & 0x07));
+      } else {
+         p[0] = s32[(i * 4)];
+         p[1] = s32[(i * 4) + 1];
+         p[2] = s32[(i * 4) + 2];
+      }
+      p += 3;
+   }
+   return rgb;
+}
+
+/* static function; unnecessary to document: */
+static unsigned char *decode(unsigned char *src, int size,
+                             Epeg_Colorspace format, int dither, int w,
+                             int h)
+{
+   const void *pixels;
+   unsigned char *rgb;
+   Epeg_Image *im;
+   int i;
+
+   im = epeg_memory_open(src, size);
+   if (!im) {
+      return NULL;
+   }
+   epeg_decode_size_set(im, w, h);
+   epeg_decode_colorspace_set(im, format);
+   epeg_decode_dither_set(im, dither);
+   pixels = epeg_pixels_get(im, 0, 0, w, h);
+   if (!pixels) {
+      epeg_close(im);
+      return NULL;
+   }
+   rgb = rgb_unpack(pixels, format, w, h);
+   if ((rgb) && (format == EPEG_RGBX8)) {
+      for ((i = 0); (i < (w * h)); i++) {
+         if (((const unsigned char *)pixels)[(i * 4) + 3] != 0xff) {
+            printf("RGBX8: pixel %d has a fourth byte of %d\n", i,
+                   ((const unsigned char *)pixels)[(i * 4) + 3]);
+            free(rgb);
+            rgb = NULL;
+            break;
+         }
+      }
+   }
+   epeg_pixels_free(im, pixels);
+   epeg_close(im);
+   return rgb;
+}
+
+/* static function; unnecessary to document: */
+static int check(unsigned char *src, int size, Epeg_Colorspace format,
+                 int w, int h)
+{
+   unsigned char *plain, *dithered, *out;
+   Epeg_Image *im;
+   char what[64];
+   int out_size, i, ret;
+
+   snprintf(what, sizeof(what), "%s at %dx%d",
+            ((format == EPEG_RGB565) ? "RGB565" : "RGBX8"), w, h);
+   plain = decode(src, size, format, 0, w, h);
+   dithered = decode(src, size, format, 1, w, h);
+   if ((!plain) || (!dithered)) {
+      printf("%s: cannot decode\n", what);
+      free(dithered);
+      free(plain);
+      return 1;
+   }
+   /* 5 bits leave steps of 8, which dithering spreads over its
+    * neighbours: */
+   ret = test_pattern_check(what, plain, w, h, 32);
+   ret |= test_pattern_check(what, dithered, w, h, 32);
+   if (format == EPEG_RGB565) {
+      for ((i = 0); (i < (w * h * 3)); i++) {
+         if (plain[i] != dithered[i]) {
+            break;
+         }
+      }
+      if (i == (w * h * 3)) {
+         printf("%s: dithering changed nothing\n", what);
+         ret = 1;
+      }
+   } else if (memcmp(plain, dithered, ((size_t)w * (size_t)h * 3)) != 0) {
+      printf("%s: dithering changed 8 bit pixels\n", what);
+      ret = 1;
+   }
+   free(dithered);
+   free(plain);
+
+   /* and thumbnails saved from them are the image still: */
+   im = epeg_memory_open(src, size);
+   if (!im) {
+      return 1;
+   }
+   out = NULL;
+   out_size = 0;
+   epeg_decode_size_set(im, w, h);
+   epeg_decode_colorspace_set(im, format);
+   epeg_memory_output_set(im, &out, &out_size);
+   if (epeg_encode(im) != 0) {
+      printf("%s: cannot encode\n", what);
+      ret = 1;
+   }
+   epeg_close(im);
+   ret |= test_image_check(what, (out ? epeg_memory_open(out, out_size) :
+                                  NULL), w, h, 32);
+   free(out);
+   return ret;
+}
+
+/* main function: */
+int main(void)
+{
+   unsigned char *src;
+   int size, ret;
+
+   src = test_source_make(640, 480, 95, &size);
+   if (!src) {
+      printf("cannot make the source\n");
+      return 1;
+   }
+   ret = 0;
+   ret |= check(src, size, EPEG_RGB565, 640, 480);
+   ret |= check(src, size, EPEG_RGB565, 160, 120);
+   ret |= check(src, size, EPEG_RGB565, 201, 149);
+   ret |= check(src, size, EPEG_RGBX8, 640, 480);
+   ret |= check(src, size, EPEG_RGBX8, 201, 149);
+   free(src);
+   return ret;
+}
+
+/* EOF */
@@ -0,0 +1,132 @@
+/* test_rows.c */
+/* checks that rows decoded one by one are those of the whole image */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+
+/* the rows seen by the callback: */
+typedef struct _Rows Rows;
+struct _Rows {
+   unsigned char *data;
+   int bpp, w, h;
+   int next, stop_at, bad;
+};
+
+/* static function; unnecessary to document: */
+static int rows_take(void *data, const void *row, int y, int w)
+{
+   Rows *r = data;
+
+   /* from the top down, each once and at the full width: */
+   if ((y != r->next) || (w != r->w) || (y >= r->h)) {
+      r->bad = 1;
+      return 1;
+   }
+   memcpy((r->data + ((size_t)y * (size_t)w * (size_t)r->bpp)), row,
+          ((size_t)w * (size_t)r->bpp));
+   r->next++;
+   return (r->next == r->stop_at);
+}
+
+/* static function; unnecessary to document: */
+static int check(unsigned char *src, int size, Epeg_Colorspace format,
+                 int bpp, int w, int h, int stop_at)
+{
+   const void *pixels;
+   Epeg_Image *im;
+   Rows r;
+   char what[64];
+   int ret;
+
+   snprintf(what, sizeof(what), "colorspace %d at %dx%d", (int)format, w, h);
+   memset(&r, 0, sizeof(r));
+   r.bpp = bpp;
+   r.w = w;
+   r.h = h;
+   r.stop_at = stop_at;
+   r.data = calloc((size_t)w * (size_t)h, (size_t)bpp);
+   im = (r.data ? epeg_memory_open(src, size) : NULL);
+   if (!im) {
+      free(r.data);
+      return 1;
+   }
+   epeg_decode_size_set(im, w, h);
+   epeg_decode_colorspace_set(im, format);
+   ret = epeg_rows_decode(im, rows_take, &r);
+   epeg_close(im);
+   if ((ret != 0) || (r.bad) || (r.next != ((stop_at > 0) ? stop_at : h))) {
+      printf("%s: returned %d after %d rows%s\n", what, ret, r.next,
+             ((r.bad) ? ", out of order" : ""));
+      free(r.data);
+      return 1;
+   }
+
+   /* the same bytes as epeg_pixels_get() gives, as far as they came: */
+   im = epeg_memory_open(src, size);
+   if (!im) {
+      free(r.data);
+      return 1;
+   }
+   epeg_decode_size_set(im, w, h);
+   epeg_decode_colorspace_set(im, format);
+   pixels = epeg_pixels_get(im, 0, 0, w, h);
+   ret = 0;
+   if ((!pixels) ||
+       (memcmp(pixels, r.data,
+               ((size_t)r.next * (size_t)w * (size_t)bpp)) != 0)) {
+      printf("%s: the rows are not the pixels\n", what);
+      ret = 1;
+   }
+   if ((format == EPEG_RGB8) && (stop_at == 0)) {
+      ret |= test_pattern_check(what, r.data, w, h, 24);
+   }
+   if (pixels) {
+      epeg_pixels_free(im, pixels);
+   }
+   epeg_close(im);
+   free(r.data);
+   return ret;
+}
+
+/* main function: */
+int main(void)
+{
+   unsigned char *src;
+   Epeg_Image *im;
+   Rows r;
+   int size, ret;
+
+   src = test_source_make(640, 480, 90, &size);
+   if (!src) {
+      printf("cannot make the source\n");
+      return 1;
+   }
+   ret = 0;
+   ret |= check(src, size, EPEG_RGB8, 3, 640, 480, 0);
+   ret |= check(src, size, EPEG_RGB8, 3, 160, 120, 0);
+   ret |= check(src, size, EPEG_RGB8, 3, 201, 149, 0);
+   ret |= check(src, size, EPEG_GRAY8, 1, 201, 149, 0);
+   ret |= check(src, size, EPEG_RGBA8, 4, 160, 120, 0);
+   ret |= check(src, size, EPEG_RGB565, 2, 201, 149, 0);
+   /* a callback can stop the decode: */
+   ret |= check(src, size, EPEG_RGB8, 3, 160, 120, 10);
+
+   /* the planar colorspaces do not come in rows: */
+   memset(&r, 0, sizeof(r));
+   im = epeg_memory_open(src, size);
+   if (im) {
+      epeg_decode_colorspace_set(im, EPEG_I420);
+      if (epeg_rows_decode(im, rows_take, &r) == 0) {
+         printf("I420 rows were decoded\n");
+         ret = 1;
+      }
+      epeg_close(im);
+   }
+
+   free(src);
+   return ret;
+}
+
+/* EOF */
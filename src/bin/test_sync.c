@@ -0,0 +1,189 @@
+/* test_sync.c */
+/* checks atomic file output and group commits */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "test_common.h"
+
+#define DIR_OUT "test_sync.d"
+
+/* static function; unnecessary to document: */
+static int encode(unsigned char *src, int size, const char *file, int atomic,
+                  Epeg_Sync *sync, int warnings)
+{
+   Epeg_Image *im;
+   int ret;
+
+   im = epeg_memory_open(src, size);
+   if (!im) {
+      return 1;
+   }
+   epeg_decode_size_set(im, 64, 48);
+   epeg_decode_warnings_max_set(im, warnings);
+   epeg_quality_set(im, 90);
+   epeg_file_output_set(im, file);
+   epeg_file_output_atomic_set(im, atomic);
+   epeg_file_output_sync_set(im, sync);
+   ret = epeg_encode(im);
+   epeg_close(im);
+   return ret;
+}
+
+/* static function; unnecessary to document: */
+static int files_count(void)
+{
+   struct dirent *e;
+   DIR *d;
+   int n;
+
+   d = opendir(DIR_OUT);
+   if (!d) {
+      return -1;
+   }
+   n = 0;
+   while ((e = readdir(d))) {
+      if (e->d_name[0] != '.') {
+         n++;
+      }
+   }
+   closedir(d);
+   return n;
+}
+
+/* static function; unnecessary to document: */
+static void files_remove(void)
+{
+   struct dirent *e;
+   DIR *d;
+   char path[512];
+
+   d = opendir(DIR_OUT);
+   if (!d) {
+      return;
+   }
+   while ((e = readdir(d))) {
+      if (e->d_name[0] != '.') {
+         snprintf(path, sizeof(path), "%s/%s", DIR_OUT, e->d_name);
+         remove(path);
+      }
+   }
+   closedir(d);
+   rmdir(DIR_OUT);
+}
+
+/* main function: */
+int main(void)
+{
+   static const char old[] = "not a jpeg yet";
+   unsigned char *src, *bad;
+   Epeg_Sync *sync;
+   char path[64], buf[sizeof(old)];
+   FILE *f;
+   int size, ret, i;
+
+   src = test_source_make(128, 96, 90, &size);
+   files_remove();
+   if ((!src) || (mkdir(DIR_OUT, 0777) != 0)) {
+      printf("cannot set up\n");
+      return 1;
+   }
+   ret = 0;
+
+   /* a failed atomic encode leaves the old file alone and no temporary; the
+    * restart markers in the scan make the decode give up: */
+   bad = malloc((size_t)size);
+   if (!bad) {
+      return 1;
+   }
+   memcpy(bad, src, (size_t)size);
+   for ((i = (size / 2)); (i < (size - 16)); (i += 16)) {
+      bad[i] = 0xff;
+      bad[i + 1] = 0xd5;
+   }
+   f = fopen(DIR_OUT "/a.jpg", "wb");
+   if ((!f) || (fwrite(old, 1, sizeof(old), f) != sizeof(old))) {
+      printf("cannot write the old file\n");
+      return 1;
+   }
+   fclose(f);
+   if (encode(bad, size, DIR_OUT "/a.jpg", 1, NULL, 1) == 0) {
+      printf("a corrupt source encoded\n");
+      ret = 1;
+   }
+   f = fopen(DIR_OUT "/a.jpg", "rb");
+   if ((!f) || (fread(buf, 1, sizeof(buf), f) != sizeof(old)) ||
+       (memcmp(buf, old, sizeof(old)) != 0)) {
+      printf("the failed encode changed the old file\n");
+      ret = 1;
+   }
+   if (f) {
+      fclose(f);
+   }
+   if (files_count() != 1) {
+      printf("%d files after a failed encode\n", files_count());
+      ret = 1;
+   }
+
+   /* and a good one replaces it: */
+   if (encode(src, size, DIR_OUT "/a.jpg", 1, NULL, 0) != 0) {
+      printf("atomic encode failed\n");
+      ret = 1;
+   }
+   ret |= test_image_check("atomic output",
+                           epeg_file_open(DIR_OUT "/a.jpg"), 64, 48, 24);
+   if (files_count() != 1) {
+      printf("%d files after an atomic encode\n", files_count());
+      ret = 1;
+   }
+
+   /* a wave of three commits the files together: */
+   sync = epeg_sync_new(3, 0);
+   if (!sync) {
+      printf("cannot make a group commit\n");
+      return 1;
+   }
+   for ((i = 0); (i < 4); i++) {
+      snprintf(path, sizeof(path), "%s/s%d.jpg", DIR_OUT, i);
+      if (encode(src, size, path, 0, sync, 0) != 0) {
+         printf("%s: encode failed\n", path);
+         ret = 1;
+      }
+      if ((i < 2) && (access(path, F_OK) == 0)) {
+         printf("%s: visible before its wave\n", path);
+         ret = 1;
+      }
+      if ((i == 2) && (access(DIR_OUT "/s0.jpg", F_OK) != 0)) {
+         printf("s0.jpg: not there after its wave\n");
+         ret = 1;
+      }
+   }
+   if (access(DIR_OUT "/s3.jpg", F_OK) == 0) {
+      printf("s3.jpg: visible before its wave\n");
+      ret = 1;
+   }
+   if (epeg_sync_flush(sync) != 0) {
+      printf("the flush failed\n");
+      ret = 1;
+   }
+   for ((i = 0); (i < 4); i++) {
+      snprintf(path, sizeof(path), "%s/s%d.jpg", DIR_OUT, i);
+      ret |= test_image_check(path, epeg_file_open(path), 64, 48, 24);
+   }
+   if (files_count() != 5) {
+      printf("%d files after the waves\n", files_count());
+      ret = 1;
+   }
+   epeg_sync_free(sync);
+   epeg_sync_free(NULL);
+
+   files_remove();
+   free(bad);
+   free(src);
+   return ret;
+}
+
+/* EOF */
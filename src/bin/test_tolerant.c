@@ -0,0 +1,169 @@
+/* test_tolerant.c */
+/* checks how much of a broken image decodes, and what fills in the rest */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test_common.h"
+
+#define W 320
+#define H 240
+
+/* static function; unnecessary to document: */
+static int check(const char *what, unsigned char *src, int size,
+                 int tolerant, int max, int broken)
+{
+   const unsigned char *pixels, *p, *last;
+   Epeg_Image *im;
+   int rows, x, y, ret;
+
+   im = epeg_memory_open(src, size);
+   if (!im) {
+      printf("%s: cannot open\n", what);
+      return 1;
+   }
+   epeg_decode_tolerant_set(im, tolerant);
+   epeg_decode_warnings_max_set(im, max);
+   epeg_decode_colorspace_set(im, EPEG_RGB8);
+   pixels = epeg_pixels_get(im, 0, 0, W, H);
+   if (broken < 0) {
+      /* an error that tolerance does not get past: */
+      ret = 0;
+      if (pixels) {
+         printf("%s: decoded\n", what);
+         epeg_pixels_free(im, pixels);
+         ret = 1;
+      }
+      epeg_close(im);
+      return ret;
+   }
+   if (!pixels) {
+      printf("%s: cannot decode\n", what);
+      epeg_close(im);
+      return 1;
+   }
+
+   rows = epeg_decode_rows_valid_get(im);
+   ret = 0;
+   if ((broken) ? ((rows <= 0) || (rows >= H)) : (rows != H)) {
+      printf("%s: %d valid rows of %d\n", what, rows, H);
+      ret = 1;
+      rows = 0;
+   }
+   /* the rows above the damage are the image: */
+   for ((y = 0); ((y < rows) && (ret == 0)); y++) {
+      for ((x = 0); (x < W); x++) {
+         p = (pixels + ((((size_t)y * W) + (size_t)x) * 3));
+         if (!test_pixel_near(p, TEST_RED(x, W), TEST_GREEN(y, H), TEST_BLUE,
+                              24)) {
+            printf("%s: pixel %d,%d above the damage is %d,%d,%d\n", what,
+                   x, y, p[0], p[1], p[2]);
+            ret = 1;
+            break;
+         }
+      }
+   }
+   /* and below it, the last of them rather than grey: */
+   if ((tolerant) && (rows > 0)) {
+      last = (pixels + ((size_t)(rows - 1) * W * 3));
+      for ((y = rows); (y < H); y++) {
+         if (memcmp((pixels + ((size_t)y * W * 3)), last, (W * 3)) != 0) {
+            printf("%s: row %d is not the last good row %d\n", what, y,
+                   (rows - 1));
+            ret = 1;
+            break;
+         }
+      }
+   }
+   epeg_pixels_free(im, pixels);
+   epeg_close(im);
+   return ret;
+}
+
+/* static function; unnecessary to document: */
+static int check_trim(unsigned char *src, int size, int tolerant)
+{
+   unsigned char *out;
+   Epeg_Image *im;
+   int out_size, w, h, ret;
+
+   im = epeg_memory_open(src, size);
+   if (!im) {
+      return 1;
+   }
+   out = NULL;
+   out_size = 0;
+   epeg_decode_tolerant_set(im, tolerant);
+   epeg_decode_bounds_set(im, 16, 16, (W - 32), (H - 32));
+   epeg_memory_output_set(im, &out, &out_size);
+   ret = epeg_trim(im);
+   epeg_close(im);
+   if ((ret == 0) != (tolerant != 0)) {
+      printf("trim, tolerant %d: returned %d\n", tolerant, ret);
+      free(out);
+      return 1;
+   }
+   ret = 0;
+   if (tolerant) {
+      im = (out ? epeg_memory_open(out, out_size) : NULL);
+      w = 0;
+      h = 0;
+      if (im) {
+         epeg_size_get(im, &w, &h);
+         epeg_close(im);
+      }
+      if ((w != (W - 32)) || (h != (H - 32))) {
+         printf("trim: the output is %dx%d\n", w, h);
+         ret = 1;
+      }
+   }
+   free(out);
+   return ret;
+}
+
+/* main function: */
+int main(void)
+{
+   unsigned char *src, *bad;
+   int size, i, ret;
+
+   src = test_source_make(W, H, 90, &size);
+   bad = (src ? malloc((size_t)size) : NULL);
+   if (!bad) {
+      printf("cannot make the source\n");
+      return 1;
+   }
+   ret = 0;
+   ret |= check("intact", src, size, 0, 0, 0);
+   ret |= check("intact, tolerant", src, size, 1, 0, 0);
+
+   /* a download that broke off only warns, but the rest is grey: */
+   ret |= check("truncated", src, (size / 2), 0, 0, 1);
+   ret |= check("truncated, tolerant", src, (size / 2), 1, 0, 1);
+
+   /* a frame header in the middle of the scan is an error: */
+   memcpy(bad, src, (size_t)size);
+   bad[size / 2] = 0xff;
+   bad[(size / 2) + 1] = 0xc0;
+   ret |= check("marker", bad, size, 0, 0, -1);
+   ret |= check("marker, tolerant", bad, size, 1, 0, 1);
+   ret |= check_trim(bad, size, 0);
+   ret |= check_trim(bad, size, 1);
+
+   /* damage throughout warns often, which a limit stops at even when
+    * tolerant; libjpeg resyncs at each restart marker, so the data that
+    * follows is kept: */
+   memcpy(bad, src, (size_t)size);
+   for ((i = (size / 2)); (i < (size - 4)); i += 16) {
+      bad[i] = 0xff;
+      bad[i + 1] = 0xd5;
+   }
+   ret |= check("damaged", bad, size, 0, 0, 1);
+   ret |= check("damaged, limited", bad, size, 1, 1, -1);
+
+   free(bad);
+   free(src);
+   return ret;
+}
+
+/* EOF */
@@ -19,11 +19,85 @@ typedef enum _Epeg_Colorspace {
 	EPEG_RGBA8,
 	EPEG_BGRA8,
 	EPEG_ARGB32,
-	EPEG_CMYK
+	EPEG_CMYK,
+	EPEG_I420,
+	EPEG_NV12,
+	EPEG_YUV444P,
+	EPEG_RGB565,
+	EPEG_RGBX8
 } Epeg_Colorspace;
 
+typedef enum _Epeg_Encode_Profile {
+	EPEG_PROFILE_DEFAULT,
+	EPEG_PROFILE_FASTEST,
+	EPEG_PROFILE_BALANCED,
+	EPEG_PROFILE_SMALLEST
+} Epeg_Encode_Profile;
+
+typedef enum _Epeg_Dct_Method {
+	EPEG_DCT_AUTO,
+	EPEG_DCT_ISLOW,
+	EPEG_DCT_IFAST,
+	EPEG_DCT_FLOAT
+} Epeg_Dct_Method;
+
+typedef enum _Epeg_Subsampling {
+	EPEG_SUBSAMPLING_AUTO,
+	EPEG_SUBSAMPLING_444,
+	EPEG_SUBSAMPLING_422,
+	EPEG_SUBSAMPLING_420
+} Epeg_Subsampling;
+
+typedef enum _Epeg_Marker {
+	EPEG_MARKER_NONE      = 0,
+	EPEG_MARKER_JFIF      = (1 << 0),
+	EPEG_MARKER_COMMENT   = (1 << 1),
+	EPEG_MARKER_THUMBNAIL = (1 << 2),
+	EPEG_MARKER_ALL       = 0x7
+} Epeg_Marker;
+
+typedef enum _Epeg_Cache {
+	EPEG_CACHE_DEFAULT    = 0,
+	EPEG_CACHE_SEQUENTIAL = (1 << 0),
+	EPEG_CACHE_WILLNEED   = (1 << 1),
+	EPEG_CACHE_DONTNEED   = (1 << 2),
+	EPEG_CACHE_DIRECT     = (1 << 3)
+} Epeg_Cache;
+
+typedef enum _Epeg_Check {
+	EPEG_CHECK_OK,
+	EPEG_CHECK_NOT_JPEG,
+	EPEG_CHECK_BAD_MARKER,
+	EPEG_CHECK_NO_FRAME,
+	EPEG_CHECK_NO_SCAN,
+	EPEG_CHECK_TRUNCATED,
+	EPEG_CHECK_NO_EOI,
+	EPEG_CHECK_IO
+} Epeg_Check;
+
+typedef enum _Epeg_Feed_State {
+	EPEG_FEED_ERROR = -1,
+	EPEG_FEED_MORE,
+	EPEG_FEED_HEADER,
+	EPEG_FEED_ROWS,
+	EPEG_FEED_COMPLETE
+} Epeg_Feed_State;
+
+typedef enum _Epeg_Fit {
+	EPEG_FIT_FILL,
+	EPEG_FIT_CONTAIN,
+	EPEG_FIT_COVER
+} Epeg_Fit;
+
 typedef struct _Epeg_Image Epeg_Image;
 typedef struct _Epeg_Thumbnail_Info Epeg_Thumbnail_Info;
+typedef struct _Epeg_Encode_Stats Epeg_Encode_Stats;
+typedef struct _Epeg_Sync Epeg_Sync;
+typedef struct _Epeg_Placeholder Epeg_Placeholder;
+
+typedef int (*Epeg_Input_Cb)(void *data, unsigned char *buf, int size);
+typedef int (*Epeg_Output_Cb)(void *data, const unsigned char *buf, int size);
+typedef int (*Epeg_Row_Cb)(void *data, const void *row, int y, int w);
 
 struct _Epeg_Thumbnail_Info {
 	char *uri;
@@ -36,28 +110,94 @@ struct _Epeg_Thumbnail_Info {
 	char  *mimetype;
 };
 
+struct _Epeg_Encode_Stats {
+	int size;
+	int markers_saved;
+};
+
+struct _Epeg_Placeholder {
+	unsigned char color[3];
+	unsigned int histogram[64];
+	int w, h;
+	unsigned char preview[32 * 32 * 3];
+	char blurhash[32];
+};
+
+extern Epeg_Check epeg_file_check(const char *file, int eoi);
+extern Epeg_Check epeg_memory_check(const unsigned char *data, int size,
+									int eoi);
 extern Epeg_Image *epeg_file_open(const char *file);
 extern Epeg_Image *epeg_memory_open(unsigned char *data, int size);
+extern Epeg_Image *epeg_file_open_with_tables(const char *file,
+											  unsigned char *tables,
+											  int tables_size);
+extern Epeg_Image *epeg_memory_open_with_tables(unsigned char *data, int size,
+												unsigned char *tables,
+												int tables_size);
+extern Epeg_Image *epeg_callback_open(Epeg_Input_Cb func, void *data,
+									  int buffer_size);
+extern Epeg_Image *epeg_fd_open(int fd, int cache);
+extern Epeg_Image *epeg_feed_open(void);
+extern Epeg_Feed_State epeg_feed(Epeg_Image *im, const unsigned char *bytes,
+								 int len);
+extern int epeg_feed_rows_get(Epeg_Image *im);
 extern void epeg_size_get(Epeg_Image *im, int *w, int *h);
 extern void epeg_decode_size_set(Epeg_Image *im, int w, int h);
 extern void epeg_decode_colorspace_set(Epeg_Image *im,
 									   Epeg_Colorspace colorspace);
+extern void epeg_decode_dither_set(Epeg_Image *im, int onoff);
+extern void epeg_decode_tolerant_set(Epeg_Image *im, int onoff);
+extern void epeg_decode_warnings_max_set(Epeg_Image *im, int max);
+extern int epeg_decode_rows_valid_get(Epeg_Image *im);
 extern const void *epeg_pixels_get(Epeg_Image *im, int x, int y, int w, int h);
 extern void epeg_pixels_free(Epeg_Image *im, const void *data);
+extern int epeg_rows_decode(Epeg_Image *im, Epeg_Row_Cb func, void *data);
+extern int epeg_phash(Epeg_Image *im, unsigned long long int *hash);
+extern int epeg_phash_distance(unsigned long long int a,
+							   unsigned long long int b);
+extern int epeg_placeholder_get(Epeg_Image *im, Epeg_Placeholder *ph);
 extern const char *epeg_comment_get(Epeg_Image *im);
 extern void epeg_thumbnail_comments_get(Epeg_Image *im,
 										Epeg_Thumbnail_Info *info);
 extern void epeg_comment_set(Epeg_Image *im, const char *comment);
 extern void epeg_quality_set(Epeg_Image *im, int quality);
 extern void epeg_thumbnail_comments_enable(Epeg_Image *im, int onoff);
+extern void epeg_encode_profile_set(Epeg_Image *im,
+									Epeg_Encode_Profile profile);
+extern void epeg_encode_dct_method_set(Epeg_Image *im, Epeg_Dct_Method method);
+extern void epeg_encode_optimize_set(Epeg_Image *im, int onoff);
+extern void epeg_encode_subsampling_set(Epeg_Image *im,
+										Epeg_Subsampling subsampling);
+extern void epeg_encode_batch_set(Epeg_Image *im, int rows);
+extern void epeg_encode_progressive_set(Epeg_Image *im, int onoff);
+extern void epeg_encode_markers_set(Epeg_Image *im, int markers);
+extern void epeg_encode_stats_get(Epeg_Image *im, Epeg_Encode_Stats *stats);
+extern void epeg_encode_abbreviated_set(Epeg_Image *im, int onoff);
+extern void epeg_encode_passthrough_set(Epeg_Image *im, int onoff);
+extern int epeg_tables_encode(int quality, unsigned char **data, int *size);
 extern void epeg_file_output_set(Epeg_Image *im, const char *file);
 extern void epeg_memory_output_set(Epeg_Image *im, unsigned char **data,
 								   int *size);
+extern void epeg_callback_output_set(Epeg_Image *im, Epeg_Output_Cb func,
+									 void *data, int chunk);
+extern void epeg_file_output_atomic_set(Epeg_Image *im, int onoff);
+extern void epeg_file_output_mmap_set(Epeg_Image *im, int onoff);
+extern void epeg_file_output_sync_set(Epeg_Image *im, Epeg_Sync *sync);
+extern Epeg_Sync *epeg_sync_new(int files, int msec);
+extern int epeg_sync_flush(Epeg_Sync *sync);
+extern void epeg_sync_free(Epeg_Sync *sync);
 extern int epeg_encode(Epeg_Image *im);
+extern Epeg_Image *epeg_encoder_new(void);
+extern int epeg_encode_pixels(Epeg_Image *im, const void *pixels,
+							  Epeg_Colorspace format, int w, int h,
+							  int stride);
 extern int epeg_trim(Epeg_Image *im);
 extern void epeg_close(Epeg_Image *im);
 extern void epeg_colorspace_get(Epeg_Image *im, int *space);
 extern void epeg_decode_bounds_set(Epeg_Image *im, int x, int y, int w, int h);
+extern void epeg_decode_crop_set(Epeg_Image *im, int x, int y, int w, int h);
+extern int epeg_decode_smart_crop_set(Epeg_Image *im, int w, int h);
+extern void epeg_decode_fit_set(Epeg_Image *im, int w, int h, Epeg_Fit fit);
 extern const void *epeg_pixels_get_as_RGB8(Epeg_Image *im,
 										   int x, int y, int w, int h);
 
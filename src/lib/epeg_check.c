@@ -0,0 +1,257 @@
+/* epeg_check.c */
+/* gets built into the libepeg library */
+
+#include <stdio.h>
+#include <errno.h>
+#include "Epeg.h"
+#include "epeg_private.h"
+
+/* internal private-only struct and typedef; unnecessary to document: */
+typedef struct _epeg_check_src epeg_check_src;
+struct _epeg_check_src
+{
+   const unsigned char *data;
+   int fd;
+   off_t start, size;
+   off_t base;
+   size_t have;
+   unsigned char buf[4096];
+};
+
+/* static internal private-only function; unnecessary to document: */
+static const unsigned char *_epeg_check_peek(epeg_check_src *src, off_t pos,
+                                             size_t len)
+{
+   ssize_t n;
+
+   if ((pos < 0) || ((pos + (off_t)len) > src->size)) {
+      return NULL;
+   }
+   if (src->data) {
+      return (src->data + pos);
+   }
+   if ((pos >= src->base) &&
+       ((pos + (off_t)len) <= (src->base + (off_t)src->have))) {
+      return (src->buf + (pos - src->base));
+   }
+   /* markers are far apart when there is a big APPn segment in between,
+    * so only read around the one that is needed next: */
+   do {
+      n = pread(src->fd, src->buf, sizeof(src->buf), (src->start + pos));
+   } while ((n < 0) && (errno == EINTR));
+   if (n < (ssize_t)len) {
+      src->have = 0;
+      return NULL;
+   }
+   src->base = pos;
+   src->have = (size_t)n;
+   return src->buf;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static Epeg_Check _epeg_check_run(epeg_check_src *src, int eoi)
+{
+   const unsigned char *d;
+   off_t pos, seg;
+   int frame;
+
+   d = _epeg_check_peek(src, (off_t)0, (size_t)2);
+   if ((!d) || (d[0] != 0xff) || (d[1] != 0xd8)) {
+      return EPEG_CHECK_NOT_JPEG;
+   }
+   frame = 0;
+   for ((pos = 2); ; ) {
+      int marker;
+
+      d = _epeg_check_peek(src, pos, (size_t)2);
+      if (!d) {
+         return (((pos + 2) > src->size) ? EPEG_CHECK_TRUNCATED :
+                 EPEG_CHECK_IO);
+      }
+      if (d[0] != 0xff) {
+         /* libjpeg skips stray bytes up to the next marker with just a
+          * warning, so they are no reason to turn the file away: */
+         pos++;
+         continue;
+      }
+      marker = d[1];
+      if (marker == 0xff) {
+         /* fill byte: */
+         pos++;
+         continue;
+      }
+      if (marker == 0x00) {
+         /* a stuffed 0xff, skipped along with the stray bytes: */
+         pos += 2;
+         continue;
+      }
+      if ((marker == 0x01) || ((marker >= 0xd0) && (marker <= 0xd7))) {
+         /* TEM and RSTn stand alone: */
+         pos += 2;
+         continue;
+      }
+      if (marker == 0xd8) {
+         return EPEG_CHECK_BAD_MARKER;
+      }
+      if (marker == 0xd9) {
+         return EPEG_CHECK_NO_SCAN;
+      }
+
+      d = _epeg_check_peek(src, (pos + 2), (size_t)2);
+      if (!d) {
+         return (((pos + 4) > src->size) ? EPEG_CHECK_TRUNCATED :
+                 EPEG_CHECK_IO);
+      }
+      seg = (off_t)((d[0] << 8) | d[1]);
+      if (seg < 2) {
+         return EPEG_CHECK_BAD_MARKER;
+      }
+      if ((pos + 2 + seg) > src->size) {
+         return EPEG_CHECK_TRUNCATED;
+      }
+      if ((marker >= 0xc0) && (marker <= 0xcf) && (marker != 0xc4) &&
+          (marker != 0xc8) && (marker != 0xcc)) {
+         /* SOFn: precision, height, width and component count at least */
+         if (seg < 8) {
+            return EPEG_CHECK_BAD_MARKER;
+         }
+         frame = 1;
+      }
+      if (marker == 0xda) {
+         if (!frame) {
+            return EPEG_CHECK_NO_FRAME;
+         }
+         break;
+      }
+      pos += (2 + seg);
+   }
+
+   if (eoi) {
+      /* allow for zero padding after the end of the image, going back over
+       * it a block at a time: */
+      for ((pos = src->size); (pos > 2); ) {
+         off_t start;
+         size_t len;
+
+         start = (pos - (off_t)sizeof(src->buf));
+         if (start < 2) {
+            start = 2;
+         }
+         len = (size_t)(pos - start);
+         d = _epeg_check_peek(src, start, len);
+         if (!d) {
+            break;
+         }
+         while ((len > 0) && (d[len - 1] == 0x00)) {
+            len--;
+         }
+         pos = (start + (off_t)len);
+         if (len > 0) {
+            break;
+         }
+      }
+      d = _epeg_check_peek(src, (pos - 2), (size_t)2);
+      if ((!d) || (d[0] != 0xff) || (d[1] != 0xd9)) {
+         return EPEG_CHECK_NO_EOI;
+      }
+   }
+   return EPEG_CHECK_OK;
+}
+
+/**
+ * Check that data in memory looks like a JPEG image, without decoding it.
+ * @param data A pointer to the memory containing the JPEG data.
+ * @param size The size of the memory segment containing the JPEG.
+ * @param eoi Whether to also require the end-of-image marker at the end.
+ * @return EPEG_CHECK_OK, or what is wrong with the data.
+ *
+ * This walks the markers of the data at @p data from the start-of-image
+ * marker to the first scan, making sure that they are in bounds and that a
+ * frame header comes before the scan, all without setting up a decoder. It
+ * is meant for turning away files that are not JPEGs at all, such as
+ * misnamed PNGs or error pages, for much less than opening them costs. A
+ * file that passes can still turn out to be broken inside its scans. Stray
+ * bytes between markers are skipped, as libjpeg skips them with a warning.
+ *
+ * With @p eoi set, the data must also end in an end-of-image marker, which
+ * catches most truncated files. Zero bytes after the marker are allowed.
+ *
+ * epeg_memory_open() and epeg_file_open() run the same check, without
+ * @p eoi, before they allocate anything.
+ *
+ * See also: epeg_file_check(), epeg_memory_open()
+ */
+extern Epeg_Check epeg_memory_check(const unsigned char *data, int size,
+                                    int eoi)
+{
+   epeg_check_src src;
+
+   if ((!data) || (size < 0)) {
+      return EPEG_CHECK_NOT_JPEG;
+   }
+   src.data = data;
+   src.fd = -1;
+   src.start = 0;
+   src.size = (off_t)size;
+   src.base = 0;
+   src.have = 0;
+   return _epeg_check_run(&src, eoi);
+}
+
+/**
+ * Check that a file looks like a JPEG image, without decoding it.
+ * @param file The file path to check.
+ * @param eoi Whether to also require the end-of-image marker at the end.
+ * @return EPEG_CHECK_OK, or what is wrong with the file.
+ *
+ * This does the same as epeg_memory_check() for the file at @p file,
+ * reading only the few kilobytes around each marker. EPEG_CHECK_IO is
+ * returned if the file cannot be opened or read.
+ *
+ * See also: epeg_memory_check(), epeg_file_open()
+ */
+extern Epeg_Check epeg_file_check(const char *file, int eoi)
+{
+   struct stat st;
+   Epeg_Check ret;
+   int fd;
+
+   fd = open(file, O_RDONLY);
+   if (fd < 0) {
+      return EPEG_CHECK_IO;
+   }
+   ret = EPEG_CHECK_IO;
+   if ((fstat(fd, &st) == 0) && (S_ISREG(st.st_mode))) {
+      ret = _epeg_fd_check(fd, (off_t)0, st.st_size, eoi);
+   }
+   close(fd);
+   return ret;
+}
+
+/* internal private-only function; unnecessary to document: */
+Epeg_Check _epeg_fd_check(int fd, off_t start, off_t size, int eoi)
+{
+   epeg_check_src src;
+
+   src.data = NULL;
+   src.fd = fd;
+   src.start = start;
+   src.size = (size - start);
+   src.base = 0;
+   src.have = 0;
+   return _epeg_check_run(&src, eoi);
+}
+
+/* various text editor settings:
+ * # Emacs: -*-
+ * coding: utf-8;
+ * mode: C;
+ * tab-width: 3;
+ * indent-tabs-mode: nil;
+ * c-basic-offset: 3
+ * # -*-
+ * # Vi:
+ * # vim:fenc=utf-8:ft=C:et:sw=3:ts=3:sts=3
+ */
+
+/* EOF */
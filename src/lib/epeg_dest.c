@@ -0,0 +1,414 @@
+/* epeg_dest.c */
+/* gets built into the libepeg library */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE 1 /* need this for copy_file_range */
+#endif /* !_GNU_SOURCE */
+#include <stdio.h>
+#include <errno.h>
+#ifdef __linux__
+# include <sys/sendfile.h>
+#endif /* __linux__ */
+#include <jerror.h>
+#include "Epeg.h"
+#include "epeg_private.h"
+
+#if defined(_POSIX_MAPPED_FILES) && (_POSIX_MAPPED_FILES > 0)
+# include <sys/mman.h>
+# define _EPEG_MMAP_DEST 1
+#endif /* _POSIX_MAPPED_FILES */
+
+/* internal private-only struct and typedef; unnecessary to document: */
+typedef struct _epeg_fd_dest_mgr epeg_fd_dest_mgr;
+struct _epeg_fd_dest_mgr
+{
+   struct jpeg_destination_mgr pub;
+   int fd;
+   JOCTET *buffer;
+   long written;
+   JOCTET *map;
+   size_t size;
+   Epeg_Output_Cb func;
+   void *data;
+};
+
+/* internal private-only function; unnecessary to document: */
+int _epeg_fd_write(int fd, const unsigned char *data, size_t len)
+{
+   while (len > 0) {
+      ssize_t n;
+
+      n = write(fd, data, len);
+      if (n < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         return 1;
+      }
+      data += n;
+      len -= (size_t)n;
+   }
+   return 0;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_fd_init_destination(j_compress_ptr cinfo)
+{
+   epeg_fd_dest_mgr *dest;
+
+   dest = (epeg_fd_dest_mgr *)cinfo->dest;
+   dest->pub.next_output_byte = dest->buffer;
+   dest->pub.free_in_buffer = EPEG_DEST_BUFFER_SIZE;
+   dest->written = 0;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static boolean _epeg_fd_empty_output_buffer(j_compress_ptr cinfo)
+{
+   epeg_fd_dest_mgr *dest;
+
+   /* libjpeg only calls this with the whole buffer full: */
+   dest = (epeg_fd_dest_mgr *)cinfo->dest;
+   if (_epeg_fd_write(dest->fd, dest->buffer, EPEG_DEST_BUFFER_SIZE) != 0) {
+      ERREXIT(cinfo, JERR_FILE_WRITE);
+   }
+   dest->written += EPEG_DEST_BUFFER_SIZE;
+   dest->pub.next_output_byte = dest->buffer;
+   dest->pub.free_in_buffer = EPEG_DEST_BUFFER_SIZE;
+   return TRUE;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_fd_term_destination(j_compress_ptr cinfo)
+{
+   epeg_fd_dest_mgr *dest;
+   size_t len;
+
+   /* jpeg_write_marker() goes through this same buffer, so an image that
+    * fits in it leaves in this one write(), headers, markers and entropy
+    * coded data together, with nothing left for a pwritev() to gather: */
+   dest = (epeg_fd_dest_mgr *)cinfo->dest;
+   len = (EPEG_DEST_BUFFER_SIZE - dest->pub.free_in_buffer);
+   if (len > 0) {
+      if (_epeg_fd_write(dest->fd, dest->buffer, len) != 0) {
+         ERREXIT(cinfo, JERR_FILE_WRITE);
+      }
+      dest->written += (long)len;
+   }
+}
+
+/* internal private-only function; unnecessary to document: */
+void _epeg_fd_dest(j_compress_ptr cinfo, int fd)
+{
+   epeg_fd_dest_mgr *dest;
+   size_t addr;
+
+   /* the compressor is created for each encode, so the permanent pool goes
+    * away with it: */
+   dest = (epeg_fd_dest_mgr *)
+      (*cinfo->mem->alloc_small)((j_common_ptr)cinfo, JPOOL_PERMANENT,
+                                 sizeof(epeg_fd_dest_mgr));
+   dest->buffer = (JOCTET *)
+      (*cinfo->mem->alloc_large)((j_common_ptr)cinfo, JPOOL_PERMANENT,
+                                 (EPEG_DEST_BUFFER_SIZE +
+                                  EPEG_DEST_BUFFER_ALIGN));
+   /* page aligned, so that the kernel can copy it out in whole pages: */
+   addr = (size_t)dest->buffer;
+   addr = ((addr + (EPEG_DEST_BUFFER_ALIGN - 1)) &
+           ~((size_t)EPEG_DEST_BUFFER_ALIGN - 1));
+   dest->buffer = (JOCTET *)addr;
+   dest->fd = fd;
+   dest->written = 0;
+   dest->map = NULL;
+   dest->size = 0;
+   dest->func = NULL;
+   dest->data = NULL;
+   dest->pub.init_destination = _epeg_fd_init_destination;
+   dest->pub.empty_output_buffer = _epeg_fd_empty_output_buffer;
+   dest->pub.term_destination = _epeg_fd_term_destination;
+   cinfo->dest = (struct jpeg_destination_mgr *)dest;
+}
+
+/* internal private-only function; unnecessary to document: */
+long _epeg_fd_dest_written(j_compress_ptr cinfo)
+{
+   return ((epeg_fd_dest_mgr *)cinfo->dest)->written;
+}
+
+#ifdef _EPEG_MMAP_DEST
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_fd_reserve(int fd, size_t size)
+{
+#if defined(_POSIX_ADVISORY_INFO) && (_POSIX_ADVISORY_INFO > 0)
+   int err;
+
+   /* real blocks, so that running out of space fails here instead of
+    * raising SIGBUS on a store into the mapping later: */
+   err = posix_fallocate(fd, (off_t)0, (off_t)size);
+   if (err == 0) {
+      return 0;
+   }
+   if ((err != EINVAL) && (err != EOPNOTSUPP)) {
+      return 1;
+   }
+#endif /* _POSIX_ADVISORY_INFO */
+   return ((ftruncate(fd, (off_t)size) == 0) ? 0 : 1);
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_mmap_grow(j_compress_ptr cinfo, size_t size)
+{
+   epeg_fd_dest_mgr *dest;
+   void *map;
+
+   dest = (epeg_fd_dest_mgr *)cinfo->dest;
+   if (_epeg_fd_reserve(dest->fd, size) != 0) {
+      ERREXIT(cinfo, JERR_FILE_WRITE);
+   }
+   if (!dest->map) {
+      map = mmap(NULL, size, (PROT_READ | PROT_WRITE), MAP_SHARED, dest->fd,
+                 (off_t)0);
+   } else {
+#ifdef MREMAP_MAYMOVE
+      map = mremap(dest->map, dest->size, size, MREMAP_MAYMOVE);
+#else
+      munmap(dest->map, dest->size);
+      dest->map = NULL;
+      map = mmap(NULL, size, (PROT_READ | PROT_WRITE), MAP_SHARED, dest->fd,
+                 (off_t)0);
+#endif /* MREMAP_MAYMOVE */
+   }
+   if (map == MAP_FAILED) {
+      ERREXIT(cinfo, JERR_FILE_WRITE);
+   }
+   dest->pub.next_output_byte = ((JOCTET *)map + dest->size);
+   dest->pub.free_in_buffer = (size - dest->size);
+   dest->map = (JOCTET *)map;
+   dest->size = size;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_mmap_init_destination(j_compress_ptr cinfo)
+{
+   epeg_fd_dest_mgr *dest;
+
+   size_t size;
+
+   dest = (epeg_fd_dest_mgr *)cinfo->dest;
+   dest->written = 0;
+   size = dest->size;
+   dest->size = 0;
+   _epeg_mmap_grow(cinfo, size);
+}
+
+/* static internal private-only function; unnecessary to document: */
+static boolean _epeg_mmap_empty_output_buffer(j_compress_ptr cinfo)
+{
+   epeg_fd_dest_mgr *dest;
+
+   dest = (epeg_fd_dest_mgr *)cinfo->dest;
+   _epeg_mmap_grow(cinfo, (dest->size * 2));
+   return TRUE;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_mmap_term_destination(j_compress_ptr cinfo)
+{
+   epeg_fd_dest_mgr *dest;
+
+   dest = (epeg_fd_dest_mgr *)cinfo->dest;
+   dest->written = (long)(dest->size - dest->pub.free_in_buffer);
+   munmap(dest->map, dest->size);
+   dest->map = NULL;
+   /* drop the part of the reservation that did not get used: */
+   if (ftruncate(dest->fd, (off_t)dest->written) != 0) {
+      ERREXIT(cinfo, JERR_FILE_WRITE);
+   }
+}
+#endif /* _EPEG_MMAP_DEST */
+
+/* internal private-only function; unnecessary to document: */
+void _epeg_mmap_dest(j_compress_ptr cinfo, int fd, size_t hint)
+{
+#ifdef _EPEG_MMAP_DEST
+   epeg_fd_dest_mgr *dest;
+   size_t page;
+
+   dest = (epeg_fd_dest_mgr *)
+      (*cinfo->mem->alloc_small)((j_common_ptr)cinfo, JPOOL_PERMANENT,
+                                 sizeof(epeg_fd_dest_mgr));
+   page = (size_t)sysconf(_SC_PAGESIZE);
+   if (hint < EPEG_DEST_BUFFER_SIZE) {
+      hint = EPEG_DEST_BUFFER_SIZE;
+   }
+   dest->buffer = NULL;
+   dest->fd = fd;
+   dest->written = 0;
+   dest->func = NULL;
+   dest->data = NULL;
+   dest->map = NULL;
+   /* the size the mapping starts out at in init: */
+   dest->size = (((hint + page) - 1) / page * page);
+   dest->pub.init_destination = _epeg_mmap_init_destination;
+   dest->pub.empty_output_buffer = _epeg_mmap_empty_output_buffer;
+   dest->pub.term_destination = _epeg_mmap_term_destination;
+   cinfo->dest = (struct jpeg_destination_mgr *)dest;
+#else
+   /* no mmap() here, so write() it is: */
+   (void)hint;
+   _epeg_fd_dest(cinfo, fd);
+#endif /* _EPEG_MMAP_DEST */
+}
+
+/* internal private-only function; unnecessary to document: */
+void _epeg_fd_dest_release(j_compress_ptr cinfo)
+{
+#ifdef _EPEG_MMAP_DEST
+   epeg_fd_dest_mgr *dest;
+
+   dest = (epeg_fd_dest_mgr *)cinfo->dest;
+   if ((dest) && (dest->map)) {
+      munmap(dest->map, dest->size);
+      dest->map = NULL;
+   }
+#else
+   (void)cinfo;
+#endif /* _EPEG_MMAP_DEST */
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_callback_init_destination(j_compress_ptr cinfo)
+{
+   epeg_fd_dest_mgr *dest;
+
+   dest = (epeg_fd_dest_mgr *)cinfo->dest;
+   dest->pub.next_output_byte = dest->buffer;
+   dest->pub.free_in_buffer = dest->size;
+   dest->written = 0;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static boolean _epeg_callback_empty_output_buffer(j_compress_ptr cinfo)
+{
+   epeg_fd_dest_mgr *dest;
+
+   dest = (epeg_fd_dest_mgr *)cinfo->dest;
+   if (dest->func(dest->data, dest->buffer, (int)dest->size) != 0) {
+      ERREXIT(cinfo, JERR_FILE_WRITE);
+   }
+   dest->written += (long)dest->size;
+   dest->pub.next_output_byte = dest->buffer;
+   dest->pub.free_in_buffer = dest->size;
+   return TRUE;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_callback_term_destination(j_compress_ptr cinfo)
+{
+   epeg_fd_dest_mgr *dest;
+   size_t len;
+
+   dest = (epeg_fd_dest_mgr *)cinfo->dest;
+   len = (dest->size - dest->pub.free_in_buffer);
+   if (len > 0) {
+      if (dest->func(dest->data, dest->buffer, (int)len) != 0) {
+         ERREXIT(cinfo, JERR_FILE_WRITE);
+      }
+      dest->written += (long)len;
+   }
+}
+
+/* internal private-only function; unnecessary to document: */
+void _epeg_callback_dest(j_compress_ptr cinfo, Epeg_Output_Cb func,
+                         void *data, int chunk)
+{
+   epeg_fd_dest_mgr *dest;
+
+   dest = (epeg_fd_dest_mgr *)
+      (*cinfo->mem->alloc_small)((j_common_ptr)cinfo, JPOOL_PERMANENT,
+                                 sizeof(epeg_fd_dest_mgr));
+   dest->size = (size_t)chunk;
+   dest->buffer = (JOCTET *)
+      (*cinfo->mem->alloc_large)((j_common_ptr)cinfo, JPOOL_PERMANENT,
+                                 dest->size);
+   dest->fd = -1;
+   dest->written = 0;
+   dest->map = NULL;
+   dest->func = func;
+   dest->data = data;
+   dest->pub.init_destination = _epeg_callback_init_destination;
+   dest->pub.empty_output_buffer = _epeg_callback_empty_output_buffer;
+   dest->pub.term_destination = _epeg_callback_term_destination;
+   cinfo->dest = (struct jpeg_destination_mgr *)dest;
+}
+
+/* internal private-only function; unnecessary to document: */
+int _epeg_fd_copy(int out, int in, off_t off, size_t len)
+{
+   unsigned char *buf;
+   ssize_t n;
+
+#ifdef __linux__
+   /* let the kernel move the bytes (or share the extents) where it can: */
+   while (len > 0) {
+      loff_t o;
+
+      o = (loff_t)off;
+      n = copy_file_range(in, &o, out, NULL, len, 0);
+      if ((n < 0) && (errno == EINTR)) {
+         continue;
+      }
+      if (n <= 0) {
+         break;
+      }
+      off += n;
+      len -= (size_t)n;
+   }
+   while (len > 0) {
+      n = sendfile(out, in, &off, len);
+      if ((n < 0) && (errno == EINTR)) {
+         continue;
+      }
+      if (n <= 0) {
+         break;
+      }
+      len -= (size_t)n;
+   }
+#endif /* __linux__ */
+
+   if (len == 0) {
+      return 0;
+   }
+   buf = malloc(EPEG_DEST_BUFFER_SIZE);
+   if (!buf) {
+      return 1;
+   }
+   while (len > 0) {
+      n = pread(in, buf, ((len < EPEG_DEST_BUFFER_SIZE) ?
+                          len : EPEG_DEST_BUFFER_SIZE), off);
+      if ((n < 0) && (errno == EINTR)) {
+         continue;
+      }
+      if ((n <= 0) || (_epeg_fd_write(out, buf, (size_t)n) != 0)) {
+         free(buf);
+         return 1;
+      }
+      off += n;
+      len -= (size_t)n;
+   }
+   free(buf);
+   return 0;
+}
+
+/* various text editor settings:
+ * # Emacs: -*-
+ * coding: utf-8;
+ * mode: C;
+ * tab-width: 3;
+ * indent-tabs-mode: nil;
+ * c-basic-offset: 3
+ * # -*-
+ * # Vi:
+ * # vim:fenc=utf-8:ft=C:et:sw=3:ts=3:sts=3
+ */
+/* EOF */
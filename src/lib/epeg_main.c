@@ -3,17 +3,77 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
+#include <jerror.h>
 #include "Epeg.h"
 #include "epeg_private.h"
 
 static Epeg_Image*_epeg_open_header(Epeg_Image *im);
+static int _epeg_header_parse(Epeg_Image *im);
 static int _epeg_decode(Epeg_Image *im);
+static int _epeg_decode_salvage(Epeg_Image *im);
+static void _epeg_decode_done(Epeg_Image *im);
+static void _epeg_decode_cmyk(Epeg_Image *im);
+static int _epeg_cmyk_row_reduce(Epeg_Image *im, const unsigned char *src,
+                                 unsigned char *dst, int w);
+static void _epeg_cmyk_row_convert(const unsigned char *src,
+                                   unsigned char *dst, int w, int inverted);
+static void _epeg_decode_params(Epeg_Image *im);
+static int _epeg_decode_setup(Epeg_Image *im);
+static int _epeg_placeholder_row(Epeg_Image *im, const unsigned char *src,
+                                 unsigned char *dst, int w);
+static void _epeg_blurhash(const unsigned char *rgb, int w, int h,
+                           char *hash);
+static int _epeg_decode_raw_check(Epeg_Image *im);
+static int _epeg_decode_box_setup(Epeg_Image *im);
+static void _epeg_decode_box(Epeg_Image *im);
+static void _epeg_decode_box_done(Epeg_Image *im);
+static int _epeg_decode_crop(Epeg_Image *im);
+static void _epeg_decode_crop_done(Epeg_Image *im);
+static int _epeg_decode_restart(Epeg_Image *im);
+static void _epeg_decode_settings_save(Epeg_Image *im,
+                                       struct _epeg_decode_settings *s);
+static void _epeg_decode_settings_restore(Epeg_Image *im,
+                                          const struct _epeg_decode_settings *s);
+static int _epeg_crop_window(Epeg_Image *im, int w, int h);
+static void _epeg_saliency_crop(Epeg_Image *im, int w, int h);
+static void _epeg_decode_raw(Epeg_Image *im);
 static int _epeg_scale(Epeg_Image *im);
+static int _epeg_scale_raw(Epeg_Image *im);
+static unsigned char *_epeg_pixels_planar_get(Epeg_Image *im, int x, int y,
+                                              int w, int h, int x0, int y0,
+                                              int x1, int y1);
 static int _epeg_decode_for_trim(Epeg_Image *im);
 static int _epeg_trim(Epeg_Image *im);
 static int _epeg_encode(Epeg_Image *im);
+static int _epeg_encode_output_open(Epeg_Image *im);
+static void _epeg_encode_begin(Epeg_Image *im, int w, int h, int components,
+                               J_COLOR_SPACE color_space, int raw);
+static int _epeg_encode_finish(Epeg_Image *im);
+static int _epeg_encode_output_close(Epeg_Image *im);
+static void _epeg_encode_abort(Epeg_Image *im);
+static void _epeg_pixels_row_convert(const unsigned char *src,
+                                     unsigned char *dst, int w,
+                                     Epeg_Colorspace format);
+static int _epeg_pixel_size(Epeg_Image *im);
+static void _epeg_rgb565_row_pack(const unsigned char *src,
+                                  unsigned char *dst, int w, int bpp, int x,
+                                  int y, int dither);
+static const unsigned char *_epeg_rows_pack(Epeg_Image *im,
+                                            const unsigned char *s, int bpp,
+                                            unsigned char *p, int w, int y);
+static void _epeg_encode_settings_apply(Epeg_Image *im);
+static void _epeg_encode_scan_script_set(Epeg_Image *im);
+static void _epeg_encode_marker_write(Epeg_Image *im, int marker, int flag,
+                                      const char *data);
+static void _epeg_encode_markers_write(Epeg_Image *im);
+static int _epeg_passthrough_check(Epeg_Image *im);
+static int _epeg_passthrough_optimized(Epeg_Image *im);
+static int _epeg_passthrough(Epeg_Image *im);
+static int _epeg_quality_estimate(Epeg_Image *im, int component);
 
 static void _epeg_fatal_error_handler(j_common_ptr cinfo);
+static void _epeg_warning_handler(j_common_ptr cinfo, int msg_level);
 
 #ifndef MIN
 # define MIN(__x,__y) ((__x) < (__y) ? (__x) : (__y))
@@ -21,6 +81,41 @@ static void _epeg_fatal_error_handler(j_common_ptr cinfo);
 #ifndef MAX
 # define MAX(__x,__y) ((__x) > (__y) ? (__x) : (__y))
 #endif /* !MAX */
+#ifndef M_PI
+# define M_PI 3.14159265358979323846
+#endif /* !M_PI */
+/* x / 255, rounded, for x up to 255 * 255, without the divide: */
+#ifndef DIV255
+# define DIV255(__x) (((((__x) + 128U) * 257U) >> 16))
+#endif /* !DIV255 */
+/* the size of a component's blocks after DCT scaling, which libjpeg 7
+ * split into a width and a height: */
+#if JPEG_LIB_VERSION >= 70
+# define EPEG_DCT_SCALED_W(__c) ((__c)->DCT_h_scaled_size)
+# define EPEG_DCT_SCALED_H(__c) ((__c)->DCT_v_scaled_size)
+#else
+# define EPEG_DCT_SCALED_W(__c) ((__c)->DCT_scaled_size)
+# define EPEG_DCT_SCALED_H(__c) ((__c)->DCT_scaled_size)
+#endif /* JPEG_LIB_VERSION >= 70 */
+/* libjpeg-turbo can decode straight to 16 bits per pixel since 1.4: */
+#if defined(LIBJPEG_TURBO_VERSION_NUMBER) && \
+    (LIBJPEG_TURBO_VERSION_NUMBER >= 1004000)
+# define EPEG_HAVE_JCS_RGB565 1
+#endif /* LIBJPEG_TURBO_VERSION_NUMBER >= 1004000 */
+/* jpeg_crop_scanline() and jpeg_skip_scanlines() came with 1.5: */
+#if defined(LIBJPEG_TURBO_VERSION_NUMBER) && \
+    (LIBJPEG_TURBO_VERSION_NUMBER >= 1005000)
+# define EPEG_HAVE_CROP_SCANLINE 1
+#endif /* LIBJPEG_TURBO_VERSION_NUMBER >= 1005000 */
+
+/* how far epeg_feed() has got with an image: */
+#define EPEG_FEED_STAGE_HEADER 0
+#define EPEG_FEED_STAGE_READY  1
+#define EPEG_FEED_STAGE_START  2
+#define EPEG_FEED_STAGE_ROWS   3
+#define EPEG_FEED_STAGE_FINISH 4
+#define EPEG_FEED_STAGE_DONE   5
+#define EPEG_FEED_STAGE_FAILED 6
 
 /**
  * Open a JPEG image by filename.
@@ -36,50 +131,406 @@ static void _epeg_fatal_error_handler(j_common_ptr cinfo);
  * thats is a relative or absolute file path. If not results are not
  * determined.
  *
- * See also: epeg_memory_open(), epeg_close()
+ * See also: epeg_memory_open(), epeg_file_open_with_tables(), epeg_close()
  */
 extern Epeg_Image *epeg_file_open(const char *file)
+{
+   return epeg_file_open_with_tables(file, NULL, 0);
+}
+
+/**
+ * Open a JPEG image stored in memory.
+ * @param data A pointer to the memory containing the JPEG data.
+ * @param size The size of the memory segment containing the JPEG.
+ * @return  A handle to the opened JPEG, with the header decoded.
+ *
+ * This function opens a JPEG file that is stored in memory pointed to by
+ * @p data, and that is @p size bytes in size. If successful a valid handle
+ * is returned, or on failure NULL is returned.
+ *
+ * See also: epeg_file_open(), epeg_memory_open_with_tables(), epeg_close()
+ */
+extern Epeg_Image *epeg_memory_open(unsigned char *data, int size)
+{
+   return epeg_memory_open_with_tables(data, size, NULL, 0);
+}
+
+/**
+ * Open an abbreviated JPEG image by filename.
+ * @param file The file path to open.
+ * @param tables A pointer to the memory containing the shared tables.
+ * @param tables_size The size of the memory segment holding the tables.
+ * @return A handle to the opened JPEG file, with the header decoded.
+ *
+ * This works like epeg_file_open(), but first loads the quantization and
+ * Huffman tables from the tables-only stream at @p tables, as written by
+ * epeg_tables_encode(). This is needed to open images that were saved with
+ * epeg_encode_abbreviated_set() enabled, since those do not carry their own
+ * tables. Tables in the image itself still override the shared ones. If
+ * @p tables is NULL, this is the same as epeg_file_open().
+ *
+ * See also: epeg_memory_open_with_tables(), epeg_tables_encode()
+ */
+extern Epeg_Image *epeg_file_open_with_tables(const char *file,
+                                              unsigned char *tables,
+                                              int tables_size)
 {
    Epeg_Image *im;
+   struct stat st;
+   int fd;
+
+   /* turn away what is not a JPEG before setting anything up for it: */
+   fd = open(file, O_RDONLY);
+   if (fd < 0) {
+      return NULL;
+   }
+   if ((fstat(fd, &st) != 0) ||
+       ((S_ISREG(st.st_mode)) &&
+        (_epeg_fd_check(fd, (off_t)0, st.st_size, 0) != EPEG_CHECK_OK))) {
+      close(fd);
+      return NULL;
+   }
 
    im = (Epeg_Image *)calloc((size_t)1, sizeof(Epeg_Image));
+   if (!im) {
+      close(fd);
+      return NULL;
+   }
+   im->stat_info = st;
    im->in.file = strdup(file);
-   im->in.f = fopen(im->in.file, "rb");
+   im->in.f = fdopen(fd, "rb");
    if (!im->in.f) {
+	   close(fd);
 	   epeg_close(im);
 	   return NULL;
    }
-   fstat(fileno(im->in.f), &(im->stat_info));
+   im->in.tables = tables;
+   im->in.tables_size = tables_size;
    im->out.quality = 75;
+   epeg_encode_profile_set(im, EPEG_PROFILE_DEFAULT);
    return _epeg_open_header(im);
 }
 
 /**
- * Open a JPEG image stored in memory.
+ * Open an abbreviated JPEG image stored in memory.
  * @param data A pointer to the memory containing the JPEG data.
  * @param size The size of the memory segment containing the JPEG.
+ * @param tables A pointer to the memory containing the shared tables.
+ * @param tables_size The size of the memory segment holding the tables.
  * @return  A handle to the opened JPEG, with the header decoded.
  *
- * This function opens a JPEG file that is stored in memory pointed to by
- * @p data, and that is @p size bytes in size. If successful a valid handle
- * is returned, or on failure NULL is returned.
+ * This works like epeg_memory_open(), loading the shared tables at
+ * @p tables first in the same way as epeg_file_open_with_tables() does.
  *
- * See also: epeg_file_open(), epeg_close()
+ * See also: epeg_file_open_with_tables(), epeg_tables_encode()
  */
-extern Epeg_Image *epeg_memory_open(unsigned char *data, int size)
+extern Epeg_Image *epeg_memory_open_with_tables(unsigned char *data, int size,
+                                                unsigned char *tables,
+                                                int tables_size)
 {
    Epeg_Image *im;
 
+   if (epeg_memory_check(data, size, 0) != EPEG_CHECK_OK) {
+      return NULL;
+   }
    im = (Epeg_Image *)calloc((size_t)1, sizeof(Epeg_Image));
+   if (!im) {
+      return NULL;
+   }
    im->in.f = _epeg_memfile_read_open(data, (size_t)size);
    if (!im->in.f) {
 	   epeg_close(im);
 	   return NULL;
    }
+   im->in.mem.data = data;
+   im->in.mem.size = size;
+   im->in.tables = tables;
+   im->in.tables_size = tables_size;
+   im->out.quality = 75;
+   epeg_encode_profile_set(im, EPEG_PROFILE_DEFAULT);
+   return _epeg_open_header(im);
+}
+
+/**
+ * Open a JPEG image read through a callback.
+ * @param func The function to read the JPEG data with.
+ * @param data A pointer passed on to @p func.
+ * @param buffer_size The number of bytes to ask @p func for at a time, or 0
+ *                    for 16KiB. At least 2 bytes are asked for.
+ * @return  A handle to the opened JPEG, with the header decoded.
+ *
+ * This opens a JPEG that is pulled through @p func, for input such as a pipe
+ * or a socket that cannot be seeked or would otherwise have to be read into
+ * memory in full first. @p func is called with a buffer of up to
+ * @p buffer_size bytes to fill, and must return the number of bytes it
+ * stored, blocking until there is at least one; it returns 0 at the end of
+ * the data and a negative value on error. Only as much is read as the header
+ * and later the decode need, so decoding starts as soon as the first
+ * scanlines are in.
+ * If successful a valid handle is returned, or on failure NULL is returned.
+ *
+ * The data can only be read once, so the image cannot be copied through with
+ * epeg_encode_passthrough_set(), and @p func and @p data have to stay valid
+ * until the image is encoded or closed.
+ *
+ * See also: epeg_file_open(), epeg_memory_open(), epeg_close()
+ */
+extern Epeg_Image *epeg_callback_open(Epeg_Input_Cb func, void *data,
+                                      int buffer_size)
+{
+   Epeg_Image *im;
+
+   if (!func) {
+      return NULL;
+   }
+   if (buffer_size < 1) {
+      buffer_size = 16384;
+   } else if (buffer_size < 2) {
+      /* room for the fake EOI that ends a short stream: */
+      buffer_size = 2;
+   }
+   im = (Epeg_Image *)calloc((size_t)1, sizeof(Epeg_Image));
+   if (!im) {
+      return NULL;
+   }
+   im->in.cb.func = func;
+   im->in.cb.data = data;
+   im->in.cb.size = buffer_size;
+   im->out.quality = 75;
+   epeg_encode_profile_set(im, EPEG_PROFILE_DEFAULT);
+   return _epeg_open_header(im);
+}
+
+/**
+ * Open a JPEG image from an open file descriptor.
+ * @param fd The descriptor to read the JPEG data from.
+ * @param cache How to use the page cache, as a mask of Epeg_Cache values.
+ * @return  A handle to the opened JPEG, with the header decoded.
+ *
+ * This opens the JPEG that starts at the current offset of @p fd. Files are
+ * read with pread(), so the offset of @p fd does not move and the descriptor
+ * can be shared; pipes and sockets are read in order instead. @p fd stays
+ * owned by the caller, and has to stay open until the image is encoded or
+ * closed.
+ * If successful a valid handle is returned, or on failure NULL is returned.
+ *
+ * @p cache controls what reading the image does to the page cache, which
+ * matters when sweeping over a large archive that is not otherwise in use:
+ *
+ * EPEG_CACHE_SEQUENTIAL and EPEG_CACHE_WILLNEED pass the matching hints to
+ * posix_fadvise() before anything is read, for more read-ahead.
+ *
+ * EPEG_CACHE_DONTNEED drops the pages that were read from the cache once the
+ * image is encoded or closed, so that the sweep does not push out the data
+ * the system is serving.
+ *
+ * EPEG_CACHE_DIRECT reads with O_DIRECT into block-aligned buffers, bypassing
+ * the cache altogether. It is turned on for @p fd only while the image is
+ * being read, and the cache is used as usual where the file system does not
+ * support it.
+ *
+ * See also: epeg_file_open(), epeg_callback_open(), epeg_close()
+ */
+extern Epeg_Image *epeg_fd_open(int fd, int cache)
+{
+   Epeg_Image *im;
+   struct stat st;
+   off_t start;
+
+   if ((fd < 0) || (fstat(fd, &st) != 0)) {
+      return NULL;
+   }
+   if (S_ISREG(st.st_mode)) {
+      start = lseek(fd, (off_t)0, SEEK_CUR);
+      if ((start < 0) ||
+          (_epeg_fd_check(fd, start, st.st_size, 0) != EPEG_CHECK_OK)) {
+         return NULL;
+      }
+   }
+   im = (Epeg_Image *)calloc((size_t)1, sizeof(Epeg_Image));
+   if (!im) {
+      return NULL;
+   }
+   im->stat_info = st;
+   im->in.fd.num = fd;
+   im->in.fd.cache = cache;
+   im->in.fd.on = 1;
    im->out.quality = 75;
+   epeg_encode_profile_set(im, EPEG_PROFILE_DEFAULT);
    return _epeg_open_header(im);
 }
 
+/**
+ * Open a JPEG image that is fed its data as it arrives.
+ * @return A handle to an image with no data yet, or NULL on failure.
+ *
+ * This creates an image for push decoding: instead of the library reading
+ * the data, the caller hands it over with epeg_feed() whenever more has
+ * arrived, and no call ever blocks waiting for data. This suits event loops
+ * that receive many images at once on a few threads.
+ *
+ * See also: epeg_feed(), epeg_callback_open(), epeg_close()
+ */
+extern Epeg_Image *epeg_feed_open(void)
+{
+   Epeg_Image *volatile im;
+
+   im = (Epeg_Image *)calloc((size_t)1, sizeof(Epeg_Image));
+   if (!im) {
+      return NULL;
+   }
+   im->out.quality = 75;
+   epeg_encode_profile_set(im, EPEG_PROFILE_DEFAULT);
+
+   im->in.jinfo.err = jpeg_std_error(&(im->jerr.pub));
+   im->jerr.pub.error_exit = _epeg_fatal_error_handler;
+   im->jerr.pub.emit_message = _epeg_warning_handler;
+
+   if (setjmp(im->jerr.setjmp_buffer)) {
+      epeg_close(im);
+      return NULL;
+   }
+
+   jpeg_create_decompress(&(im->in.jinfo));
+   im->jerr.warning_row = -1;
+   im->jerr.truncated = 0;
+   im->jerr.exceeded = 0;
+   im->in.feed.on = 1;
+   im->in.feed.stage = EPEG_FEED_STAGE_HEADER;
+   jpeg_save_markers(&(im->in.jinfo), (JPEG_APP0 + 7), 1024);
+   jpeg_save_markers(&(im->in.jinfo), JPEG_COM, 65535);
+   _epeg_feed_src(&(im->in.jinfo));
+   return im;
+}
+
+/**
+ * Feed the next bytes of a JPEG image to the decoder.
+ * @param im A handle from epeg_feed_open().
+ * @param bytes A pointer to the next bytes of the image, or NULL.
+ * @param len The number of bytes at @p bytes.
+ * @return How far the decode has got.
+ *
+ * This adds @p len bytes to the data of @p im, which is copied, and decodes
+ * as far as all data so far allows. The return value is one of:
+ *
+ * EPEG_FEED_MORE if more data is needed before anything new can be done.
+ *
+ * EPEG_FEED_HEADER once the header is complete. From then on epeg_size_get()
+ * and the other header queries work, and the decode size and colour space
+ * can be set. Decoding only starts with the next call, which can pass no
+ * bytes if all data is in already.
+ *
+ * EPEG_FEED_ROWS if more scanlines were decoded; epeg_feed_rows_get() says
+ * how many there are so far.
+ *
+ * EPEG_FEED_COMPLETE once the whole image is decoded. It can then be saved
+ * with epeg_encode() or read with epeg_pixels_get().
+ *
+ * EPEG_FEED_ERROR if the data is not a JPEG that can be decoded; the image
+ * can only be closed then.
+ *
+ * See also: epeg_feed_open(), epeg_feed_rows_get()
+ */
+extern Epeg_Feed_State epeg_feed(Epeg_Image *im, const unsigned char *bytes,
+                                 int len)
+{
+   JDIMENSION rows, n;
+
+   if ((!im->in.feed.on) || (im->in.feed.stage == EPEG_FEED_STAGE_FAILED)) {
+      return EPEG_FEED_ERROR;
+   }
+   if (im->in.feed.stage == EPEG_FEED_STAGE_DONE) {
+      return EPEG_FEED_COMPLETE;
+   }
+   if ((bytes) && (len > 0)) {
+      if (_epeg_feed_src_append(&(im->in.jinfo), &(im->in.feed.buf),
+                                &(im->in.feed.alloc), bytes,
+                                (size_t)len) != 0) {
+         im->in.feed.stage = EPEG_FEED_STAGE_FAILED;
+         return EPEG_FEED_ERROR;
+      }
+   }
+
+   /* the error manager from epeg_feed_open() stays, so that warnings add
+    * up over all calls: */
+   if (setjmp(im->jerr.setjmp_buffer)) {
+      if ((im->in.feed.stage == EPEG_FEED_STAGE_ROWS) &&
+          (_epeg_decode_salvage(im) == 0)) {
+         im->in.feed.stage = EPEG_FEED_STAGE_DONE;
+         return EPEG_FEED_COMPLETE;
+      }
+      im->in.feed.stage = EPEG_FEED_STAGE_FAILED;
+      im->error = 1;
+      return EPEG_FEED_ERROR;
+   }
+
+   if (im->in.feed.stage == EPEG_FEED_STAGE_HEADER) {
+      if (jpeg_read_header(&(im->in.jinfo), TRUE) == JPEG_SUSPENDED) {
+         return EPEG_FEED_MORE;
+      }
+      if (_epeg_header_parse(im) != 0) {
+         im->in.feed.stage = EPEG_FEED_STAGE_FAILED;
+         return EPEG_FEED_ERROR;
+      }
+      im->in.feed.stage = EPEG_FEED_STAGE_READY;
+      return EPEG_FEED_HEADER;
+   }
+   if (im->in.feed.stage == EPEG_FEED_STAGE_READY) {
+      if (_epeg_decode_setup(im) != 0) {
+         im->in.feed.stage = EPEG_FEED_STAGE_FAILED;
+         return EPEG_FEED_ERROR;
+      }
+      im->in.feed.stage = EPEG_FEED_STAGE_START;
+   }
+   if (im->in.feed.stage == EPEG_FEED_STAGE_START) {
+      /* progressive images are taken in whole before this returns TRUE: */
+      if (!jpeg_start_decompress(&(im->in.jinfo))) {
+         return EPEG_FEED_MORE;
+      }
+      im->in.feed.stage = EPEG_FEED_STAGE_ROWS;
+      im->jerr.watch = 1;
+   }
+
+   rows = 0;
+   if (im->in.feed.stage == EPEG_FEED_STAGE_ROWS) {
+      while (im->in.jinfo.output_scanline < im->in.jinfo.output_height) {
+         n = jpeg_read_scanlines(&(im->in.jinfo),
+                                 &(im->lines[im->in.jinfo.output_scanline]),
+                                 (JDIMENSION)im->in.jinfo.rec_outbuf_height);
+         if (n == 0) {
+            return ((rows > 0) ? EPEG_FEED_ROWS : EPEG_FEED_MORE);
+         }
+         rows += n;
+      }
+      im->in.feed.stage = EPEG_FEED_STAGE_FINISH;
+   }
+   if (!jpeg_finish_decompress(&(im->in.jinfo))) {
+      return ((rows > 0) ? EPEG_FEED_ROWS : EPEG_FEED_MORE);
+   }
+   _epeg_decode_done(im);
+   im->in.feed.stage = EPEG_FEED_STAGE_DONE;
+   return EPEG_FEED_COMPLETE;
+}
+
+/**
+ * Return how many scanlines of a fed image are decoded.
+ * @param im A handle from epeg_feed_open().
+ * @return The number of decoded scanlines.
+ *
+ * The scanlines are those of the image as the decoder produces it, which
+ * may be scaled down by up to 8 times from the full size when a smaller
+ * decode size was set; they are decoded top to bottom.
+ *
+ * See also: epeg_feed()
+ */
+extern int epeg_feed_rows_get(Epeg_Image *im)
+{
+   if ((!im->in.feed.on) || (im->in.feed.stage < EPEG_FEED_STAGE_ROWS)) {
+      return 0;
+   }
+   return (int)im->in.jinfo.output_scanline;
+}
+
 /**
  * Return the original JPEG pixel size.
  * @param im A handle to an opened Epeg image.
@@ -128,7 +579,18 @@ extern void epeg_colorspace_get(Epeg_Image *im, int *space)
  * Sets the size at which to decode the JPEG image, giving an optimized load
  * that only decodes the pixels needed.
  *
- * See also: epeg_decode_bounds_set(), epeg_decode_colorspace_set()
+ * For sizes of 1/16 of the image or less, the 1/8 image that libjpeg makes
+ * out of just the DC coefficients is averaged down further in boxes of up to
+ * 8x8 pixels while it is decoded, so icons come out smoothed rather than
+ * picked from single pixels, and only the averaged image is kept in memory.
+ *
+ * The width and height are taken as they are, stretching the image if they
+ * do not have its aspect ratio; epeg_decode_fit_set() works them out to
+ * keep it. Neither is taken bigger than the image, or than the part set
+ * with epeg_decode_crop_set().
+ *
+ * See also: epeg_decode_fit_set(), epeg_decode_bounds_set(),
+ * epeg_decode_colorspace_set()
  */
 extern void epeg_decode_size_set(Epeg_Image *im, int w, int h)
 {
@@ -145,6 +607,11 @@ extern void epeg_decode_size_set(Epeg_Image *im, int w, int h)
    } else if (h > im->in.h) {
 	   h = im->in.h;
    }
+   /* no bigger than the part that epeg_decode_crop_set() decodes: */
+   if (im->in.crop.on) {
+      w = MIN(w, im->in.crop.w);
+      h = MIN(h, im->in.crop.h);
+   }
    im->out.w = w;
    im->out.h = h;
    im->out.x = 0;
@@ -193,6 +660,194 @@ extern void epeg_decode_bounds_set(Epeg_Image *im, int x, int y, int w, int h)
    im->out.y = y;
 }
 
+/**
+ * Set the part of the image to decode and scale down.
+ * @param im A handle to an opened Epeg image.
+ * @param x The left edge of the part, in pixels of the image.
+ * @param y The top edge of the part, in pixels of the image.
+ * @param w The width of the part, in pixels of the image.
+ * @param h The height of the part, in pixels of the image.
+ * @return Nothing.
+ *
+ * This limits the decode of image @p im to the given rectangle, which gets
+ * scaled to the size set by epeg_decode_size_set() just as the whole image
+ * otherwise would, with the DCT scaling picked for the rectangle rather than
+ * for the whole image. The rectangle is clipped to the image, and a width or
+ * height below 1 turns the crop off again.
+ *
+ * With libjpeg-turbo, the columns left and right of the rectangle are never
+ * put through the IDCT and the rows below it are not read at all.
+ *
+ * Unlike epeg_decode_bounds_set() and epeg_trim(), which cut out a part at
+ * full size, this works with epeg_encode() and epeg_pixels_get(). It has no
+ * effect on epeg_rows_decode(), which turns it down, nor on epeg_phash() and
+ * epeg_placeholder_get(), which always look at the whole image.
+ *
+ * See also: epeg_decode_smart_crop_set(), epeg_decode_size_set()
+ */
+extern void epeg_decode_crop_set(Epeg_Image *im, int x, int y, int w, int h)
+{
+   if (im->pixels) {
+      return;
+   }
+   im->in.crop.on = 0;
+   if ((w < 1) || (h < 1)) {
+      return;
+   }
+   if (x < 0) {
+      w += x;
+      x = 0;
+   }
+   if (y < 0) {
+      h += y;
+      y = 0;
+   }
+   w = MIN(w, (im->in.w - x));
+   h = MIN(h, (im->in.h - y));
+   if ((w < 1) || (h < 1)) {
+      return;
+   }
+   im->in.crop.x = x;
+   im->in.crop.y = y;
+   im->in.crop.w = w;
+   im->in.crop.h = h;
+   im->in.crop.on = 1;
+   /* the decode size cannot be bigger than what gets decoded: */
+   im->out.w = MIN(im->out.w, w);
+   im->out.h = MIN(im->out.h, h);
+}
+
+/**
+ * Pick the most interesting part of an image to decode at a size.
+ * @param im A handle to an opened Epeg image.
+ * @param w The width to decode at, in pixels.
+ * @param h The height to decode at, in pixels.
+ * @return 0 on success, 1 on failure.
+ *
+ * This finds the biggest rectangle with the aspect ratio of @p w by @p h in
+ * image @p im that takes in the most of what stands out in it, and sets it
+ * up with epeg_decode_crop_set() and epeg_decode_size_set() for the decode
+ * that follows, as for a square avatar cut from a landscape photo.
+ *
+ * What stands out is measured on the 1/8 size image made of just the DC
+ * coefficients of the luma, as the strength of its edges plus the entropy
+ * of its brightness around them, with a slight pull towards the centre so
+ * that an image that is much the same all over gets cut in the middle. That
+ * decode costs a fraction of the one that follows, which then only has to
+ * deal with the part that was picked, at the scale that @p w and @p h need.
+ *
+ * As the image has to be read twice, this fails for images opened with
+ * epeg_callback_open(), epeg_feed_open() or epeg_fd_open() on a pipe, and
+ * must come before anything that decodes the pixels. The colorspace set
+ * with epeg_decode_colorspace_set() is kept, and if this fails the decode
+ * settings are left as they were.
+ *
+ * See also: epeg_decode_crop_set(), epeg_decode_size_set()
+ */
+extern int epeg_decode_smart_crop_set(Epeg_Image *im, int w, int h)
+{
+   struct _epeg_decode_settings settings;
+
+   if ((im->pixels) || (im->in.cb.func) || (im->in.feed.on) ||
+       ((im->in.fd.on) &&
+        (lseek(im->in.fd.num, (off_t)0, SEEK_CUR) < 0))) {
+      return 1;
+   }
+   if ((w < 1) || (h < 1)) {
+      return 1;
+   }
+
+   _epeg_decode_settings_save(im, &settings);
+   im->in.crop.on = 0;
+   epeg_decode_colorspace_set(im, EPEG_GRAY8);
+   epeg_decode_size_set(im, MAX((im->in.w / 8), 1), MAX((im->in.h / 8), 1));
+   if (_epeg_decode(im) != 0) {
+      _epeg_decode_settings_restore(im, &settings);
+      return 1;
+   }
+   _epeg_saliency_crop(im, w, h);
+   if (_epeg_decode_restart(im) != 0) {
+      _epeg_decode_settings_restore(im, &settings);
+      return 1;
+   }
+
+   epeg_decode_colorspace_set(im, settings.color_space);
+   epeg_decode_size_set(im, w, h);
+   im->in.crop.on = 1;
+   im->out.w = MIN(im->out.w, im->in.crop.w);
+   im->out.h = MIN(im->out.h, im->in.crop.h);
+   return 0;
+}
+
+/**
+ * Set the size to decode at, and how the image is fitted into it.
+ * @param im A handle to an opened Epeg image.
+ * @param w The width of the box to fit the image into, in pixels.
+ * @param h The height of the box to fit the image into, in pixels.
+ * @param fit How to fit the image into the box.
+ * @return Nothing.
+ *
+ * This works out the size to decode image @p im at, and with
+ * EPEG_FIT_COVER the part of it to decode, from the size of the image in
+ * its header alone, so that the DCT scaling and the decode are planned for
+ * just what ends up in the output:
+ *
+ * EPEG_FIT_FILL stretches the whole image to @p w by @p h, as
+ * epeg_decode_size_set() does.
+ *
+ * EPEG_FIT_CONTAIN scales the whole image down to fit inside @p w by @p h,
+ * keeping its aspect ratio, so that one side comes out shorter than asked
+ * for unless the aspect ratios match.
+ *
+ * EPEG_FIT_COVER scales the image down to cover all of @p w by @p h,
+ * keeping its aspect ratio, and cuts off what sticks out on either side,
+ * as for square thumbnails of photos. That part of the image is left out
+ * of the decode with epeg_decode_crop_set(), so it costs nothing beyond
+ * reading past it. See epeg_decode_smart_crop_set() for a cut that follows
+ * what is in the image rather than its middle.
+ *
+ * Images are only ever scaled down: a box bigger than the image gets the
+ * image at full size, or the middle of it for EPEG_FIT_COVER, in the same
+ * aspect ratio as it would have had. Any crop set before is replaced.
+ *
+ * See also: epeg_decode_size_set(), epeg_decode_crop_set()
+ */
+extern void epeg_decode_fit_set(Epeg_Image *im, int w, int h, Epeg_Fit fit)
+{
+   if ((im->pixels) || (w < 1) || (h < 1)) {
+      return;
+   }
+   im->in.crop.on = 0;
+   switch (fit) {
+      case EPEG_FIT_CONTAIN:
+         /* the side that has to shrink the most sets the scale: */
+         if (((long long int)im->in.w * h) > ((long long int)im->in.h * w)) {
+            w = MIN(w, im->in.w);
+            h = (int)((((long long int)im->in.h * w) + (im->in.w / 2)) /
+                      im->in.w);
+         } else {
+            h = MIN(h, im->in.h);
+            w = (int)((((long long int)im->in.w * h) + (im->in.h / 2)) /
+                      im->in.h);
+         }
+         epeg_decode_size_set(im, MAX(w, 1), MAX(h, 1));
+         break;
+      case EPEG_FIT_COVER:
+         _epeg_crop_window(im, w, h);
+         epeg_decode_size_set(im, w, h);
+         if ((im->in.crop.w < im->in.w) || (im->in.crop.h < im->in.h)) {
+            im->in.crop.on = 1;
+         }
+         im->out.w = MIN(im->out.w, im->in.crop.w);
+         im->out.h = MIN(im->out.h, im->in.crop.h);
+         break;
+      case EPEG_FIT_FILL:
+      default:
+         epeg_decode_size_set(im, w, h);
+         break;
+   }
+}
+
 /**
  * Set the colorspace in which to decode the image.
  * @param im A handle to an opened Epeg image.
@@ -203,6 +858,15 @@ extern void epeg_decode_bounds_set(Epeg_Image *im, int x, int y, int w, int h)
  * as this is normally the native colorspace of a JPEG file, avoiding any
  * colorspace conversions for a faster load and/or save.
  *
+ * EPEG_I420, EPEG_NV12 and EPEG_YUV444P are the planar layouts that video
+ * encoders take, as described at epeg_pixels_get(). For a YCbCr image with
+ * 4:2:0 sampling, I420 and NV12 come from the decoder without any chroma
+ * upsampling or colour conversion at all.
+ *
+ * EPEG_RGB565 and EPEG_RGBX8 are for framebuffers. With libjpeg-turbo both
+ * are produced by its colour converter, so the decoded image takes only 2
+ * bytes a pixel for RGB565; see also epeg_decode_dither_set().
+ *
  * See also: epeg_decode_size_set(), epeg_decode_bounds_set()
  */
 extern void epeg_decode_colorspace_set(Epeg_Image *im,
@@ -211,40 +875,134 @@ extern void epeg_decode_colorspace_set(Epeg_Image *im,
 	if (im->pixels) {
 		return;
 	}
-	if ((colorspace < EPEG_GRAY8) || (colorspace > EPEG_ARGB32)) {
+	if (((colorspace < EPEG_GRAY8) || (colorspace > EPEG_ARGB32)) &&
+	    ((colorspace < EPEG_I420) || (colorspace > EPEG_RGBX8))) {
 		return;
 	}
 	im->color_space = colorspace;
 }
 
 /**
- * Get a segment of decoded pixels from an image.
+ * Set whether to dither when decoding to 16 bits per pixel.
  * @param im A handle to an opened Epeg image.
- * @param x Rectangle X.
- * @param y Rectangle Y.
- * @param w Rectangle width.
- * @param h Rectangle height.
- * @return Pointer to the top left of the requested pixel block.
+ * @param onoff A boolean on and off enabling flag.
+ * @return Nothing.
  *
- * Return image pixels in the decoded format from the specified location
- * rectangle bounded with the box @p x, @p y @p w X @p y. The pixel block is
- * packed with no row padding, and it organized from top-left to bottom right,
- * row by row. You must free the pixel block using epeg_pixels_free() before
- * you close the image handle, and assume the pixels to be read-only memory.
+ * With this enabled, EPEG_RGB565 pixels get an ordered dither before they
+ * are cut down to 5 and 6 bits, which hides the banding that this leaves in
+ * smooth gradients such as skies. The image is then decoded at 3 bytes a
+ * pixel and only packed by epeg_pixels_get(). The default is off.
  *
- * On success the pointer is returned, on failure, NULL is returned. Failure
- * may be because the rectangle is out of the bounds of the image, memory
- * allocations failed, or the image data cannot be decoded.
+ * See also: epeg_decode_colorspace_set()
+ */
+extern void epeg_decode_dither_set(Epeg_Image *im, int onoff)
+{
+   im->in.dither = ((onoff) ? 1 : 0);
+}
+
+/**
+ * Set whether to keep what decodes of a broken image.
+ * @param im A handle to an opened Epeg image.
+ * @param onoff A boolean on and off enabling flag.
+ * @return Nothing.
  *
- * See also: epeg_pixels_get_as_RGB8()
+ * Normally an error in the compressed data of @p im makes decoding it fail.
+ * With this enabled, an image that breaks off after some of its scanlines
+ * have been decoded is still taken: the last good scanline is repeated down
+ * to the bottom, and epeg_decode_rows_valid_get() says how far the real data
+ * went. This gives truncated downloads a thumbnail instead of a retry, and
+ * holds for the decode done by epeg_trim() as well. The default is off.
+ *
+ * Images stopped by epeg_decode_warnings_max_set() still fail.
+ *
+ * See also: epeg_decode_warnings_max_set(), epeg_decode_rows_valid_get()
  */
-extern const void *epeg_pixels_get(Epeg_Image *im, int x, int y,  int w, int h)
+extern void epeg_decode_tolerant_set(Epeg_Image *im, int onoff)
 {
-   int xx, yy, ww, hh, bpp, ox, oy, ow, oh, iw, ih;
+   im->in.tolerant = ((onoff) ? 1 : 0);
+}
 
-   if (!im->pixels) {
-	   if (_epeg_decode(im) != 0) {
-         return NULL;
+/**
+ * Set how many corrupt-data warnings to allow before giving up on an image.
+ * @param im A handle to an opened Epeg image.
+ * @param max The number of warnings to allow, or 0 for no limit.
+ * @return Nothing.
+ *
+ * libjpeg recovers from most damage in the compressed data by itself,
+ * warning about it and filling in what it cannot read, which can take a
+ * long time for data that is garbage throughout. With a limit set, decoding
+ * @p im fails as soon as there are more than @p max warnings. The default is
+ * no limit.
+ *
+ * See also: epeg_decode_tolerant_set()
+ */
+extern void epeg_decode_warnings_max_set(Epeg_Image *im, int max)
+{
+   im->jerr.warnings_max = ((max > 0) ? (long)max : 0L);
+}
+
+/**
+ * Return how many decoded scanlines of an image hold real image data.
+ * @param im A handle to an opened Epeg image.
+ * @return The number of good scanlines, or 0 if nothing is decoded yet.
+ *
+ * After a decode, this is the number of scanlines from the top of the
+ * decoded image that came before the first damage in the data. It equals
+ * the decoded height for an image without damage, and is lower where
+ * libjpeg had to fill in after a corrupt-data warning or where
+ * epeg_decode_tolerant_set() filled in after an error.
+ *
+ * See also: epeg_decode_tolerant_set()
+ */
+extern int epeg_decode_rows_valid_get(Epeg_Image *im)
+{
+   return im->in.rows_valid;
+}
+
+/**
+ * Get a segment of decoded pixels from an image.
+ * @param im A handle to an opened Epeg image.
+ * @param x Rectangle X.
+ * @param y Rectangle Y.
+ * @param w Rectangle width.
+ * @param h Rectangle height.
+ * @return Pointer to the top left of the requested pixel block.
+ *
+ * Return image pixels in the decoded format from the specified location
+ * rectangle bounded with the box @p x, @p y @p w X @p y. The pixel block is
+ * packed with no row padding, and it organized from top-left to bottom right,
+ * row by row. You must free the pixel block using epeg_pixels_free() before
+ * you close the image handle, and assume the pixels to be read-only memory.
+ *
+ * On success the pointer is returned, on failure, NULL is returned. Failure
+ * may be because the rectangle is out of the bounds of the image, memory
+ * allocations failed, or the image data cannot be decoded.
+ *
+ * The planar colorspaces come as one block too. EPEG_I420 is a @p w wide Y
+ * plane, then a U and a V plane, each with half the width and height
+ * (rounded up) and that as their stride. EPEG_NV12 has the same Y plane,
+ * then a single plane of interleaved U and V pairs with the half height and
+ * a stride of twice the half width. EPEG_YUV444P is three @p w by @p h
+ * planes, one after the other. Pixels of the rectangle that fall outside
+ * the image repeat the nearest edge.
+ *
+ * EPEG_RGB565 pixels are 16 bit words in host byte order, with red in the
+ * top 5 bits and blue in the bottom 5. EPEG_RGBX8 pixels are 4 bytes of red,
+ * green, blue and 0xff.
+ *
+ * See also: epeg_pixels_get_as_RGB8()
+ */
+extern const void *epeg_pixels_get(Epeg_Image *im, int x, int y,  int w, int h)
+{
+   int xx, yy, ww, hh, bpp, ox, oy, ow, oh, iw, ih;
+
+   if (!im->pixels) {
+	   if (_epeg_decode(im) != 0) {
+         return NULL;
+      }
+      /* libjpeg only scales by eighths; the rest is done as for encoding: */
+      if (_epeg_scale(im) != 0) {
+         return NULL;
       }
    }
 
@@ -252,7 +1010,7 @@ extern const void *epeg_pixels_get(Epeg_Image *im, int x, int y,  int w, int h)
       return NULL;
    }
 
-   bpp = im->in.jinfo.output_components;
+   bpp = _epeg_pixel_size(im);
    iw = im->out.w;
    ih = im->out.h;
    ow = w;
@@ -289,8 +1047,14 @@ extern const void *epeg_pixels_get(Epeg_Image *im, int x, int y,  int w, int h)
    ww = (x + ox + ow);
    hh = (y + oy + oh);
 
-   /* go through all 8 values in type Epeg_Colorspace
-    * (i.e. enum _Epeg_Colorspace): */
+   if ((im->color_space == EPEG_I420) || (im->color_space == EPEG_NV12) ||
+       (im->color_space == EPEG_YUV444P)) {
+      return _epeg_pixels_planar_get(im, x, y, w, h, (x + ox), (y + oy),
+                                     ww, hh);
+   }
+
+   /* go through the other 10 of the 13 values in type Epeg_Colorspace
+    * (i.e. enum _Epeg_Colorspace); the 3 planar ones are handled above: */
    if (im->color_space == EPEG_GRAY8) {
       /* this whole block is pretty much the same thing we do for each
        * of the other enumeration values as well... could probably be simplified
@@ -476,6 +1240,56 @@ extern const void *epeg_pixels_get(Epeg_Image *im, int x, int y,  int w, int h)
          } /* end inner for-loop (for 'xx') */
       } /* end outer for-loop (for 'yy') */
       return pix;
+   } else if (im->color_space == EPEG_RGB565) {
+      unsigned char *pix, *p;
+
+      /* '2': */
+      pix = (unsigned char *)malloc((size_t)(w * h * 2L));
+      if (!pix) {
+         return NULL;
+      }
+      for ((yy = (y + oy)); (yy < hh); yy++) {
+         unsigned char *s;
+
+         s = (im->lines[yy] + ((x + ox) * bpp));
+         p = (pix + ((((yy - y) * w) + ox) * 2));
+         if (bpp == 2) {
+            /* libjpeg packed them already: */
+            memcpy(p, s, (size_t)(ww - (x + ox)) * 2);
+         } else {
+            _epeg_rgb565_row_pack(s, p, (ww - (x + ox)), bpp, (x + ox), yy,
+                                  im->in.dither);
+         }
+      } /* end outer for-loop (for 'yy') */
+      return pix;
+   } else if (im->color_space == EPEG_RGBX8) {
+      unsigned char *pix, *p;
+
+      /* '4' once more: */
+      pix = (unsigned char *)malloc((size_t)(w * h * 4L));
+      if (!pix) {
+         return NULL;
+      }
+      for ((yy = (y + oy)); (yy < hh); yy++) {
+         unsigned char *s;
+
+         s = (im->lines[yy] + ((x + ox) * bpp));
+         p = (pix + ((((yy - y) * w) + ox) * 4));
+         if (bpp == 4) {
+            /* libjpeg filled in the 0xff already: */
+            memcpy(p, s, (size_t)(ww - (x + ox)) * 4);
+            continue;
+         }
+         for ((xx = (x + ox)); (xx < ww); xx++) {
+            p[0] = s[0];
+            p[1] = s[1];
+            p[2] = s[2];
+            p[3] = 0xff;
+            p += 4;
+            s += bpp;
+         } /* end inner for-loop (for 'xx') */
+      } /* end outer for-loop (for 'yy') */
+      return pix;
    } /* end "if-else" that seems like it should really be a "switch" */
    return NULL;
 }
@@ -510,13 +1324,16 @@ extern const void *epeg_pixels_get_as_RGB8(Epeg_Image *im, int x, int y,
 	   if (_epeg_decode(im) != 0) {
 		   return NULL;
 	   }
+	   if (_epeg_scale(im) != 0) {
+		   return NULL;
+	   }
    }
 
    if (!im->pixels) {
 	   return NULL;
    }
 
-   bpp = im->in.jinfo.output_components;
+   bpp = _epeg_pixel_size(im);
    iw = im->out.w;
    ih = im->out.h;
    ow = w;
@@ -581,7 +1398,8 @@ extern const void *epeg_pixels_get_as_RGB8(Epeg_Image *im, int x, int y,
       } /* end outer for-loop (for 'yy') */
       return pix;
    }
-   if (im->color_space == EPEG_RGB8) {
+   if ((im->color_space == EPEG_RGB8) || (im->color_space == EPEG_RGBX8) ||
+       ((im->color_space == EPEG_RGB565) && (bpp >= 3))) {
       unsigned char *pix, *p;
 
       /* also '3': */
@@ -618,14 +1436,24 @@ extern const void *epeg_pixels_get_as_RGB8(Epeg_Image *im, int x, int y,
 
          s = (im->lines[yy] + ((x + ox) * bpp));
          p = (pix + ((((yy - y) * w) + ox) * 3));
-         for ((xx = (x + ox)); (xx < ww); xx++) {
-            /* what? */
-            p[0] = (unsigned char)(MIN(255, (s[0] * s[3]) / 255));
-            p[1] = (unsigned char)(MIN(255, (s[1] * s[3]) / 255));
-            p[2] = (unsigned char)(MIN(255, (s[2] * s[3]) / 255));
-            p += 3;
-            s += bpp;
-         } /* end inner for-loop (for 'xx') */
+         _epeg_cmyk_row_convert(s, p, (ww - (x + ox)), im->in.cmyk_inverted);
+      } /* end outer for-loop (for 'yy') */
+      return pix;
+   }
+   if (im->color_space == EPEG_RGB565) {
+      unsigned char *pix, *p;
+
+      /* back up from '2' to '3': */
+      pix = (unsigned char *)malloc((size_t)(w * h * 3L));
+      if (!pix) {
+         return NULL;
+      }
+      for ((yy = (y + oy)); (yy < hh); yy++) {
+         unsigned char *s;
+
+         s = (im->lines[yy] + ((x + ox) * bpp));
+         p = (pix + ((((yy - y) * w) + ox) * 3));
+         _epeg_pixels_row_convert(s, p, (ww - (x + ox)), EPEG_RGB565);
       } /* end outer for-loop (for 'yy') */
       return pix;
    }
@@ -649,6 +1477,410 @@ extern void epeg_pixels_free(Epeg_Image *im, const void *data)
    free((void *)data);
 }
 
+/**
+ * Decode an image row by row, handing each row to a callback.
+ * @param im A handle to an opened Epeg image.
+ * @param func The function that each row gets handed to.
+ * @param data A pointer passed on to @p func untouched.
+ * @return 0 if all rows were handed over or @p func stopped early, 1 if not.
+ *
+ * This decodes the image @p im at the size set by epeg_decode_size_set()
+ * and in the colorspace set by epeg_decode_colorspace_set(), calling @p func
+ * with each row as soon as libjpeg produces it, from the top down. The rows
+ * are scaled the same way as for epeg_encode() and laid out like a one row
+ * block from epeg_pixels_get(). Only a few rows are ever held at a time, so
+ * unlike epeg_pixels_get() this needs memory for the width of the image
+ * rather than all of it, and the caller can work on the rows while the rest
+ * are still being decoded. Progressive images are the exception, as libjpeg
+ * has to keep all their coefficients until the last scan is in.
+ *
+ * @p func gets @p data, the row, its index and its width in pixels. The row
+ * is only valid until @p func returns. If @p func returns anything other
+ * than 0 no more rows are decoded.
+ *
+ * An image can only be decoded once, so nothing else that needs its pixels
+ * can be done with @p im afterwards. The planar colorspaces, fed images and
+ * images whose pixels were already decoded are not supported.
+ *
+ * See also: epeg_pixels_get()
+ */
+extern int epeg_rows_decode(Epeg_Image *im, Epeg_Row_Cb func, void *data)
+{
+   unsigned char *volatile work;
+   unsigned char *packed, *reduced, *sampled;
+   JSAMPROW *strip;
+   JDIMENSION first, got;
+   size_t size;
+   int x, y, n, bpp, stop;
+
+   if ((im->pixels) || (im->in.feed.on) || (im->in.crop.on) || (!func)) {
+      return 1;
+   }
+   if ((im->color_space == EPEG_I420) || (im->color_space == EPEG_NV12) ||
+       (im->color_space == EPEG_YUV444P)) {
+      return 1;
+   }
+
+   im->in.jinfo.err = jpeg_std_error(&(im->jerr.pub));
+   im->jerr.pub.error_exit = _epeg_fatal_error_handler;
+   im->jerr.pub.emit_message = _epeg_warning_handler;
+   im->jerr.warning_row = -1;
+   im->jerr.truncated = 0;
+   im->jerr.exceeded = 0;
+
+   work = NULL;
+   if (setjmp(im->jerr.setjmp_buffer)) {
+      jpeg_abort_decompress(&(im->in.jinfo));
+      free(work);
+      im->jerr.watch = 0;
+      im->error = 1;
+      return 1;
+   }
+
+   _epeg_decode_params(im);
+   jpeg_start_decompress(&(im->in.jinfo));
+   im->jerr.watch = 1;
+
+   /* the rows libjpeg likes to write at once, then one output row, aligned
+    * for EPEG_ARGB32, and one each for the CMYK reduction and the scaling: */
+   n = im->in.jinfo.rec_outbuf_height;
+   bpp = _epeg_pixel_size(im);
+   size = (((size_t)n * sizeof(JSAMPROW)) + ((size_t)im->out.w * 4U) +
+           ((size_t)n * (size_t)bpp * im->in.jinfo.output_width) +
+           ((size_t)im->in.jinfo.output_width * 3U) +
+           ((size_t)im->out.w * 4U));
+   work = (unsigned char *)malloc(size);
+   if (!work) {
+      jpeg_abort_decompress(&(im->in.jinfo));
+      im->jerr.watch = 0;
+      return 1;
+   }
+   strip = (JSAMPROW *)work;
+   packed = (work + ((size_t)n * sizeof(JSAMPROW)));
+   strip[0] = (packed + ((size_t)im->out.w * 4U));
+   for ((y = 1); (y < n); y++) {
+      strip[y] = (strip[y - 1] +
+                  ((size_t)bpp * im->in.jinfo.output_width));
+   }
+   reduced = (strip[n - 1] + ((size_t)bpp * im->in.jinfo.output_width));
+   sampled = (reduced + ((size_t)im->in.jinfo.output_width * 3U));
+
+   stop = 0;
+   for ((y = 0); ((y < im->out.h) && (!stop)); ) {
+      first = im->in.jinfo.output_scanline;
+      got = jpeg_read_scanlines(&(im->in.jinfo), strip, (JDIMENSION)n);
+      if (got < 1) {
+         break;
+      }
+      /* the same rows and columns as _epeg_scale() picks: */
+      for ( ; (y < im->out.h); y++) {
+         const unsigned char *s;
+         JDIMENSION sy;
+         int sbpp;
+
+         sy = (((unsigned int)y * im->in.jinfo.output_height) /
+               (unsigned int)im->out.h);
+         if (sy >= (first + got)) {
+            break;
+         }
+         s = strip[sy - first];
+         sbpp = bpp;
+         if ((im->color_space != EPEG_CMYK) &&
+             ((im->in.jinfo.out_color_space == JCS_CMYK) ||
+              (im->in.jinfo.out_color_space == JCS_YCCK))) {
+            sbpp = _epeg_cmyk_row_reduce(im, s, reduced,
+                                         (int)im->in.jinfo.output_width);
+            s = reduced;
+         }
+         if ((unsigned int)im->out.w != im->in.jinfo.output_width) {
+            for ((x = 0); (x < im->out.w); x++) {
+               memcpy((sampled + (x * sbpp)),
+                      (s + ((((unsigned int)x * im->in.jinfo.output_width) /
+                             (unsigned int)im->out.w) * (unsigned int)sbpp)),
+                      (size_t)sbpp);
+            }
+            s = sampled;
+         }
+         s = _epeg_rows_pack(im, s, sbpp, packed, im->out.w, y);
+         if (func(data, s, y, im->out.w) != 0) {
+            stop = 1;
+            break;
+         }
+      }
+   }
+   im->jerr.watch = 0;
+
+   /* rows below the last one used are not worth decoding: */
+   if (im->in.jinfo.output_scanline < im->in.jinfo.output_height) {
+      jpeg_abort_decompress(&(im->in.jinfo));
+   } else {
+      jpeg_finish_decompress(&(im->in.jinfo));
+   }
+   free(work);
+   return (((y < im->out.h) && (!stop)) ? 1 : 0);
+}
+
+/**
+ * Compute a perceptual hash of an image.
+ * @param im A handle to an opened Epeg image.
+ * @param hash Where to store the 64 bit hash.
+ * @return 0 on success, 1 on failure.
+ *
+ * This computes a pHash of image @p im from its luma at 32x32, taking the
+ * signs of the 8x8 lowest frequencies of the DCT of that against their
+ * median, and stores it at @p hash. Images that look alike get hashes that
+ * differ in few bits, which epeg_phash_distance() counts.
+ *
+ * The luma comes from the smallest decode there is: only the DC coefficient
+ * of each luma block, averaged down as for epeg_decode_size_set(), without
+ * any work on the chroma. That still reads all of the entropy coded data,
+ * but costs about half as much as decoding even just the grey pixels, and
+ * the hash does not depend on any of the decode settings.
+ *
+ * The image is then read again from the start for whatever comes next,
+ * with the decode settings it had before, so this fails for images opened
+ * with epeg_callback_open(), epeg_feed_open() or epeg_fd_open() on a pipe,
+ * and must come before anything that decodes the pixels.
+ *
+ * See also: epeg_phash_distance()
+ */
+extern int epeg_phash(Epeg_Image *im, unsigned long long int *hash)
+{
+   double grid[32][32], rows[32][9], freq[64], sorted[64], cosines[128];
+   double median;
+   struct _epeg_decode_settings settings;
+   unsigned int w, h, x0, x1, y0, y1, x, y;
+   int i, j, u, v, ret;
+
+   if ((!hash) || (im->pixels) || (im->in.cb.func) || (im->in.feed.on) ||
+       ((im->in.fd.on) &&
+        (lseek(im->in.fd.num, (off_t)0, SEEK_CUR) < 0))) {
+      return 1;
+   }
+   _epeg_decode_settings_save(im, &settings);
+   im->in.crop.on = 0;
+   epeg_decode_colorspace_set(im, EPEG_GRAY8);
+   epeg_decode_size_set(im, 32, 32);
+   if (_epeg_decode(im) != 0) {
+      _epeg_decode_settings_restore(im, &settings);
+      return 1;
+   }
+
+   /* average down to exactly 32x32, or repeat pixels up to it: */
+   w = im->in.jinfo.output_width;
+   h = im->in.jinfo.output_height;
+   for ((i = 0); (i < 32); i++) {
+      y0 = (((unsigned int)i * h) / 32U);
+      y1 = MAX((((unsigned int)(i + 1) * h) / 32U), (y0 + 1U));
+      for ((j = 0); (j < 32); j++) {
+         unsigned int sum;
+
+         x0 = (((unsigned int)j * w) / 32U);
+         x1 = MAX((((unsigned int)(j + 1) * w) / 32U), (x0 + 1U));
+         sum = 0U;
+         for ((y = y0); (y < y1); y++) {
+            for ((x = x0); (x < x1); x++) {
+               sum += im->lines[y][x];
+            }
+         }
+         grid[i][j] = ((double)sum / (double)((y1 - y0) * (x1 - x0)));
+      }
+   }
+
+   /* cos(k pi / 64), one period of it, without needing libm: */
+   cosines[0] = 1.0;
+   cosines[1] = 0.99879545620517239271;
+   for ((i = 2); (i < 128); i++) {
+      cosines[i] = ((2.0 * cosines[1] * cosines[i - 1]) - cosines[i - 2]);
+   }
+   /* only frequencies 1 to 8 each way are needed, the first row and column
+    * being mostly the average brightness and the gradient across: */
+   for ((i = 0); (i < 32); i++) {
+      for ((u = 0); (u < 9); u++) {
+         rows[i][u] = 0.0;
+         for ((j = 0); (j < 32); j++) {
+            rows[i][u] += (grid[i][j] * cosines[(((2 * j) + 1) * u) % 128]);
+         }
+      }
+   }
+   for ((v = 1); (v < 9); v++) {
+      for ((u = 1); (u < 9); u++) {
+         double sum;
+
+         sum = 0.0;
+         for ((i = 0); (i < 32); i++) {
+            sum += (rows[i][u] * cosines[(((2 * i) + 1) * v) % 128]);
+         }
+         freq[((v - 1) * 8) + (u - 1)] = sum;
+      }
+   }
+
+   /* 64 values sort quickly enough by insertion: */
+   for ((i = 0); (i < 64); i++) {
+      for ((j = i); ((j > 0) && (sorted[j - 1] > freq[i])); j--) {
+         sorted[j] = sorted[j - 1];
+      }
+      sorted[j] = freq[i];
+   }
+   median = ((sorted[31] + sorted[32]) / 2.0);
+   *hash = 0ULL;
+   for ((i = 0); (i < 64); i++) {
+      *hash = ((*hash << 1) | ((freq[i] > median) ? 1ULL : 0ULL));
+   }
+
+   ret = _epeg_decode_restart(im);
+   _epeg_decode_settings_restore(im, &settings);
+   return ret;
+}
+
+/**
+ * Count the bits that two perceptual hashes differ in.
+ * @param a A hash from epeg_phash().
+ * @param b Another hash from epeg_phash().
+ * @return The Hamming distance between @p a and @p b, from 0 to 64.
+ *
+ * Hashes of the same picture, scaled, recompressed or slightly retouched,
+ * mostly come out within 10 of each other; unrelated pictures are at around
+ * 32.
+ *
+ * See also: epeg_phash()
+ */
+extern int epeg_phash_distance(unsigned long long int a,
+                               unsigned long long int b)
+{
+   unsigned long long int d;
+   int n;
+
+   d = (a ^ b);
+   for ((n = 0); (d); n++) {
+      d &= (d - 1ULL);
+   }
+   return n;
+}
+
+/**
+ * Compute placeholders to show while an image loads.
+ * @param im A handle to an opened Epeg image.
+ * @param ph Where to store the placeholders.
+ * @return 0 on success, 1 on failure.
+ *
+ * This fills in @p ph for image @p im with:
+ *
+ * color: the dominant colour as red, green and blue, the average of the
+ * pixels in the fullest bin of the histogram.
+ *
+ * histogram: the number of pixels in each of 64 bins, with 2 bits of each of
+ * red, green and blue making up the bin number as RRGGBB.
+ *
+ * preview and w, h: a tiny blurred copy of the image in RGB8, with the same
+ * aspect ratio and at most 32 pixels on a side.
+ *
+ * blurhash: the BlurHash of the image as a NUL terminated string, with 4x3
+ * components for landscape and 3x4 for portrait images.
+ *
+ * If the pixels of @p im were already decoded, by epeg_pixels_get() or
+ * epeg_encode(), they are what the placeholders are made from, so after
+ * epeg_encode() they come out of the thumbnail at no decode cost at all.
+ * Otherwise the image gets decoded the cheapest way there is, from just the
+ * DC coefficients at 1/8 of the size or less, as for epeg_phash(), and then
+ * nothing else that needs its pixels can be done with @p im. Pixels decoded
+ * as one of the planar colorspaces are not supported.
+ *
+ * See also: epeg_phash(), epeg_encode()
+ */
+extern int epeg_placeholder_get(Epeg_Image *im, Epeg_Placeholder *ph)
+{
+   /* full size pixels add up to more than 32 bits in a single bin: */
+   unsigned long long int sums[32 * 32][4], bins[64][3];
+   unsigned char *row;
+   int w, h, x, y, c, i, best;
+
+   if (!ph) {
+      return 1;
+   }
+   if (!im->pixels) {
+      if (im->in.feed.on) {
+         return 1;
+      }
+      im->in.crop.on = 0;
+      epeg_decode_colorspace_set(im, EPEG_RGB8);
+      epeg_decode_size_set(im, 32, 32);
+      if (_epeg_decode(im) != 0) {
+         return 1;
+      }
+   }
+   /* planar pixels are YCbCr even where they are not raw planes: */
+   if ((im->in.raw.on) || (im->color_space == EPEG_I420) ||
+       (im->color_space == EPEG_NV12) || (im->color_space == EPEG_YUV444P)) {
+      return 1;
+   }
+   /* after _epeg_scale() only the top left of the decoded image is used: */
+   w = (int)im->in.jinfo.output_width;
+   h = (int)im->in.jinfo.output_height;
+   if (im->scaled) {
+      w = im->out.w;
+      h = im->out.h;
+   }
+   if (w >= h) {
+      ph->w = MIN(w, 32);
+      ph->h = MAX((((h * ph->w) + (w / 2)) / w), 1);
+   } else {
+      ph->h = MIN(h, 32);
+      ph->w = MAX((((w * ph->h) + (h / 2)) / h), 1);
+   }
+
+   row = (unsigned char *)malloc((size_t)w * 3U);
+   if (!row) {
+      return 1;
+   }
+   memset(sums, 0, sizeof(sums));
+   memset(bins, 0, sizeof(bins));
+   memset(ph->histogram, 0, sizeof(ph->histogram));
+   for ((y = 0); (y < h); y++) {
+      unsigned long long int *cell;
+      const unsigned char *s;
+
+      if (_epeg_placeholder_row(im, im->lines[y], row, w) != 0) {
+         free(row);
+         return 1;
+      }
+      cell = sums[((y * ph->h) / h) * ph->w];
+      s = row;
+      for ((x = 0); (x < w); x++) {
+         i = (((s[0] >> 6) << 4) | ((s[1] >> 6) << 2) | (s[2] >> 6));
+         ph->histogram[i]++;
+         for ((c = 0); (c < 3); c++) {
+            bins[i][c] += s[c];
+            cell[((x * ph->w) / w) * 4 + c] += s[c];
+         }
+         cell[(((x * ph->w) / w) * 4) + 3]++;
+         s += 3;
+      }
+   }
+   free(row);
+
+   best = 0;
+   for ((i = 1); (i < 64); i++) {
+      if (ph->histogram[i] > ph->histogram[best]) {
+         best = i;
+      }
+   }
+   for ((c = 0); (c < 3); c++) {
+      ph->color[c] = (unsigned char)((bins[best][c] +
+                                      (ph->histogram[best] / 2ULL)) /
+                                     ph->histogram[best]);
+   }
+   for ((i = 0); (i < (ph->w * ph->h)); i++) {
+      for ((c = 0); (c < 3); c++) {
+         ph->preview[(i * 3) + c] = (unsigned char)((sums[i][c] +
+                                                     (sums[i][3] / 2ULL)) /
+                                                    sums[i][3]);
+      }
+   }
+   _epeg_blurhash(ph->preview, ph->w, ph->h, ph->blurhash);
+   return 0;
+}
+
 /**
  * Get the image comment field as a string.
  * @param im A handle to an opened Epeg image.
@@ -725,7 +1957,8 @@ extern void epeg_comment_set(Epeg_Image *im, const char *comment)
  * Set the quality of the output encoded image. Values from 0 to 100
  * inclusive are valid, with 100 being the maximum quality, and 0 being the
  * minimum. If the quality is set equal to or above 90%, the output U and V
- * color planes are encoded at 1:1 with the Y plane.
+ * color planes are encoded at 1:1 with the Y plane, unless a chroma
+ * subsampling has been chosen with epeg_encode_subsampling_set().
  *
  * The default quality is 75.
  *
@@ -758,51 +1991,514 @@ extern void epeg_thumbnail_comments_enable(Epeg_Image *im, int onoff)
 }
 
 /**
- * Set the output file path for the image when saved.
+ * Select a named set of encoder settings for the saved image.
  * @param im A handle to an opened Epeg image.
- * @param file The path to the output file.
+ * @param profile The encode profile to use.
  * @return Nothing.
  *
- * This sets the output file path name (either a full or relative path name)
- * to where the file will be written when saved. @p file must be a NUL
- * terminated C string containing the path to the file to be saved to. If it is
- * NULL, then the image will not be saved to a file when calling epeg_encode().
+ * This sets the DCT method, Huffman optimisation, chroma subsampling and
+ * scanline batch size of the encoder in one go:
  *
- * See also: epeg_memory_output_set(), epeg_encode()
+ * EPEG_PROFILE_DEFAULT keeps the historic behaviour: the accurate integer
+ * DCT, single pass Huffman coding and 4:2:0 chroma (4:4:4 at quality 90
+ * and above). All scanlines go to the encoder in one call; the output is the
+ * same as with one row per call, only with less call overhead.
+ *
+ * EPEG_PROFILE_FASTEST uses the fast integer DCT, single pass Huffman coding
+ * and 4:2:0 chroma.
+ *
+ * EPEG_PROFILE_BALANCED uses the accurate integer DCT and optimised Huffman
+ * tables, with the chroma subsampling of the default profile.
+ *
+ * EPEG_PROFILE_SMALLEST favours output size over encode time: on top of the
+ * balanced settings it keeps 4:2:0 chroma at every quality, writes a
+ * progressive file where that pays off and leaves out the JFIF, comment
+ * and thumbnail markers.
+ *
+ * Any of the settings can be overridden afterwards with the individual
+ * setters. None of the profiles turns on epeg_encode_passthrough_set().
+ *
+ * See also: epeg_encode_dct_method_set(), epeg_encode_optimize_set(),
+ * epeg_encode_subsampling_set(), epeg_encode_batch_set(),
+ * epeg_encode_progressive_set(), epeg_encode_markers_set(),
+ * epeg_encode_passthrough_set()
  */
-extern void epeg_file_output_set(Epeg_Image *im, const char *file)
+extern void epeg_encode_profile_set(Epeg_Image *im,
+                                    Epeg_Encode_Profile profile)
 {
-   if (im->out.file) {
-      free(im->out.file);
-   }
-   if (!file) {
-      im->out.file = NULL;
-   } else {
-      im->out.file = strdup(file);
+   switch (profile) {
+      case EPEG_PROFILE_DEFAULT:
+         im->out.dct_method = EPEG_DCT_AUTO;
+         im->out.optimize = 0;
+         im->out.subsampling = EPEG_SUBSAMPLING_AUTO;
+         im->out.batch = 0;
+         im->out.progressive = 0;
+         im->out.markers = EPEG_MARKER_ALL;
+         im->out.passthrough = 0;
+         break;
+
+      case EPEG_PROFILE_FASTEST:
+         im->out.dct_method = EPEG_DCT_IFAST;
+         im->out.optimize = 0;
+         im->out.subsampling = EPEG_SUBSAMPLING_420;
+         im->out.batch = 0;
+         im->out.progressive = 0;
+         im->out.markers = EPEG_MARKER_ALL;
+         im->out.passthrough = 0;
+         break;
+
+      case EPEG_PROFILE_BALANCED:
+         im->out.dct_method = EPEG_DCT_ISLOW;
+         im->out.optimize = 1;
+         im->out.subsampling = EPEG_SUBSAMPLING_AUTO;
+         im->out.batch = 0;
+         im->out.progressive = 0;
+         im->out.markers = EPEG_MARKER_ALL;
+         im->out.passthrough = 0;
+         break;
+
+      case EPEG_PROFILE_SMALLEST:
+         im->out.dct_method = EPEG_DCT_ISLOW;
+         im->out.optimize = 1;
+         im->out.subsampling = EPEG_SUBSAMPLING_420;
+         im->out.batch = 0;
+         im->out.progressive = 1;
+         im->out.markers = EPEG_MARKER_NONE;
+         im->out.passthrough = 0;
+         break;
+
+      default:
+         break;
    }
 }
 
 /**
- * Set the output file to be a block of allocated memory.
+ * Set the DCT method used when encoding the saved image.
  * @param im A handle to an opened Epeg image.
- * @param data A pointer to a pointer to a memory block.
- * @param size A pointer to a counter of the size of the memory block.
+ * @param method The DCT method to encode with.
  * @return Nothing.
  *
- * This sets the output encoding of the image when saved to be allocated
- * memory. After epeg_close() is called the pointer pointed to by @p data
- * and the integer pointed to by @p size will contain the pointer to the
+ * EPEG_DCT_AUTO (the default) uses the libjpeg default, the accurate integer
+ * method, which is what Epeg has always encoded with whatever method the
+ * image was decoded with. EPEG_DCT_IFAST is the quickest, EPEG_DCT_ISLOW the
+ * most accurate integer method, and EPEG_DCT_FLOAT uses floating point
+ * arithmetic.
+ *
+ * See also: epeg_encode_profile_set()
+ */
+extern void epeg_encode_dct_method_set(Epeg_Image *im, Epeg_Dct_Method method)
+{
+   if ((method < EPEG_DCT_AUTO) || (method > EPEG_DCT_FLOAT)) {
+      return;
+   }
+   im->out.dct_method = method;
+}
+
+/**
+ * Enable optimised Huffman tables in the saved image.
+ * @param im A handle to an opened Epeg image.
+ * @param onoff A boolean on and off enabling flag.
+ * @return Nothing.
+ *
+ * If @p onoff is 1, the encoder makes an extra pass over the image to compute
+ * Huffman tables tailored to it, which gives a smaller file at some CPU cost.
+ * If it is 0, the tables from the JPEG specification are used. The default
+ * is 0.
+ *
+ * For thumbnails the extra pass costs little next to decoding the source,
+ * and most of what it saves is the Huffman table segment: tailored tables
+ * only have codes for the symbols that the image uses, while tables fixed in
+ * advance need one for every symbol the encoder could emit.
+ *
+ * See also: epeg_encode_profile_set()
+ */
+extern void epeg_encode_optimize_set(Epeg_Image *im, int onoff)
+{
+   im->out.optimize = (char)(onoff ? 1 : 0);
+}
+
+/**
+ * Set the chroma subsampling of the saved image.
+ * @param im A handle to an opened Epeg image.
+ * @param subsampling The chroma subsampling to encode with.
+ * @return Nothing.
+ *
+ * EPEG_SUBSAMPLING_AUTO (the default) encodes at 4:2:0, switching to 4:4:4
+ * when the quality is 90 or above. The other values force the given
+ * subsampling regardless of quality. This only affects YCbCr output; gray and
+ * CMYK images are always encoded at full resolution.
+ *
+ * See also: epeg_quality_set(), epeg_encode_profile_set()
+ */
+extern void epeg_encode_subsampling_set(Epeg_Image *im,
+                                        Epeg_Subsampling subsampling)
+{
+   if ((subsampling < EPEG_SUBSAMPLING_AUTO) ||
+       (subsampling > EPEG_SUBSAMPLING_420)) {
+      return;
+   }
+   im->out.subsampling = subsampling;
+}
+
+/**
+ * Set how many scanlines are handed to the encoder per call.
+ * @param im A handle to an opened Epeg image.
+ * @param rows The number of scanlines per call, or 0 for all of them.
+ * @return Nothing.
+ *
+ * Passing bigger batches of rows to libjpeg cuts the per-call overhead of the
+ * encode loop. A value of 0 (or less) hands over every remaining row in a
+ * single call, which is the default.
+ *
+ * See also: epeg_encode_profile_set()
+ */
+extern void epeg_encode_batch_set(Epeg_Image *im, int rows)
+{
+   if (rows < 0) {
+      rows = 0;
+   }
+   im->out.batch = rows;
+}
+
+/**
+ * Enable progressive encoding of the saved image.
+ * @param im A handle to an opened Epeg image.
+ * @param onoff A boolean on and off enabling flag.
+ * @return Nothing.
+ *
+ * If @p onoff is 1, the image is written with a progressive scan script,
+ * which together with optimised Huffman tables usually gives a smaller file.
+ * The script is picked by output size: below about 16k pixels the extra scan
+ * headers cost more than they save, so such images stay sequential; medium
+ * images get a short spectral-selection script, and large ones the standard
+ * libjpeg progression. The default is 0.
+ *
+ * See also: epeg_encode_optimize_set(), epeg_encode_profile_set()
+ */
+extern void epeg_encode_progressive_set(Epeg_Image *im, int onoff)
+{
+   im->out.progressive = (char)(onoff ? 1 : 0);
+}
+
+/**
+ * Choose which metadata markers are written to the saved image.
+ * @param im A handle to an opened Epeg image.
+ * @param markers A bitmask of Epeg_Marker values.
+ * @return Nothing.
+ *
+ * EPEG_MARKER_JFIF writes the JFIF APP0 header, EPEG_MARKER_COMMENT the
+ * comment set with epeg_comment_set(), and EPEG_MARKER_THUMBNAIL the thumbnail
+ * comments enabled with epeg_thumbnail_comments_enable(). Markers left out of
+ * the mask are not written even when their content is set; the bytes this
+ * saves are reported by epeg_encode_stats_get(). The default is
+ * EPEG_MARKER_ALL.
+ *
+ * See also: epeg_encode_stats_get(), epeg_encode_profile_set()
+ */
+extern void epeg_encode_markers_set(Epeg_Image *im, int markers)
+{
+   im->out.markers = (markers & EPEG_MARKER_ALL);
+}
+
+/**
+ * Get statistics about the last encode of an image.
+ * @param im A handle to an opened Epeg image.
+ * @param stats Pointer to an encode stats struct to be filled in.
+ * @return Nothing.
+ *
+ * After epeg_encode() or epeg_trim(), this fills in the number of bytes
+ * written and the number of marker bytes that were left out because of
+ * epeg_encode_markers_set(). If nothing has been encoded yet, the fields will
+ * be 0 in the @p stats struct on return.
+ *
+ * See also: epeg_encode_markers_set()
+ */
+extern void epeg_encode_stats_get(Epeg_Image *im, Epeg_Encode_Stats *stats)
+{
+   if (!stats) {
+      return;
+   }
+   stats->size = im->out.stats.size;
+   stats->markers_saved = im->out.stats.markers_saved;
+}
+
+/**
+ * Leave the tables out of the saved image.
+ * @param im A handle to an opened Epeg image.
+ * @param onoff A boolean on and off enabling flag.
+ * @return Nothing.
+ *
+ * If @p onoff is 1, the image is written as an abbreviated JPEG stream, with
+ * no quantization or Huffman tables in it. This saves a few hundred bytes per
+ * image when a whole set of thumbnails shares one tables-only stream made by
+ * epeg_tables_encode() with the same quality as the images. Such images
+ * can only be read back by a decoder that is given the shared tables first,
+ * like epeg_file_open_with_tables().
+ *
+ * Since the tables have to be the same for every image, Huffman optimisation
+ * and progressive output are turned off while this is enabled. The default
+ * is 0.
+ *
+ * See also: epeg_tables_encode(), epeg_encode_optimize_set()
+ */
+extern void epeg_encode_abbreviated_set(Epeg_Image *im, int onoff)
+{
+   im->out.abbreviated = (char)(onoff ? 1 : 0);
+}
+
+/**
+ * Copy the source as it is when it already meets the output settings.
+ * @param im A handle to an opened Epeg image.
+ * @param onoff A boolean on and off enabling flag.
+ * @return Nothing.
+ *
+ * With this on, epeg_encode() skips the decode and re-encode when the image
+ * is saved at its full size and uncropped, its quantization tables are no
+ * finer than those of the output quality, and its colour space, chroma
+ * subsampling, progressive mode and Huffman optimisation are what the
+ * output settings ask for, as is a JFIF marker if EPEG_MARKER_JFIF is set.
+ * The source bytes are then copied to the destination (in the kernel where
+ * it can, for file to file copies). The application markers a re-encode
+ * would not write, such as Exif and ICC profiles, are left out, and the
+ * comment and thumbnail markers are replaced as a re-encode would write
+ * them, so that the output carries the same metadata either way. If the
+ * source cannot be read through, it is re-encoded after all. Abbreviated
+ * input or output is always re-encoded.
+ *
+ * This is off by default.
+ *
+ * See also: epeg_encode_profile_set(), epeg_encode()
+ */
+extern void epeg_encode_passthrough_set(Epeg_Image *im, int onoff)
+{
+   if (onoff) {
+      im->out.passthrough = 1;
+   } else {
+      im->out.passthrough = 0;
+   }
+}
+
+/**
+ * Write a tables-only JPEG stream to a block of allocated memory.
+ * @param quality The quality of encoding from 0 to 100.
+ * @param data A pointer to a pointer to a memory block.
+ * @param size A pointer to a counter of the size of the memory block.
+ * @return 1 if something happened, otherwise 0.
+ *
+ * This writes the quantization tables for @p quality and the standard
+ * Huffman tables as a tables-only JPEG stream, to go with images saved
+ * with epeg_encode_abbreviated_set() enabled. On success the pointer pointed
+ * to by @p data and the integer pointed to by @p size will contain the memory
+ * block and its size in bytes; the block can be freed with free().
+ *
+ * See also: epeg_encode_abbreviated_set(), epeg_file_open_with_tables(),
+ * epeg_memory_open_with_tables()
+ */
+extern int epeg_tables_encode(int quality, unsigned char **data, int *size)
+{
+   struct jpeg_compress_struct jinfo;
+   struct _epeg_error_mgr jerr;
+   void  *buf = NULL;
+   size_t len = 0;
+   FILE  *f;
+
+   if (quality < 0) {
+      quality = 0;
+   } else if (quality > 100) {
+      quality = 100;
+   }
+
+   f = _epeg_memfile_write_open(&buf, &len);
+   if (!f) {
+      return 1;
+   }
+
+   jinfo.err = jpeg_std_error(&(jerr.pub));
+   jerr.pub.error_exit = _epeg_fatal_error_handler;
+
+   if (setjmp(jerr.setjmp_buffer)) {
+      jpeg_destroy_compress(&jinfo);
+      _epeg_memfile_write_close(f);
+      if (buf) {
+         free(buf);
+      }
+      return 1;
+   }
+
+   jpeg_create_compress(&jinfo);
+   jpeg_stdio_dest(&jinfo, f);
+   jinfo.input_components = 3;
+   jinfo.in_color_space = JCS_YCbCr;
+   jpeg_set_defaults(&jinfo);
+   jpeg_set_quality(&jinfo, quality, TRUE);
+   jpeg_write_tables(&jinfo);
+   jpeg_destroy_compress(&jinfo);
+   _epeg_memfile_write_close(f);
+
+   if (data) {
+      *data = (unsigned char *)buf;
+   } else {
+      free(buf);
+   }
+   if (size) {
+      *size = (int)len;
+   }
+   return 0;
+}
+
+/**
+ * Set the output file path for the image when saved.
+ * @param im A handle to an opened Epeg image.
+ * @param file The path to the output file.
+ * @return Nothing.
+ *
+ * This sets the output file path name (either a full or relative path name)
+ * to where the file will be written when saved. @p file must be a NUL
+ * terminated C string containing the path to the file to be saved to. If it is
+ * NULL, then the image will not be saved to a file when calling epeg_encode().
+ *
+ * See also: epeg_memory_output_set(), epeg_encode()
+ */
+extern void epeg_file_output_set(Epeg_Image *im, const char *file)
+{
+   if (im->out.file) {
+      free(im->out.file);
+   }
+   if (!file) {
+      im->out.file = NULL;
+   } else {
+      im->out.file = strdup(file);
+      im->out.cb.func = NULL;
+   }
+}
+
+/**
+ * Set the output file to be a block of allocated memory.
+ * @param im A handle to an opened Epeg image.
+ * @param data A pointer to a pointer to a memory block.
+ * @param size A pointer to a counter of the size of the memory block.
+ * @return Nothing.
+ *
+ * This sets the output encoding of the image when saved to be allocated
+ * memory. After epeg_close() is called the pointer pointed to by @p data
+ * and the integer pointed to by @p size will contain the pointer to the
  * memory block and its size in bytes, respecitvely. The memory block can be
  * freed with the free() function call. If the save fails the pointer to the
- * memory block will be unaffected, as will the size.
+ * memory block will be unaffected, as will the size. This replaces any file
+ * or callback output set before.
  *
  * See also: epeg_file_output_set(), epeg_encode()
  */
 extern void epeg_memory_output_set(Epeg_Image *im, unsigned char **data,
                                    int *size)
 {
+   if (im->out.file) {
+      free(im->out.file);
+      im->out.file = NULL;
+   }
    im->out.mem.data = data;
    im->out.mem.size = size;
+   im->out.cb.func = NULL;
+}
+
+/**
+ * Set the output of the image to be streamed to a callback.
+ * @param im A handle to an opened Epeg image.
+ * @param func The function to hand the encoded data to.
+ * @param data A pointer passed on to @p func.
+ * @param chunk The number of bytes handed over per call, or 0 for 16KiB.
+ * @return Nothing.
+ *
+ * This sets the output of the image when saved to be a series of calls to
+ * @p func, each with the next up to @p chunk bytes of the encoded image, as
+ * soon as the encoder has produced them. Nothing but the current chunk is
+ * kept, so a server can send the image while it is still being encoded. The
+ * buffer passed to @p func is only valid during the call. If @p func returns
+ * anything but 0 the save is aborted and fails. Setting a file or memory
+ * output afterwards replaces this one.
+ *
+ * See also: epeg_file_output_set(), epeg_memory_output_set(), epeg_encode()
+ */
+extern void epeg_callback_output_set(Epeg_Image *im, Epeg_Output_Cb func,
+                                     void *data, int chunk)
+{
+   if (chunk < 1) {
+      chunk = 16384;
+   }
+   if ((func) && (im->out.file)) {
+      free(im->out.file);
+      im->out.file = NULL;
+   }
+   im->out.cb.func = func;
+   im->out.cb.data = data;
+   im->out.cb.chunk = chunk;
+}
+
+/**
+ * Make file output of the image atomic.
+ * @param im A handle to an opened Epeg image.
+ * @param onoff A boolean on and off enabling flag.
+ * @return Nothing.
+ *
+ * With this on, the image is written to a temporary file in the directory of
+ * the output file and renamed over it once the encode has succeeded, so
+ * readers (and a crash half way through) never see a partial file under the
+ * output name. This on its own does not sync anything to disk; see
+ * epeg_file_output_sync_set() for durable output. It is off by default.
+ *
+ * See also: epeg_file_output_set(), epeg_file_output_sync_set()
+ */
+extern void epeg_file_output_atomic_set(Epeg_Image *im, int onoff)
+{
+   if (onoff) {
+      im->out.atomic = 1;
+   } else {
+      im->out.atomic = 0;
+   }
+}
+
+/**
+ * Write file output of the image through a memory mapping.
+ * @param im A handle to an opened Epeg image.
+ * @param onoff A boolean on and off enabling flag.
+ * @return Nothing.
+ *
+ * With this on, the output file is reserved on disk up front and mapped, and
+ * the encoder writes the compressed data straight into the mapping, which is
+ * grown as needed; the file is truncated to its real size at the end. This
+ * saves a copy and most system calls on multi-megabyte outputs, but costs
+ * more than it saves on thumbnails. The output file has to be readable as
+ * well as writable. Where mmap() is missing this is the same as off, which
+ * is the default.
+ *
+ * See also: epeg_file_output_set(), epeg_file_output_atomic_set()
+ */
+extern void epeg_file_output_mmap_set(Epeg_Image *im, int onoff)
+{
+   if (onoff) {
+      im->out.mmap = 1;
+   } else {
+      im->out.mmap = 0;
+   }
+}
+
+/**
+ * Commit file output of the image as part of a group commit.
+ * @param im A handle to an opened Epeg image.
+ * @param sync A handle to a group commit, or NULL for none.
+ * @return Nothing.
+ *
+ * This makes the file output of @p im atomic, and leaves the final rename to
+ * the next sync wave of @p sync, which makes the file durable together with
+ * the others waiting on it. The image can be closed before that wave runs.
+ * Once epeg_encode() returns 0 the file is complete; errors in the wave
+ * itself are reported by epeg_sync_flush().
+ *
+ * See also: epeg_sync_new(), epeg_file_output_atomic_set()
+ */
+extern void epeg_file_output_sync_set(Epeg_Image *im, Epeg_Sync *sync)
+{
+   im->out.sync = sync;
 }
 
 /**
@@ -815,11 +2511,25 @@ extern void epeg_memory_output_set(Epeg_Image *im, unsigned char **data,
  * encoded at the decoded pixel size, using the quality, comment,
  * and thumbnail comment settings set on the image.
  *
- * See also: epeg_file_output_set(), epeg_memory_output_set()
+ * See also: epeg_file_output_set(), epeg_memory_output_set(),
+ * epeg_encode_passthrough_set()
  */
 extern int epeg_encode(Epeg_Image *im)
 {
-   if (_epeg_decode(im) != 0) {
+   if (_epeg_passthrough_check(im)) {
+      int ret;
+
+      /* or re-encode, if the source could not be read through: */
+      ret = _epeg_passthrough(im);
+      if (ret >= 0) {
+         return ret;
+      }
+   }
+   if (im->in.feed.on) {
+      if (im->in.feed.stage != EPEG_FEED_STAGE_DONE) {
+         return 1;
+      }
+   } else if (_epeg_decode(im) != 0) {
       return 1;
    }
    if (_epeg_scale(im) != 0) {
@@ -832,521 +2542,2907 @@ extern int epeg_encode(Epeg_Image *im)
 }
 
 /**
- * FIXME: Document this with a short, sentence-long description of epeg_trim()
- * @param im A handle to an opened Epeg image.
- * @return 1 if something happened, otherwise 0.
+ * Create an image handle for encoding pixels that did not come from a JPEG.
+ * @return A handle with the default encode settings, or NULL on failure.
  *
- * FIXME: Document this with a longer, paragraph-long description.
+ * The handle has no source image; it only carries encode settings and an
+ * output destination for epeg_encode_pixels(), and can be used for any
+ * number of encodes. Close it with epeg_close() when done.
+ *
+ * See also: epeg_encode_pixels(), epeg_close()
  */
-extern int epeg_trim(Epeg_Image *im)
+extern Epeg_Image *epeg_encoder_new(void)
 {
-   if (_epeg_decode_for_trim(im) != 0) {
-      return 1;
-   }
-   if (_epeg_trim(im) != 0) {
-      return 1;
-   }
-   if (_epeg_encode(im) != 0) {
-      return 1;
+   Epeg_Image *im;
+
+   im = (Epeg_Image *)calloc((size_t)1, sizeof(Epeg_Image));
+   if (!im) {
+      return NULL;
    }
-   return 0;
+   im->out.quality = 75;
+   epeg_encode_profile_set(im, EPEG_PROFILE_DEFAULT);
+   return im;
 }
 
 /**
- * Close an image handle.
+ * Encode a caller-supplied block of pixels to the image destination.
  * @param im A handle to an opened Epeg image.
- * @return Nothing.
+ * @param pixels A pointer to the top left of the pixel block.
+ * @param format The layout of the pixels.
+ * @param w The width of the pixel block.
+ * @param h The height of the pixel block.
+ * @param stride The number of bytes between rows, or 0 for packed rows.
+ * @return 1 if something happened, otherwise 0.
  *
- * This closes an opened image handle and frees all memory associated with it.
- * It does NOT free encoded data generated by epeg_memory_output_set() followed
- * by epeg_encode(), nor does it guarantee to free any data received by
- * epeg_pixels_get(). Once an image handle is closed, consider it invalid.
+ * This encodes @p pixels to the destination set by epeg_file_output_set() or
+ * epeg_memory_output_set(), with the same quality, profile, marker and
+ * comment settings that epeg_encode() uses. The pixel layouts are the ones
+ * epeg_pixels_get() returns, with EPEG_CMYK being four bytes of C, M, Y and K
+ * per pixel. EPEG_I420 is planar YUV 4:2:0: a full resolution Y plane with
+ * @p stride bytes per row, directly followed by the U and then the V plane,
+ * each half the size in both directions and with a stride of half of
+ * @p stride (rounded up); it is passed to the DCT without any colour
+ * conversion or resampling.
  *
- * See also: epeg_file_open(), epeg_memory_open()
+ * @p im can be a handle from epeg_encoder_new(), or an opened image, whose
+ * source is left untouched. Either way it can be used again afterwards.
+ *
+ * See also: epeg_encoder_new(), epeg_encode()
  */
-extern void epeg_close(Epeg_Image *im)
+extern int epeg_encode_pixels(Epeg_Image *im, const void *pixels,
+                              Epeg_Colorspace format, int w, int h,
+                              int stride)
 {
-   if (im->pixels) {
-      free(im->pixels);
+   const unsigned char *src;
+   unsigned char *volatile work = NULL;
+   unsigned char *data;
+   JSAMPROW *rows;
+   volatile J_COLOR_SPACE color_space;
+   volatile int components, batch;
+   int bpp, i;
+   size_t nrows, row_size;
+
+   if ((!pixels) || (w < 1) || (h < 1)) {
+      return 1;
+   }
+   if (im->out.f) {
+      return 1;
+   }
+
+   switch (format) {
+      case EPEG_GRAY8:
+         bpp = 1;
+         components = 1;
+         color_space = JCS_GRAYSCALE;
+         break;
+
+      case EPEG_YUV8:
+         bpp = 3;
+         components = 3;
+         color_space = JCS_YCbCr;
+         break;
+
+      case EPEG_RGB8:
+      case EPEG_BGR8:
+         bpp = 3;
+         components = 3;
+         color_space = JCS_RGB;
+         break;
+
+      case EPEG_RGBA8:
+      case EPEG_BGRA8:
+      case EPEG_ARGB32:
+         bpp = 4;
+         components = 3;
+         color_space = JCS_RGB;
+         break;
+
+      case EPEG_CMYK:
+         bpp = 4;
+         components = 4;
+         color_space = JCS_CMYK;
+         break;
+
+      case EPEG_RGB565:
+         bpp = 2;
+         components = 3;
+         color_space = JCS_RGB;
+         break;
+
+      case EPEG_RGBX8:
+         bpp = 4;
+         components = 3;
+         color_space = JCS_RGB;
+         break;
+
+      case EPEG_I420:
+         bpp = 1;
+         components = 3;
+         color_space = JCS_YCbCr;
+         break;
+
+      default:
+         return 1;
+   }
+   if (stride <= 0) {
+      stride = (w * bpp);
+   }
+   if (stride < (w * bpp)) {
+      return 1;
+   }
+
+   /* row pointers first, then any rows that have to be copied: */
+   batch = ((im->out.batch > 0) ? MIN(im->out.batch, h) : h);
+   if (format == EPEG_I420) {
+      nrows = (size_t)(16 + 8 + 8);
+      row_size = (size_t)((w + 15) & ~15);
+      row_size = ((16 * row_size) + (16 * (row_size / 2)));
+   } else if ((format == EPEG_GRAY8) || (format == EPEG_YUV8) ||
+              (format == EPEG_RGB8) || (format == EPEG_CMYK)) {
+      nrows = (size_t)batch;
+      row_size = 0;
+   } else {
+      batch = MIN(batch, 16);
+      nrows = (size_t)batch;
+      row_size = ((size_t)batch * (size_t)w * 3);
+   }
+   work = (unsigned char *)malloc((nrows * sizeof(JSAMPROW)) + row_size);
+   if (!work) {
+      return 1;
+   }
+   rows = (JSAMPROW *)work;
+   data = (work + (nrows * sizeof(JSAMPROW)));
+
+   if (_epeg_encode_output_open(im) != 0) {
+      free(work);
+      return 1;
+   }
+
+   im->out.jinfo.err = jpeg_std_error(&(im->jerr.pub));
+   im->jerr.pub.error_exit = _epeg_fatal_error_handler;
+
+   if (setjmp(im->jerr.setjmp_buffer)) {
+      _epeg_encode_abort(im);
+      free(work);
+      return 1;
+   }
+
+   _epeg_encode_begin(im, w, h, components, color_space,
+                      (format == EPEG_I420));
+
+   src = (const unsigned char *)pixels;
+   if (format == EPEG_I420) {
+      const unsigned char *up, *vp;
+      JSAMPARRAY planes[3];
+      int pw, cw, cs, ch, y0;
+
+      pw = ((w + 15) & ~15);
+      cw = (pw / 2);
+      cs = ((stride + 1) / 2);
+      ch = ((h + 1) / 2);
+      up = (src + ((size_t)stride * (size_t)h));
+      vp = (up + ((size_t)cs * (size_t)ch));
+      planes[0] = rows;
+      planes[1] = (rows + 16);
+      planes[2] = (rows + 24);
+
+      /* libjpeg wants whole 16 row strips, padded out to whole blocks, so
+       * edge rows and columns are replicated into the work rows; strips
+       * that lie inside the image with a block aligned width are used in
+       * place: */
+      for ((y0 = 0); (y0 < h); (y0 += 16)) {
+         for ((i = 0); (i < 16); i++) {
+            const unsigned char *s;
+            int sy;
+
+            sy = MIN((y0 + i), (h - 1));
+            s = (src + ((size_t)sy * (size_t)stride));
+            if ((sy == (y0 + i)) && (pw == w)) {
+               rows[i] = (JSAMPROW)s;
+            } else {
+               rows[i] = (data + ((size_t)i * (size_t)pw));
+               memcpy(rows[i], s, (size_t)w);
+               memset((rows[i] + w), rows[i][w - 1], (size_t)(pw - w));
+            }
+         }
+         for ((i = 0); (i < 8); i++) {
+            const unsigned char *su, *sv;
+            int sy, sw;
+
+            sy = MIN(((y0 / 2) + i), (ch - 1));
+            sw = ((w + 1) / 2);
+            su = (up + ((size_t)sy * (size_t)cs));
+            sv = (vp + ((size_t)sy * (size_t)cs));
+            if ((sy == ((y0 / 2) + i)) && (cw == sw)) {
+               rows[16 + i] = (JSAMPROW)su;
+               rows[24 + i] = (JSAMPROW)sv;
+            } else {
+               rows[16 + i] = (data + ((size_t)16 * (size_t)pw) +
+                               ((size_t)i * (size_t)cw));
+               rows[24 + i] = (data + ((size_t)16 * (size_t)pw) +
+                               ((size_t)(8 + i) * (size_t)cw));
+               memcpy(rows[16 + i], su, (size_t)sw);
+               memset((rows[16 + i] + sw), rows[16 + i][sw - 1],
+                      (size_t)(cw - sw));
+               memcpy(rows[24 + i], sv, (size_t)sw);
+               memset((rows[24 + i] + sw), rows[24 + i][sw - 1],
+                      (size_t)(cw - sw));
+            }
+         }
+         jpeg_write_raw_data(&(im->out.jinfo), planes, (JDIMENSION)16);
+      }
+   } else {
+      while (im->out.jinfo.next_scanline < (JDIMENSION)h) {
+         int n, y;
+
+         y = (int)im->out.jinfo.next_scanline;
+         n = MIN(batch, (h - y));
+         for ((i = 0); (i < n); i++) {
+            const unsigned char *s;
+
+            s = (src + ((size_t)(y + i) * (size_t)stride));
+            if (row_size) {
+               rows[i] = (data + ((size_t)i * (size_t)w * 3));
+               _epeg_pixels_row_convert(s, rows[i], w, format);
+            } else {
+               rows[i] = (JSAMPROW)s;
+            }
+         }
+         jpeg_write_scanlines(&(im->out.jinfo), rows, (JDIMENSION)n);
+      }
+   }
+
+   i = _epeg_encode_finish(im);
+   free(work);
+   return i;
+}
+
+/**
+ * FIXME: Document this with a short, sentence-long description of epeg_trim()
+ * @param im A handle to an opened Epeg image.
+ * @return 1 if something happened, otherwise 0.
+ *
+ * FIXME: Document this with a longer, paragraph-long description.
+ */
+extern int epeg_trim(Epeg_Image *im)
+{
+   if (_epeg_decode_for_trim(im) != 0) {
+      return 1;
+   }
+   if (_epeg_trim(im) != 0) {
+      return 1;
+   }
+   if (_epeg_encode(im) != 0) {
+      return 1;
+   }
+   return 0;
+}
+
+/**
+ * Close an image handle.
+ * @param im A handle to an opened Epeg image.
+ * @return Nothing.
+ *
+ * This closes an opened image handle and frees all memory associated with it.
+ * It does NOT free encoded data generated by epeg_memory_output_set() followed
+ * by epeg_encode(), nor does it guarantee to free any data received by
+ * epeg_pixels_get(). Once an image handle is closed, consider it invalid.
+ *
+ * See also: epeg_file_open(), epeg_memory_open()
+ */
+extern void epeg_close(Epeg_Image *im)
+{
+   if (im->pixels) {
+      free(im->pixels);
+   }
+   if (im->lines) {
+      free(im->lines);
+   }
+   if (im->in.file) {
+      free(im->in.file);
+   }
+   if (im->in.fd.on) {
+      _epeg_fd_src_release(&(im->in.jinfo));
+   }
+   if ((im->in.f) || (im->in.cb.func) || (im->in.feed.on) ||
+       (im->in.fd.on)) {
+      jpeg_destroy_decompress(&(im->in.jinfo));
+   }
+   if (im->in.f) {
+      fclose(im->in.f);
+   }
+   if (im->in.feed.buf) {
+      free(im->in.feed.buf);
+   }
+   if (im->in.comment) {
+      free(im->in.comment);
+   }
+   if (im->in.thumb_info.uri) {
+      free(im->in.thumb_info.uri);
+   }
+   if (im->in.thumb_info.mime) {
+      free(im->in.thumb_info.mime);
+   }
+   if (im->out.file) {
+      free(im->out.file);
+   }
+   if (im->out.ready) {
+      jpeg_destroy_compress(&(im->out.jinfo));
+   }
+   if ((im->out.f) && (!im->out.file)) {
+      _epeg_memfile_write_close(im->out.f);
+   }
+   if (im->out.mem.buf) {
+      free(im->out.mem.buf);
+   }
+   if (im->out.comment) {
+      free(im->out.comment);
+   }
+   free(im);
+}
+
+/* static internal private-only function; unnecessary to document: */
+static Epeg_Image *_epeg_open_header(Epeg_Image *im)
+{
+   FILE *volatile tf = NULL;
+
+   im->in.jinfo.err = jpeg_std_error(&(im->jerr.pub));
+   im->jerr.pub.error_exit = _epeg_fatal_error_handler;
+   im->jerr.pub.emit_message = _epeg_warning_handler;
+
+   if (setjmp(im->jerr.setjmp_buffer)) {
+      error:
+      if (tf) {
+         _epeg_memfile_read_close(tf);
+      }
+      epeg_close(im);
+      im = NULL;
+      return NULL;
+   }
+
+   jpeg_create_decompress(&(im->in.jinfo));
+   im->jerr.warning_row = -1;
+   im->jerr.truncated = 0;
+   im->jerr.exceeded = 0;
+   jpeg_save_markers(&(im->in.jinfo), (JPEG_APP0 + 7), 1024);
+   jpeg_save_markers(&(im->in.jinfo), JPEG_COM, 65535);
+   if (im->in.tables) {
+      /* load the shared tables of an abbreviated image first: */
+      tf = _epeg_memfile_read_open(im->in.tables, (size_t)im->in.tables_size);
+      if (!tf) {
+         goto error;
+      }
+      jpeg_stdio_src(&(im->in.jinfo), tf);
+      if (jpeg_read_header(&(im->in.jinfo), FALSE) != JPEG_HEADER_TABLES_ONLY) {
+         goto error;
+      }
+      _epeg_memfile_read_close(tf);
+      tf = NULL;
+      im->in.tables = NULL;
+      im->in.tables_size = 0;
+      im->in.shared_tables = 1;
+   }
+   if (im->in.cb.func) {
+      _epeg_callback_src(&(im->in.jinfo), im->in.cb.func, im->in.cb.data,
+                         im->in.cb.size);
+   } else if (im->in.fd.on) {
+      _epeg_fd_src(&(im->in.jinfo), im->in.fd.num, im->in.fd.cache);
+   } else {
+      jpeg_stdio_src(&(im->in.jinfo), im->in.f);
+   }
+   jpeg_read_header(&(im->in.jinfo), TRUE);
+   if (_epeg_header_parse(im) != 0) {
+      goto error;
+   }
+   return im;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_header_parse(Epeg_Image *im)
+{
+   struct jpeg_marker_struct *m;
+
+   im->in.w = (int)im->in.jinfo.image_width;
+   im->in.h = (int)im->in.jinfo.image_height;
+   if (im->in.w <= 1) {
+      return 1;
+   }
+   if (im->in.h <= 1) {
+      return 1;
+   }
+
+   im->out.w = im->in.w;
+   im->out.h = im->in.h;
+
+   im->color_space = (((im->in.color_space = im->in.jinfo.out_color_space) == JCS_GRAYSCALE) ? EPEG_GRAY8 : EPEG_RGB8);
+   if (im->in.color_space == JCS_CMYK) {
+      im->color_space = EPEG_CMYK;
+   }
+   /* Adobe applications store CMYK inverted, 255 being no ink, and say so
+    * with their APP14 marker; YCCK only ever comes from them: */
+   im->in.cmyk_inverted = (((im->in.jinfo.saw_Adobe_marker) ||
+                            (im->in.jinfo.jpeg_color_space == JCS_YCCK)) ?
+                           1 : 0);
+
+   for ((m = im->in.jinfo.marker_list); m; (m = m->next)) {
+      if (m->marker == JPEG_COM) {
+         if (im->in.comment) {
+            free(im->in.comment);
+         }
+         im->in.comment = (char *)malloc((size_t)(m->data_length + 1));
+         if (im->in.comment) {
+            memcpy(im->in.comment, m->data, (size_t)m->data_length);
+            im->in.comment[m->data_length] = 0;
+         }
+      } else if (m->marker == (JPEG_APP0 + 7))  {
+         if ((m->data_length > 7) &&
+             (!strncmp((char *)m->data, "Thumb::", (size_t)7))) {
+            char *p, *p2;
+
+            p = (char *)malloc((size_t)(m->data_length + 1));
+            if (p) {
+               memcpy(p, m->data, (size_t)m->data_length);
+               p[m->data_length] = 0;
+               p2 = strchr(p, '\n');
+               if (p2) {
+                  p2[0] = 0;
+                  if (!strcmp(p, "Thumb::URI")) {
+                     im->in.thumb_info.uri = strdup(p2 + 1);
+                  } else if (!strcmp(p, "Thumb::MTime")) {
+                     sscanf((p2 + 1), "%llu", &(im->in.thumb_info.mtime));
+                  } else if (!strcmp(p, "Thumb::Image::Width")) {
+                     im->in.thumb_info.w = atoi(p2 + 1);
+                  } else if (!strcmp(p, "Thumb::Image::Height")) {
+                     im->in.thumb_info.h = atoi(p2 + 1);
+                  } else if (!strcmp(p, "Thumb::Mimetype")) {
+                     im->in.thumb_info.mime = strdup(p2 + 1);
+                  }
+               } /* end "if (p2)" */
+               free(p);
+            } /* end "if (p)" */
+         }
+      }
+   } /* end for-loop */
+   return 0;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_decode(Epeg_Image *im)
+{
+   if (im->pixels) {
+      return 1;
+   }
+   /* fed images are decoded by epeg_feed() as their data comes in: */
+   if (im->in.feed.on) {
+      return 1;
+   }
+
+   im->out.jinfo.err = jpeg_std_error(&(im->jerr.pub));
+   im->jerr.pub.error_exit = _epeg_fatal_error_handler;
+   im->jerr.pub.emit_message = _epeg_warning_handler;
+   im->jerr.warning_row = -1;
+   im->jerr.truncated = 0;
+   im->jerr.exceeded = 0;
+
+   if (setjmp(im->jerr.setjmp_buffer)) {
+      if (_epeg_decode_salvage(im) == 0) {
+         return 0;
+      }
+      /* leave the handle for the caller to close: */
+      jpeg_abort_decompress(&(im->in.jinfo));
+      if (im->pixels) {
+         free(im->pixels);
+         im->pixels = NULL;
+      }
+      if (im->lines) {
+         free(im->lines);
+         im->lines = NULL;
+      }
+      im->error = 1;
+      return 1;
+   }
+
+   if (im->in.crop.on) {
+      if (_epeg_decode_crop(im) != 0) {
+         return 1;
+      }
+      _epeg_decode_done(im);
+      return 0;
+   }
+
+   if (_epeg_decode_setup(im) != 0) {
+      return 1;
+   }
+
+   jpeg_start_decompress(&(im->in.jinfo));
+   im->jerr.watch = 1;
+
+   if (im->in.raw.on) {
+      _epeg_decode_raw(im);
+   } else if (im->in.box.k > 1) {
+      _epeg_decode_box(im);
+   }
+   while (im->in.jinfo.output_scanline < im->in.jinfo.output_height) {
+	   jpeg_read_scanlines(&(im->in.jinfo),
+                          &(im->lines[im->in.jinfo.output_scanline]),
+                          (JDIMENSION)im->in.jinfo.rec_outbuf_height);
+   }
+
+   jpeg_finish_decompress(&(im->in.jinfo));
+   _epeg_decode_done(im);
+   return 0;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_decode_fill(Epeg_Image *im, JDIMENSION rows)
+{
+   JDIMENSION y;
+   size_t len;
+
+   /* repeat the last good row down to the bottom: */
+   len = ((size_t)im->in.jinfo.output_width * (size_t)_epeg_pixel_size(im));
+   for ((y = rows); (y < im->in.jinfo.output_height); y++) {
+      memcpy(im->lines[y], im->lines[rows - 1], len);
+   }
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_decode_done(Epeg_Image *im)
+{
+   im->jerr.watch = 0;
+   _epeg_decode_box_done(im);
+   _epeg_decode_crop_done(im);
+   im->in.rows_valid = (int)im->in.jinfo.output_height;
+   if (im->jerr.warning_row >= 0) {
+      im->in.rows_valid = (int)im->jerr.warning_row;
+   }
+   /* libjpeg fills a cut off image with grey; the last good row makes for a
+    * less visible seam in a thumbnail: */
+   if ((im->in.tolerant) && (im->jerr.truncated) && (im->in.rows_valid > 0) &&
+       (im->lines)) {
+      _epeg_decode_fill(im, (JDIMENSION)im->in.rows_valid);
+   }
+   _epeg_decode_cmyk(im);
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_decode_cmyk(Epeg_Image *im)
+{
+   JDIMENSION y;
+   int bpp;
+
+   /* what came out of libjpeg as four channels for a colour space that it
+    * cannot produce itself gets converted in place, each row being no
+    * longer than before and starting no later: */
+   if ((im->color_space == EPEG_CMYK) ||
+       ((im->in.jinfo.out_color_space != JCS_CMYK) &&
+        (im->in.jinfo.out_color_space != JCS_YCCK))) {
+      return;
+   }
+
+   bpp = ((im->color_space == EPEG_GRAY8) ? 1 : 3);
+   for ((y = 0U); (y < im->in.jinfo.output_height); y++) {
+      unsigned char *dst;
+
+      dst = (im->pixels + (y * (unsigned int)bpp * im->in.jinfo.output_width));
+      _epeg_cmyk_row_reduce(im, im->lines[y], dst,
+                            (int)im->in.jinfo.output_width);
+      im->lines[y] = dst;
+   }
+   im->in.jinfo.out_color_space = ((bpp == 1) ? JCS_GRAYSCALE : JCS_RGB);
+   im->in.jinfo.output_components = bpp;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_cmyk_row_reduce(Epeg_Image *im, const unsigned char *src,
+                                 unsigned char *dst, int w)
+{
+   unsigned int flip;
+   int x;
+
+   if (im->color_space != EPEG_GRAY8) {
+      _epeg_cmyk_row_convert(src, dst, w, im->in.cmyk_inverted);
+      return 3;
+   }
+
+   flip = ((im->in.cmyk_inverted) ? 0U : 0xffU);
+   for ((x = 0); (x < w); x++) {
+      unsigned int l;
+
+      if (im->in.jinfo.out_color_space == JCS_YCCK) {
+         /* the Y of YCCK is the luma of the inverted CMY: */
+         l = (255U - src[0]);
+      } else {
+         l = (((77U * (src[0] ^ flip)) + (150U * (src[1] ^ flip)) +
+               (29U * (src[2] ^ flip)) + 128U) >> 8);
+      }
+      dst[x] = (unsigned char)DIV255(l * (src[3] ^ flip));
+      src += 4;
+   }
+   return 1;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_cmyk_row_convert(const unsigned char *src,
+                                   unsigned char *dst, int w, int inverted)
+{
+   unsigned int flip;
+   int x;
+
+   /* inverted CMYK is already 255 - ink, and red is what neither cyan nor
+    * black take away: R = C * K / 255. A flip of the bits turns plain CMYK
+    * into that without a branch in the loop, which leaves it plain
+    * multiplies and shifts for the compiler to vectorise: */
+   flip = ((inverted) ? 0U : 0xffU);
+   for ((x = 0); (x < w); x++) {
+      unsigned int k;
+
+      k = (src[3] ^ flip);
+      dst[0] = (unsigned char)DIV255((src[0] ^ flip) * k);
+      dst[1] = (unsigned char)DIV255((src[1] ^ flip) * k);
+      dst[2] = (unsigned char)DIV255((src[2] ^ flip) * k);
+      src += 4;
+      dst += 3;
+   }
+}
+
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_decode_salvage(Epeg_Image *im)
+{
+   JDIMENSION rows;
+
+   im->jerr.watch = 0;
+   rows = im->in.jinfo.output_scanline;
+   if (im->in.box.k > 1) {
+      rows = (JDIMENSION)im->in.box.rows;
+      _epeg_decode_box_done(im);
+   }
+   if (im->in.crop.on) {
+      rows = (JDIMENSION)im->in.crop.rows;
+      _epeg_decode_crop_done(im);
+   }
+   if ((!im->in.tolerant) || (im->jerr.exceeded) || (!im->lines) ||
+       (rows == 0)) {
+      return 1;
+   }
+
+   _epeg_decode_fill(im, rows);
+   im->in.rows_valid = (int)rows;
+   if ((im->jerr.warning_row >= 0) && (im->jerr.warning_row < (long)rows)) {
+      im->in.rows_valid = (int)im->jerr.warning_row;
+   }
+   /* the scan may have broken off well before the error: */
+   if ((im->jerr.truncated) && (im->in.rows_valid > 0)) {
+      _epeg_decode_fill(im, (JDIMENSION)im->in.rows_valid);
+   }
+   jpeg_abort_decompress(&(im->in.jinfo));
+   _epeg_decode_cmyk(im);
+   return 0;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_decode_params(Epeg_Image *im)
+{
+   int scale, scalew, scaleh;
+
+   scalew = (((im->in.crop.on) ? im->in.crop.w : im->in.w) / im->out.w);
+   scaleh = (((im->in.crop.on) ? im->in.crop.h : im->in.h) / im->out.h);
+
+   scale = scalew;
+   if (scaleh < scalew) {
+      scale = scaleh;
+   }
+
+   /* past the 1/8 that libjpeg can do, whose IDCT then only takes the DC
+    * coefficient of each block, _epeg_decode_box() averages boxes of up to
+    * 8x8 of those as they come in: */
+   im->in.box.k = 1;
+   if ((scale >= 16) && (!im->in.feed.on) && (!im->in.crop.on)) {
+      im->in.box.k = MIN((scale / 8), 8);
+   }
+
+   if (scale > 8) {
+      scale = 8;
+   } else if (scale < 1) {
+      scale = 1;
+   }
+
+   im->in.jinfo.scale_num = 1;
+   im->in.jinfo.scale_denom = (unsigned int)scale;
+   im->in.jinfo.do_fancy_upsampling = FALSE;
+   im->in.jinfo.do_block_smoothing = FALSE;
+   im->in.jinfo.dct_method = JDCT_IFAST;
+   im->in.raw.on = 0;
+
+   switch (im->color_space) {
+      case EPEG_GRAY8:
+			 if ((im->in.jinfo.jpeg_color_space == JCS_CMYK) ||
+			     (im->in.jinfo.jpeg_color_space == JCS_YCCK)) {
+				 /* libjpeg has no grey for these; take the channels as
+				  * stored, without its YCCK to CMYK conversion, and reduce
+				  * them to luma in _epeg_cmyk_row_reduce(): */
+				 im->in.jinfo.out_color_space = im->in.jinfo.jpeg_color_space;
+				 im->in.jinfo.output_components = 4;
+				 break;
+			 }
+			 /* for YCbCr, libjpeg flags the chroma components as not needed
+			  * and skips their dequantization, IDCT and upsampling: */
+			 im->in.jinfo.out_color_space = JCS_GRAYSCALE;
+			 im->in.jinfo.output_components = 1;
+			 break;
+
+      case EPEG_YUV8:
+			 im->in.jinfo.out_color_space = JCS_YCbCr;
+			 break;
+
+      case EPEG_RGB8:
+      case EPEG_BGR8:
+      case EPEG_RGBA8:
+      case EPEG_BGRA8:
+      case EPEG_ARGB32:
+      case EPEG_RGB565:
+      case EPEG_RGBX8:
+			 if ((im->in.jinfo.jpeg_color_space == JCS_CMYK) ||
+			     (im->in.jinfo.jpeg_color_space == JCS_YCCK)) {
+				 /* libjpeg only goes as far as CMYK;
+				  * _epeg_cmyk_row_reduce() takes it on to RGB: */
+				 im->in.jinfo.out_color_space = JCS_CMYK;
+				 im->in.jinfo.output_components = 4;
+				 break;
+			 }
+			 im->in.jinfo.out_color_space = JCS_RGB;
+#ifdef EPEG_HAVE_JCS_RGB565
+			 if ((im->color_space == EPEG_RGB565) && (!im->in.dither) &&
+			     (im->in.box.k < 2)) {
+				 /* its own dither only ever adds, which leaves the image
+				  * brighter on average; _epeg_rgb565_row_pack() does that
+				  * one instead: */
+				 im->in.jinfo.out_color_space = JCS_RGB565;
+				 im->in.jinfo.dither_mode = JDITHER_NONE;
+			 }
+#endif /* EPEG_HAVE_JCS_RGB565 */
+#ifdef JCS_EXTENSIONS
+			 if (im->color_space == EPEG_RGBX8) {
+				 /* RGBA rather than RGBX, which leaves the fourth byte
+				  * undefined: */
+				 im->in.jinfo.out_color_space = JCS_EXT_RGBA;
+			 }
+#endif /* JCS_EXTENSIONS */
+			 break;
+
+      case EPEG_CMYK:
+			 im->in.jinfo.out_color_space = JCS_CMYK;
+			 im->in.jinfo.output_components = 4;
+			 break;
+
+      case EPEG_I420:
+      case EPEG_NV12:
+      case EPEG_YUV444P:
+			 if (im->in.jinfo.jpeg_color_space == JCS_GRAYSCALE) {
+				 /* the chroma planes get filled in flat: */
+				 im->in.jinfo.out_color_space = JCS_GRAYSCALE;
+				 im->in.jinfo.output_components = 1;
+				 break;
+			 }
+			 im->in.jinfo.out_color_space = JCS_YCbCr;
+			 if ((im->color_space != EPEG_YUV444P) &&
+			     (_epeg_decode_raw_check(im) == 0)) {
+				 /* the planes as they are stored are already I420: */
+				 im->in.jinfo.raw_data_out = TRUE;
+				 im->in.raw.on = 1;
+			 }
+			 break;
+
+      default:
+			 break;
+   }
+
+   if (im->in.raw.on) {
+      im->in.box.k = 1;
+   }
+
+   jpeg_calc_output_dimensions(&(im->in.jinfo));
+}
+
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_decode_setup(Epeg_Image *im)
+{
+   JDIMENSION y;
+
+   _epeg_decode_params(im);
+
+   if (im->in.raw.on) {
+      jpeg_component_info *comp;
+      size_t size[3];
+      int c;
+
+      /* libjpeg writes whole blocks of whole iMCU rows, so each plane is
+       * padded out to those. When scaling down, it decodes the chroma
+       * blocks bigger instead of upsampling them, which can leave the
+       * chroma planes at the full size of the Y plane: */
+      comp = im->in.jinfo.comp_info;
+      for ((c = 0); (c < 3); c++) {
+         im->in.raw.stride[c] = (int)(comp[c].width_in_blocks *
+                                      (JDIMENSION)EPEG_DCT_SCALED_W(&(comp[c])));
+         im->in.raw.w[c] = (int)comp[c].downsampled_width;
+         im->in.raw.h[c] = (int)comp[c].downsampled_height;
+         size[c] = ((size_t)im->in.raw.stride[c] *
+                    (size_t)im->in.jinfo.total_iMCU_rows *
+                    (size_t)(comp[c].v_samp_factor *
+                             EPEG_DCT_SCALED_H(&(comp[c]))));
+      }
+      im->in.raw.full = ((EPEG_DCT_SCALED_H(&(comp[1])) ==
+                          (2 * EPEG_DCT_SCALED_H(&(comp[0])))) ? 1 : 0);
+      im->pixels = (unsigned char *)malloc(size[0] + size[1] + size[2]);
+      if (!im->pixels) {
+         return 1;
+      }
+      im->in.raw.plane[0] = im->pixels;
+      im->in.raw.plane[1] = (im->in.raw.plane[0] + size[0]);
+      im->in.raw.plane[2] = (im->in.raw.plane[1] + size[1]);
+      return 0;
+   }
+
+   if (im->in.box.k > 1) {
+      return _epeg_decode_box_setup(im);
+   }
+
+   im->pixels = (unsigned char *)malloc((size_t)(im->in.jinfo.output_width * im->in.jinfo.output_height * (unsigned int)_epeg_pixel_size(im)));
+   if (!im->pixels) {
+      return 1;
+   }
+
+   im->lines = (unsigned char **)malloc(im->in.jinfo.output_height * sizeof(char *));
+   if (!im->lines) {
+      free(im->pixels);
+      im->pixels = NULL;
+      return 1;
+   }
+
+   for ((y = 0U); (y < im->in.jinfo.output_height); y++) {
+	   im->lines[y] = (im->pixels +
+                      ((y * (unsigned int)_epeg_pixel_size(im)) * im->in.jinfo.output_width));
+   }
+
+   return 0;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_decode_raw_check(Epeg_Image *im)
+{
+   jpeg_component_info *comp;
+
+   /* epeg_feed() and crops read scanlines, and only plain 4:2:0 is already
+    * laid out like I420: */
+   if ((im->in.feed.on) || (im->in.crop.on) ||
+       (im->in.jinfo.num_components != 3) ||
+       (im->in.jinfo.jpeg_color_space != JCS_YCbCr)) {
+      return 1;
+   }
+   comp = im->in.jinfo.comp_info;
+   if ((comp[0].h_samp_factor != 2) || (comp[0].v_samp_factor != 2) ||
+       (comp[1].h_samp_factor != 1) || (comp[1].v_samp_factor != 1) ||
+       (comp[2].h_samp_factor != 1) || (comp[2].v_samp_factor != 1)) {
+      return 1;
+   }
+   return 0;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_decode_box_setup(Epeg_Image *im)
+{
+   size_t size, row;
+   int y, n, bpp;
+
+   /* the averaged image first, so that the lines are where they always
+    * are, then the sums of one row of boxes and the rows libjpeg writes to
+    * at once: */
+   bpp = _epeg_pixel_size(im);
+   n = im->in.jinfo.rec_outbuf_height;
+   im->in.box.w = (int)((im->in.jinfo.output_width +
+                         (JDIMENSION)im->in.box.k - 1U) /
+                        (JDIMENSION)im->in.box.k);
+   im->in.box.h = (int)((im->in.jinfo.output_height +
+                         (JDIMENSION)im->in.box.k - 1U) /
+                        (JDIMENSION)im->in.box.k);
+   im->in.box.rows = 0;
+   row = ((size_t)im->in.jinfo.output_width * (size_t)bpp);
+   size = ((size_t)im->in.box.w * (size_t)im->in.box.h * (size_t)bpp);
+   size = (((size + sizeof(JSAMPROW) - 1U) / sizeof(JSAMPROW)) *
+           sizeof(JSAMPROW));
+   im->pixels = (unsigned char *)malloc(size + ((size_t)n * sizeof(JSAMPROW)) +
+                                        ((size_t)im->in.box.w * (size_t)bpp *
+                                         sizeof(unsigned int)) +
+                                        ((size_t)n * row));
+   if (!im->pixels) {
+      return 1;
+   }
+
+   im->lines = (unsigned char **)malloc((size_t)im->in.box.h * sizeof(char *));
+   if (!im->lines) {
+      free(im->pixels);
+      im->pixels = NULL;
+      return 1;
+   }
+
+   for ((y = 0); (y < im->in.box.h); y++) {
+      im->lines[y] = (im->pixels + ((size_t)y * (size_t)bpp *
+                                    (size_t)im->in.box.w));
+   }
+   im->in.box.strip = (JSAMPROW *)(im->pixels + size);
+   im->in.box.sum = (unsigned int *)(im->in.box.strip + n);
+   im->in.box.strip[0] = (unsigned char *)(im->in.box.sum +
+                                           (im->in.box.w * bpp));
+   for ((y = 1); (y < n); y++) {
+      im->in.box.strip[y] = (im->in.box.strip[y - 1] + row);
+   }
+   return 0;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_decode_box(Epeg_Image *im)
+{
+   JDIMENSION first, got, r;
+   size_t len;
+   int x, i, c, k, bpp, cols, div, last;
+
+   k = im->in.box.k;
+   bpp = _epeg_pixel_size(im);
+   len = ((size_t)im->in.box.w * (size_t)bpp * sizeof(unsigned int));
+   memset(im->in.box.sum, 0, len);
+   while (im->in.jinfo.output_scanline < im->in.jinfo.output_height) {
+      first = im->in.jinfo.output_scanline;
+      got = jpeg_read_scanlines(&(im->in.jinfo), im->in.box.strip,
+                                (JDIMENSION)im->in.jinfo.rec_outbuf_height);
+      for ((r = 0U); (r < got); r++) {
+         const unsigned char *s;
+         unsigned int *sum;
+         unsigned char *dst;
+
+         s = im->in.box.strip[r];
+         sum = im->in.box.sum;
+         for ((x = 0); (x < (int)im->in.jinfo.output_width); x++) {
+            for ((c = 0); (c < bpp); c++) {
+               sum[c] += s[c];
+            }
+            s += bpp;
+            if (((x + 1) % k) == 0) {
+               sum += bpp;
+            }
+         }
+         last = ((first + r + 1U) == im->in.jinfo.output_height);
+         if ((((int)(first + r) + 1) % k) && (!last)) {
+            continue;
+         }
+
+         /* a full row of boxes, or the last one cut short: */
+         div = ((((int)(first + r) % k) + 1) * k);
+         cols = (((int)im->in.jinfo.output_width - 1) % k) + 1;
+         dst = im->lines[im->in.box.rows];
+         sum = im->in.box.sum;
+         for ((x = 0); (x < im->in.box.w); x++) {
+            if (x == (im->in.box.w - 1)) {
+               div = ((div / k) * cols);
+            }
+            for ((i = 0); (i < bpp); i++) {
+               dst[i] = (unsigned char)((sum[i] + ((unsigned int)div / 2U)) /
+                                        (unsigned int)div);
+            }
+            dst += bpp;
+            sum += bpp;
+         }
+         memset(im->in.box.sum, 0, len);
+         im->in.box.rows++;
+      }
+   }
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_decode_box_done(Epeg_Image *im)
+{
+   if (im->in.box.k < 2) {
+      return;
+   }
+   /* from here on the averaged image is what was decoded: */
+   im->in.jinfo.output_width = (JDIMENSION)im->in.box.w;
+   im->in.jinfo.output_height = (JDIMENSION)im->in.box.h;
+   if (im->jerr.warning_row > 0) {
+      im->jerr.warning_row /= im->in.box.k;
+   }
+   im->in.box.k = 1;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_decode_crop(Epeg_Image *im)
+{
+   JDIMENSION sx, sy, ex, ey, xoff, width, first, got, r;
+   JSAMPROW *strip;
+   size_t size, row, len;
+   int y, n, bpp, lead;
+
+   _epeg_decode_params(im);
+
+   /* the rectangle in the pixels of the DCT scaled image, rounded out: */
+   sx = (JDIMENSION)(((unsigned long long int)im->in.crop.x *
+                      im->in.jinfo.output_width) / (unsigned int)im->in.w);
+   sy = (JDIMENSION)(((unsigned long long int)im->in.crop.y *
+                      im->in.jinfo.output_height) / (unsigned int)im->in.h);
+   ex = (JDIMENSION)((((unsigned long long int)(im->in.crop.x +
+                                                 im->in.crop.w) *
+                       im->in.jinfo.output_width) +
+                      (unsigned int)im->in.w - 1U) / (unsigned int)im->in.w);
+   ey = (JDIMENSION)((((unsigned long long int)(im->in.crop.y +
+                                                 im->in.crop.h) *
+                       im->in.jinfo.output_height) +
+                      (unsigned int)im->in.h - 1U) / (unsigned int)im->in.h);
+   ex = MIN(MAX(ex, (sx + 1U)), im->in.jinfo.output_width);
+   ey = MIN(MAX(ey, (sy + 1U)), im->in.jinfo.output_height);
+   im->in.crop.top = (int)sy;
+   im->in.crop.rows = 0;
+   im->in.crop.out_w = (int)(ex - sx);
+   im->in.crop.out_h = (int)(ey - sy);
+
+   jpeg_start_decompress(&(im->in.jinfo));
+   im->jerr.watch = 1;
+
+   /* libjpeg-turbo widens the columns out to whole iMCUs and leaves the
+    * rest out of the IDCT; other libraries decode all of them: */
+   xoff = 0U;
+#ifdef EPEG_HAVE_CROP_SCANLINE
+   xoff = sx;
+   width = (ex - sx);
+   jpeg_crop_scanline(&(im->in.jinfo), &xoff, &width);
+#endif /* EPEG_HAVE_CROP_SCANLINE */
+   lead = (int)(sx - xoff);
+
+   /* the cropped image first, so that the lines are where they always are,
+    * then the rows libjpeg writes to at once: */
+   bpp = _epeg_pixel_size(im);
+   n = im->in.jinfo.rec_outbuf_height;
+   row = ((size_t)im->in.jinfo.output_width * (size_t)bpp);
+   len = ((size_t)im->in.crop.out_w * (size_t)bpp);
+   size = (len * (size_t)im->in.crop.out_h);
+   size = (((size + sizeof(JSAMPROW) - 1U) / sizeof(JSAMPROW)) *
+           sizeof(JSAMPROW));
+   im->pixels = (unsigned char *)malloc(size + ((size_t)n *
+                                                (sizeof(JSAMPROW) + row)));
+   if (!im->pixels) {
+      jpeg_abort_decompress(&(im->in.jinfo));
+      return 1;
+   }
+   im->lines = (unsigned char **)malloc((size_t)im->in.crop.out_h *
+                                        sizeof(char *));
+   if (!im->lines) {
+      jpeg_abort_decompress(&(im->in.jinfo));
+      free(im->pixels);
+      im->pixels = NULL;
+      return 1;
+   }
+   for ((y = 0); (y < im->in.crop.out_h); y++) {
+      im->lines[y] = (im->pixels + ((size_t)y * len));
+   }
+   strip = (JSAMPROW *)(im->pixels + size);
+   strip[0] = (unsigned char *)(strip + n);
+   for ((y = 1); (y < n); y++) {
+      strip[y] = (strip[y - 1] + row);
+   }
+
+#ifdef EPEG_HAVE_CROP_SCANLINE
+   if (sy > 0U) {
+      jpeg_skip_scanlines(&(im->in.jinfo), sy);
+   }
+#endif /* EPEG_HAVE_CROP_SCANLINE */
+   while ((im->in.crop.rows < im->in.crop.out_h) &&
+          (im->in.jinfo.output_scanline < im->in.jinfo.output_height)) {
+      first = im->in.jinfo.output_scanline;
+      got = jpeg_read_scanlines(&(im->in.jinfo), strip, (JDIMENSION)n);
+      for ((r = 0U); (r < got); r++) {
+         if ((first + r) < sy) {
+            continue;
+         }
+         if (im->in.crop.rows >= im->in.crop.out_h) {
+            break;
+         }
+         memcpy(im->lines[im->in.crop.rows], (strip[r] + (lead * bpp)), len);
+         im->in.crop.rows++;
+      }
+   }
+
+   /* the rows below are not worth decoding: */
+   if (im->in.jinfo.output_scanline < im->in.jinfo.output_height) {
+      jpeg_abort_decompress(&(im->in.jinfo));
+   } else {
+      jpeg_finish_decompress(&(im->in.jinfo));
+   }
+   return 0;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_decode_crop_done(Epeg_Image *im)
+{
+   if ((!im->in.crop.on) || (!im->lines)) {
+      return;
+   }
+   /* from here on the rectangle is what was decoded: */
+   im->in.jinfo.output_width = (JDIMENSION)im->in.crop.out_w;
+   im->in.jinfo.output_height = (JDIMENSION)im->in.crop.out_h;
+   if (im->jerr.warning_row >= 0) {
+      im->jerr.warning_row = MAX((im->jerr.warning_row - im->in.crop.top),
+                                 0);
+   }
+}
+
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_decode_restart(Epeg_Image *im)
+{
+   /* start over on the same data, for a second decode: */
+   jpeg_abort_decompress(&(im->in.jinfo));
+   if (im->pixels) {
+      free(im->pixels);
+      im->pixels = NULL;
+   }
+   if (im->lines) {
+      free(im->lines);
+      im->lines = NULL;
+   }
+   im->scaled = 0;
+   im->jerr.warning_row = -1;
+   im->jerr.truncated = 0;
+
+   if (setjmp(im->jerr.setjmp_buffer)) {
+      im->error = 1;
+      return 1;
+   }
+   if (im->in.fd.on) {
+      if (_epeg_fd_src_rewind(&(im->in.jinfo)) != 0) {
+         return 1;
+      }
+   } else {
+      if ((!im->in.f) || (fseek(im->in.f, 0L, SEEK_SET) != 0)) {
+         return 1;
+      }
+      jpeg_stdio_src(&(im->in.jinfo), im->in.f);
+   }
+   jpeg_read_header(&(im->in.jinfo), TRUE);
+   return 0;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_decode_settings_save(Epeg_Image *im,
+                                       struct _epeg_decode_settings *s)
+{
+   s->color_space = im->color_space;
+   s->x = im->out.x;
+   s->y = im->out.y;
+   s->w = im->out.w;
+   s->h = im->out.h;
+   s->crop_x = im->in.crop.x;
+   s->crop_y = im->in.crop.y;
+   s->crop_w = im->in.crop.w;
+   s->crop_h = im->in.crop.h;
+   s->crop_on = im->in.crop.on;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_decode_settings_restore(Epeg_Image *im,
+                                          const struct _epeg_decode_settings *s)
+{
+   /* set directly, as the setters ignore images that have pixels: */
+   im->color_space = s->color_space;
+   im->out.x = s->x;
+   im->out.y = s->y;
+   im->out.w = s->w;
+   im->out.h = s->h;
+   im->in.crop.x = s->crop_x;
+   im->in.crop.y = s->crop_y;
+   im->in.crop.w = s->crop_w;
+   im->in.crop.h = s->crop_h;
+   im->in.crop.on = s->crop_on;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_crop_window(Epeg_Image *im, int w, int h)
+{
+   /* the biggest rectangle of the aspect ratio asked for, in the middle of
+    * the image; says whether it is narrower than the image: */
+   if (((long long int)im->in.w * h) > ((long long int)im->in.h * w)) {
+      im->in.crop.h = im->in.h;
+      im->in.crop.w = MAX((int)(((long long int)im->in.h * w) / h), 1);
+      im->in.crop.x = ((im->in.w - im->in.crop.w) / 2);
+      im->in.crop.y = 0;
+      return 1;
+   }
+   im->in.crop.w = im->in.w;
+   im->in.crop.h = MAX((int)(((long long int)im->in.w * h) / w), 1);
+   im->in.crop.x = 0;
+   im->in.crop.y = ((im->in.h - im->in.crop.h) / 2);
+   return 0;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_saliency_crop(Epeg_Image *im, int w, int h)
+{
+   double *score, best, near, total, s;
+   unsigned int hist[16];
+   int gw, gh, cw, ch, x, y, i, j, n, pos, span, len, horizontal;
+
+   gw = (int)im->in.jinfo.output_width;
+   gh = (int)im->in.jinfo.output_height;
+
+   horizontal = _epeg_crop_window(im, w, h);
+   cw = im->in.crop.w;
+   ch = im->in.crop.h;
+
+   /* only one way is left for it to move, so the saliency is only needed
+    * summed up across the other: */
+   len = ((horizontal) ? gw : gh);
+   score = (double *)calloc((size_t)len, sizeof(double));
+   if (!score) {
+      return;
+   }
+   for ((y = 0); (y < gh); y += 8) {
+      for ((x = 0); (x < gw); x += 8) {
+         double entropy;
+
+         /* the entropy of the brightness in 8x8 cells: */
+         memset(hist, 0, sizeof(hist));
+         n = 0;
+         for ((j = y); (j < MIN((y + 8), gh)); j++) {
+            for ((i = x); (i < MIN((x + 8), gw)); i++) {
+               hist[im->lines[j][i] >> 4]++;
+               n++;
+            }
+         }
+         entropy = 0.0;
+         for ((i = 0); (i < 16); i++) {
+            if (hist[i]) {
+               double p;
+
+               p = ((double)hist[i] / (double)n);
+               entropy -= (p * log(p));
+            }
+         }
+         entropy /= log(2.0);
+
+         for ((j = y); (j < MIN((y + 8), gh)); j++) {
+            for ((i = x); (i < MIN((x + 8), gw)); i++) {
+               int dx, dy;
+
+               dx = (im->lines[j][MIN((i + 1), (gw - 1))] -
+                     im->lines[j][MAX((i - 1), 0)]);
+               dy = (im->lines[MIN((j + 1), (gh - 1))][i] -
+                     im->lines[MAX((j - 1), 0)][i]);
+               score[(horizontal) ? i : j] += ((abs(dx) + abs(dy)) *
+                                                (1.0 + (entropy / 4.0)));
+            }
+         }
+      }
+   }
+
+   /* slide the window along, in pixels of the small image, taking up to a
+    * tenth of what an average window scores off for being at the edge, and
+    * the one nearest the centre of those that score the same: */
+   span = ((horizontal) ?
+           (int)(((long long int)cw * gw) / im->in.w) :
+           (int)(((long long int)ch * gh) / im->in.h));
+   span = MIN(MAX(span, 1), len);
+   total = 0.0;
+   for ((i = 0); (i < len); i++) {
+      total += score[i];
+   }
+   s = 0.0;
+   for ((i = 0); (i < span); i++) {
+      s += score[i];
+   }
+   best = 0.0;
+   near = 2.0;
+   pos = 0;
+   for ((i = 0); ; i++) {
+      double centre, value;
+
+      centre = ((len > span) ?
+                ((double)abs((2 * i) - (len - span)) / (double)(len - span)) :
+                0.0);
+      value = (s - (0.1 * centre * ((total * span) / len)));
+      if ((near > 1.0) || (value > best) ||
+          ((value == best) && (centre < near))) {
+         best = value;
+         near = centre;
+         pos = i;
+      }
+      if ((i + span) >= len) {
+         break;
+      }
+      s += (score[i + span] - score[i]);
+   }
+   free(score);
+
+   if (horizontal) {
+      im->in.crop.x = MIN((int)(((long long int)pos * im->in.w) / gw),
+                          (im->in.w - cw));
+   } else {
+      im->in.crop.y = MIN((int)(((long long int)pos * im->in.h) / gh),
+                          (im->in.h - ch));
+   }
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_decode_raw(Epeg_Image *im)
+{
+   JSAMPROW rows[3 * 16];
+   JSAMPARRAY planes[3];
+   JDIMENSION imcu;
+   int n[3], c, i;
+
+   /* an iMCU row is at most two rows of blocks of at most 8 rows each: */
+   for ((c = 0); (c < 3); c++) {
+      planes[c] = (rows + (16 * c));
+      n[c] = (im->in.jinfo.comp_info[c].v_samp_factor *
+              EPEG_DCT_SCALED_H(&(im->in.jinfo.comp_info[c])));
+   }
+   while (im->in.jinfo.output_scanline < im->in.jinfo.output_height) {
+      imcu = (im->in.jinfo.output_scanline / (JDIMENSION)n[0]);
+      for ((c = 0); (c < 3); c++) {
+         for ((i = 0); (i < n[c]); i++) {
+            planes[c][i] = (im->in.raw.plane[c] +
+                            ((((size_t)imcu * (size_t)n[c]) + (size_t)i) *
+                             (size_t)im->in.raw.stride[c]));
+         }
+      }
+      jpeg_read_raw_data(&(im->in.jinfo), planes, (JDIMENSION)n[0]);
+   }
+}
+
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_scale(Epeg_Image *im)
+{
+   unsigned char *dst, *row, *src;
+   int            x, y, w, h, i, bpp;
+
+   if (im->in.raw.on) {
+      return _epeg_scale_raw(im);
+   }
+   /* full size: the decoded pixels are already what gets encoded: */
+   if ((im->in.jinfo.output_width == (JDIMENSION)im->out.w) &&
+       (im->in.jinfo.output_height == (JDIMENSION)im->out.h)) {
+      return 0;
+   }
+   if (im->scaled) {
+      return 1;
+   }
+
+   im->scaled = 1;
+   w = im->out.w;
+   h = im->out.h;
+   bpp = _epeg_pixel_size(im);
+   for ((y = 0); (y < h); y++) {
+      row = (im->pixels +
+             ((((unsigned int)y * im->in.jinfo.output_height) / (unsigned int)h) * (unsigned int)bpp * im->in.jinfo.output_width));
+      dst = (im->pixels +
+             ((unsigned int)(y * bpp) * im->in.jinfo.output_width));
+
+      for ((x = 0); (x < im->out.w); x++) {
+         src = (row +
+                ((((unsigned int)x * im->in.jinfo.output_width) / (unsigned int)w) * (unsigned int)bpp));
+
+         for ((i = 0); (i < bpp); i++) {
+            dst[i] = src[i];
+         } /* end inmost for-loop */
+
+         dst += bpp;
+      } /* end inner for-loop */
+   } /* end outer for-loop */
+   return 0;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_scale_raw(Epeg_Image *im)
+{
+   unsigned char *dst, *row, *next;
+   int c, x, y, w, h, sw, sh, sx, sx2, sy;
+
+   if (im->scaled) {
+      return 1;
+   }
+
+   /* the planes get packed into plain I420 at the output size, which for
+    * the full size only drops the padding; each sample moves to an offset
+    * no later than its own, so it can all be done in place: */
+   im->scaled = 1;
+   dst = im->pixels;
+   for ((c = 0); (c < 3); c++) {
+      w = ((c == 0) ? im->out.w : ((im->out.w + 1) / 2));
+      h = ((c == 0) ? im->out.h : ((im->out.h + 1) / 2));
+      sw = im->in.raw.w[c];
+      sh = im->in.raw.h[c];
+      for ((y = 0); (y < h); y++) {
+         if ((c == 0) || (!im->in.raw.full)) {
+            row = (im->in.raw.plane[c] +
+                   ((size_t)((y * sh) / h) * (size_t)im->in.raw.stride[c]));
+            for ((x = 0); (x < w); x++) {
+               dst[(y * w) + x] = row[(x * sw) / w];
+            }
+            continue;
+         }
+         /* chroma decoded at the full size is sampled where the Y plane
+          * is, and gets the 2x2 average that the encoder would have taken
+          * of it: */
+         sy = (((2 * y) * sh) / im->out.h);
+         row = (im->in.raw.plane[c] +
+                ((size_t)sy * (size_t)im->in.raw.stride[c]));
+         next = row;
+         if ((sy + 1) < sh) {
+            next = (row + im->in.raw.stride[c]);
+         }
+         for ((x = 0); (x < w); x++) {
+            sx = (((2 * x) * sw) / im->out.w);
+            sx2 = MIN((sx + 1), (sw - 1));
+            dst[(y * w) + x] = (unsigned char)((row[sx] + row[sx2] +
+                                                next[sx] + next[sx2] + 2) >> 2);
+         }
+      }
+      im->in.raw.plane[c] = dst;
+      im->in.raw.stride[c] = w;
+      im->in.raw.w[c] = w;
+      im->in.raw.h[c] = h;
+      dst += (w * h);
+   }
+   im->in.raw.full = 0;
+   return 0;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_decode_for_trim(Epeg_Image *im)
+{
+   JDIMENSION y;
+
+   if ((im->pixels) || (im->in.feed.on)) {
+      return 1;
+   }
+
+   im->in.jinfo.scale_num = 1;
+   im->in.jinfo.scale_denom = 1;
+   im->in.jinfo.do_fancy_upsampling = FALSE;
+   im->in.jinfo.do_block_smoothing = FALSE;
+   im->in.jinfo.dct_method = JDCT_ISLOW;
+
+   switch (im->color_space) {
+      case EPEG_GRAY8:
+		   im->in.jinfo.out_color_space = JCS_GRAYSCALE;
+		   im->in.jinfo.output_components = 1;
+		   break;
+
+      case EPEG_YUV8:
+		   im->in.jinfo.out_color_space = JCS_YCbCr;
+		   break;
+
+      case EPEG_RGB8:
+      case EPEG_BGR8:
+      case EPEG_RGBA8:
+      case EPEG_BGRA8:
+      case EPEG_ARGB32:
+      case EPEG_RGB565:
+      case EPEG_RGBX8:
+		   im->in.jinfo.out_color_space = JCS_RGB;
+		   break;
+
+      case EPEG_CMYK:
+		   im->in.jinfo.out_color_space = JCS_CMYK;
+		   im->in.jinfo.output_components = 4;
+		   break;
+
+      default:
+		   break;
+   }
+
+   im->out.jinfo.err = jpeg_std_error(&(im->jerr.pub));
+   im->jerr.pub.error_exit = _epeg_fatal_error_handler;
+   im->jerr.pub.emit_message = _epeg_warning_handler;
+   im->jerr.warning_row = -1;
+   im->jerr.truncated = 0;
+   im->jerr.exceeded = 0;
+
+   if (setjmp(im->jerr.setjmp_buffer)) {
+      /* the same salvage as _epeg_decode_salvage(), on a full size decode
+       * that has no box averaging or crop to undo: */
+      im->jerr.watch = 0;
+      y = im->in.jinfo.output_scanline;
+      if ((!im->in.tolerant) || (im->jerr.exceeded) || (!im->lines) ||
+          (y == 0U)) {
+         return 1;
+      }
+      _epeg_decode_fill(im, y);
+      im->in.rows_valid = (int)y;
+      if ((im->jerr.warning_row >= 0) && (im->jerr.warning_row < (long)y)) {
+         im->in.rows_valid = (int)im->jerr.warning_row;
+      }
+      if ((im->jerr.truncated) && (im->in.rows_valid > 0)) {
+         _epeg_decode_fill(im, (JDIMENSION)im->in.rows_valid);
+      }
+      jpeg_abort_decompress(&(im->in.jinfo));
+      return 0;
+   }
+
+   jpeg_calc_output_dimensions(&(im->in.jinfo));
+
+   im->pixels = (unsigned char *)malloc((size_t)(im->in.jinfo.output_width * im->in.jinfo.output_height * (unsigned int)im->in.jinfo.output_components));
+   if (!im->pixels) {
+      return 1;
+   }
+
+   im->lines = (unsigned char **)malloc(im->in.jinfo.output_height * sizeof(char *));
+   if (!im->lines) {
+      free(im->pixels);
+      im->pixels = NULL;
+      return 1;
+   }
+
+   jpeg_start_decompress(&(im->in.jinfo));
+
+   for ((y = 0U); (y < im->in.jinfo.output_height); y++) {
+      im->lines[y] = (im->pixels +
+                      ((y * im->in.jinfo.output_components) * im->in.jinfo.output_width));
+   }
+
+   im->jerr.watch = 1;
+   while (im->in.jinfo.output_scanline < im->in.jinfo.output_height) {
+      jpeg_read_scanlines(&(im->in.jinfo),
+                          &(im->lines[im->in.jinfo.output_scanline]),
+                          (JDIMENSION)im->in.jinfo.rec_outbuf_height);
+   }
+
+   jpeg_finish_decompress(&(im->in.jinfo));
+   im->jerr.watch = 0;
+   im->in.rows_valid = (int)im->in.jinfo.output_height;
+   if (im->jerr.warning_row >= 0) {
+      im->in.rows_valid = (int)im->jerr.warning_row;
+   }
+   if ((im->in.tolerant) && (im->jerr.truncated) && (im->in.rows_valid > 0)) {
+      _epeg_decode_fill(im, (JDIMENSION)im->in.rows_valid);
+   }
+
+   return 0;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_trim(Epeg_Image *im)
+{
+   int y, a, b, w, h;
+
+   if ((im->in.w == im->out.w) && (im->in.h == im->out.h)) {
+      return 1;
+   }
+   if (im->scaled) {
+      return 1;
+   }
+
+   im->scaled = 1;
+   w = im->out.w;
+   h = im->out.h;
+   a = im->out.x;
+   b = im->out.y;
+
+   /* dummy condition to use value stored to 'w': */
+   if (w == 0) {
+	   ;
+   }
+
+   for ((y = 0); (y < h); y++) {
+	   im->lines[y] = (im->pixels +
+                      ((unsigned int)((y + b) * im->in.jinfo.output_components) * im->in.jinfo.output_width)
+                      + (a * im->in.jinfo.output_components));
+   }
+
+   return 0;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_encode(Epeg_Image *im)
+{
+   int ret;
+
+   if (im->out.f) {
+      return 1;
+   }
+
+   if (im->in.raw.on) {
+      /* _epeg_scale_raw() left plain I420 planes behind: */
+      if (epeg_encode_pixels(im, im->pixels, EPEG_I420, im->out.w,
+                             im->out.h, im->out.w) != 0) {
+         return 1;
+      }
+      ret = 0;
+   } else if (_epeg_pixel_size(im) == 2) {
+      /* libjpeg takes no 16 bit pixels, so they get unpacked again: */
+      if (epeg_encode_pixels(im, im->pixels, EPEG_RGB565, im->out.w,
+                             im->out.h,
+                             (int)(im->in.jinfo.output_width * 2U)) != 0) {
+         return 1;
+      }
+      ret = 0;
+   } else {
+      if (_epeg_encode_output_open(im) != 0) {
+         return 1;
+      }
+
+      im->out.jinfo.err = jpeg_std_error(&(im->jerr.pub));
+      im->jerr.pub.error_exit = _epeg_fatal_error_handler;
+
+      if (setjmp(im->jerr.setjmp_buffer)) {
+         _epeg_encode_abort(im);
+         return 1;
+      }
+
+      _epeg_encode_begin(im, im->out.w, im->out.h,
+                         im->in.jinfo.output_components,
+                         im->in.jinfo.out_color_space, 0);
+
+      while (im->out.jinfo.next_scanline < im->out.h) {
+         JDIMENSION rows;
+
+         rows = ((JDIMENSION)im->out.h - im->out.jinfo.next_scanline);
+         if ((im->out.batch > 0) && (rows > (JDIMENSION)im->out.batch)) {
+            rows = (JDIMENSION)im->out.batch;
+         }
+         jpeg_write_scanlines(&(im->out.jinfo),
+                              &(im->lines[im->out.jinfo.next_scanline]),
+                              rows);
+      }
+
+      ret = _epeg_encode_finish(im);
+   }
+
+   if (im->in.fd.on) {
+      _epeg_fd_src_release(&(im->in.jinfo));
+   }
+   if ((im->in.f) || (im->in.cb.func) || (im->in.feed.on) ||
+       (im->in.fd.on)) {
+      jpeg_destroy_decompress(&(im->in.jinfo));
+   }
+   if ((im->in.f) && (im->in.file)) {
+      fclose(im->in.f);
+   }
+   if ((im->in.f) && (!im->in.file)) {
+      _epeg_memfile_read_close(im->in.f);
+   }
+   im->in.f = NULL;
+   im->in.cb.func = NULL;
+   im->in.feed.on = 0;
+   im->in.fd.on = 0;
+
+   return ret;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_encode_output_open(Epeg_Image *im)
+{
+   int flags;
+
+   im->out.mem.buf = NULL;
+   im->out.mem.len = 0;
+   im->out.fd = -1;
+   if ((!im->out.file) && (im->out.cb.func)) {
+      return 0;
+   }
+   if (!im->out.file) {
+      im->out.f = _epeg_memfile_write_open(&(im->out.mem.buf),
+                                           &(im->out.mem.len));
+      if (!im->out.f) {
+         im->error = 1;
+         return 1;
+      }
+      return 0;
+   }
+
+   /* files get written with plain write() calls from our own buffer, which
+    * saves the extra copy and the locking of stdio: */
+   if ((im->out.atomic) || (im->out.sync)) {
+      im->out.fd = _epeg_atomic_open(im->out.file, &(im->out.tmp));
+   } else {
+      flags = ((im->out.mmap ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC);
+#ifdef O_CLOEXEC
+      flags |= O_CLOEXEC;
+#endif /* O_CLOEXEC */
+#ifdef O_BINARY
+      flags |= O_BINARY;
+#endif /* O_BINARY */
+      im->out.fd = open(im->out.file, flags, 0666);
+   }
+   if (im->out.fd < 0) {
+      im->error = 1;
+      return 1;
+   }
+   return 0;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_encode_begin(Epeg_Image *im, int w, int h, int components,
+                               J_COLOR_SPACE color_space, int raw)
+{
+   im->out.stats.size = 0;
+   im->out.stats.markers_saved = 0;
+
+   /* a fresh compressor every time: jpeg_set_defaults() does not replace
+    * Huffman tables that are already there, so a reused one would keep the
+    * optimised tables of the previous image: */
+   jpeg_create_compress(&(im->out.jinfo));
+   im->out.ready = 1;
+   if ((im->out.file) && (im->out.mmap)) {
+      /* a first guess of about 2 bits per sample; it doubles as needed: */
+      _epeg_mmap_dest(&(im->out.jinfo), im->out.fd,
+                      ((size_t)w * (size_t)h * (size_t)components / 4));
+   } else if (im->out.file) {
+      _epeg_fd_dest(&(im->out.jinfo), im->out.fd);
+   } else if (im->out.cb.func) {
+      _epeg_callback_dest(&(im->out.jinfo), im->out.cb.func, im->out.cb.data,
+                          im->out.cb.chunk);
+   } else {
+      jpeg_stdio_dest(&(im->out.jinfo), im->out.f);
+   }
+   im->out.jinfo.image_width = (JDIMENSION)w;
+   im->out.jinfo.image_height = (JDIMENSION)h;
+   im->out.jinfo.input_components = components;
+   im->out.jinfo.in_color_space = color_space;
+   jpeg_set_defaults(&(im->out.jinfo));
+   jpeg_set_quality(&(im->out.jinfo), im->out.quality, TRUE);
+   _epeg_encode_settings_apply(im);
+   if (raw) {
+      /* planar 4:2:0 input goes straight to the DCT: */
+      im->out.jinfo.raw_data_in = TRUE;
+      im->out.jinfo.comp_info[0].h_samp_factor = 2;
+      im->out.jinfo.comp_info[0].v_samp_factor = 2;
+      im->out.jinfo.comp_info[1].h_samp_factor = 1;
+      im->out.jinfo.comp_info[1].v_samp_factor = 1;
+      im->out.jinfo.comp_info[2].h_samp_factor = 1;
+      im->out.jinfo.comp_info[2].v_samp_factor = 1;
+   }
+   if (im->out.abbreviated) {
+      jpeg_suppress_tables(&(im->out.jinfo), TRUE);
+      jpeg_start_compress(&(im->out.jinfo), FALSE);
+   } else {
+      jpeg_start_compress(&(im->out.jinfo), TRUE);
+   }
+
+   _epeg_encode_markers_write(im);
+}
+
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_encode_finish(Epeg_Image *im)
+{
+   jpeg_finish_compress(&(im->out.jinfo));
+   if ((im->out.file) || (im->out.cb.func)) {
+      im->out.stats.size = (int)_epeg_fd_dest_written(&(im->out.jinfo));
+   } else {
+      im->out.stats.size = (int)ftell(im->out.f);
+   }
+   jpeg_destroy_compress(&(im->out.jinfo));
+   im->out.ready = 0;
+
+   return _epeg_encode_output_close(im);
+}
+
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_encode_output_close(Epeg_Image *im)
+{
+   int ret;
+
+   ret = 0;
+   if (im->out.file) {
+      /* NFS and the like only report some write errors on close: */
+      if (close(im->out.fd) != 0) {
+         ret = 1;
+         if (im->out.tmp) {
+            unlink(im->out.tmp);
+            free(im->out.tmp);
+            im->out.tmp = NULL;
+         }
+      }
+   } else if (im->out.f) {
+      _epeg_memfile_write_close(im->out.f);
+   }
+   im->out.f = NULL;
+   im->out.fd = -1;
+
+   /* atomic output only shows up under its real name once it is complete: */
+   if (im->out.tmp) {
+      char *tmp;
+
+      tmp = im->out.tmp;
+      im->out.tmp = NULL;
+      if (_epeg_atomic_commit(im->out.sync, tmp, im->out.file) != 0) {
+         ret = 1;
+      }
+   }
+   if (ret) {
+      im->error = 1;
    }
-   if (im->lines) {
-      free(im->lines);
+
+   if ((!im->out.file) && (!im->out.cb.func) && (im->out.mem.data)) {
+	   *(im->out.mem.data) = (unsigned char *)im->out.mem.buf;
+   } else if (im->out.mem.buf) {
+      free(im->out.mem.buf);
    }
-   if (im->in.file) {
-      free(im->in.file);
+   if ((!im->out.file) && (!im->out.cb.func) && (im->out.mem.size)) {
+	   *(im->out.mem.size) = (int)im->out.mem.len;
    }
-   if (im->in.f) {
-      jpeg_destroy_decompress(&(im->in.jinfo));
+   im->out.mem.buf = NULL;
+   im->out.mem.len = 0;
+   return ret;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_encode_abort(Epeg_Image *im)
+{
+   if ((im->out.ready) && (im->out.file)) {
+      _epeg_fd_dest_release(&(im->out.jinfo));
    }
-   if (im->in.f) {
-      fclose(im->in.f);
+   if (im->out.ready) {
+      jpeg_destroy_compress(&(im->out.jinfo));
    }
-   if (im->in.comment) {
-      free(im->in.comment);
+   im->out.ready = 0;
+   if ((im->out.fd >= 0) && (im->out.file)) {
+      close(im->out.fd);
    }
-   if (im->in.thumb_info.uri) {
-      free(im->in.thumb_info.uri);
+   if (im->out.tmp) {
+      unlink(im->out.tmp);
+      free(im->out.tmp);
    }
-   if (im->in.thumb_info.mime) {
-      free(im->in.thumb_info.mime);
+   im->out.tmp = NULL;
+   if ((im->out.f) && (!im->out.file)) {
+      _epeg_memfile_write_close(im->out.f);
    }
-   if (im->out.file) {
-      free(im->out.file);
+   im->out.f = NULL;
+   im->out.fd = -1;
+   if (im->out.mem.buf) {
+      free(im->out.mem.buf);
    }
-   if (im->out.f) {
-      jpeg_destroy_compress(&(im->out.jinfo));
+   im->out.mem.buf = NULL;
+   im->out.mem.len = 0;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_encode_scan_script_set(Epeg_Image *im)
+{
+   /* DC first, then luma AC split at coefficient 8, then each chroma AC band
+    * whole. On thumbnail-sized images this beats both a sequential file and
+    * jpeg_simple_progression(), whose successive approximation scans each
+    * pay for their own Huffman tables: */
+   static const jpeg_scan_info ycc_script[] = {
+      { 3, { 0, 1, 2 }, 0, 0, 0, 0 },
+      { 1, { 0 }, 1, 8, 0, 0 },
+      { 1, { 0 }, 9, 63, 0, 0 },
+      { 1, { 1 }, 1, 63, 0, 0 },
+      { 1, { 2 }, 1, 63, 0, 0 }
+   };
+   static const jpeg_scan_info gray_script[] = {
+      { 1, { 0 }, 0, 0, 0, 0 },
+      { 1, { 0 }, 1, 8, 0, 0 },
+      { 1, { 0 }, 9, 63, 0, 0 }
+   };
+   long pixels;
+
+   pixels = ((long)im->out.jinfo.image_width *
+             (long)im->out.jinfo.image_height);
+   if (pixels < (128L * 128L)) {
+      /* too small for the scan headers to pay for themselves: */
+      return;
    }
-   if (im->out.f) {
-      fclose(im->out.f);
+   if (pixels >= (512L * 512L)) {
+      jpeg_simple_progression(&(im->out.jinfo));
+      return;
    }
-   if (im->out.comment) {
-      free(im->out.comment);
+   if ((im->out.jinfo.jpeg_color_space == JCS_YCbCr) &&
+       (im->out.jinfo.num_components == 3)) {
+      im->out.jinfo.scan_info = ycc_script;
+      im->out.jinfo.num_scans = (int)(sizeof(ycc_script) / sizeof(ycc_script[0]));
+   } else if (im->out.jinfo.num_components == 1) {
+      im->out.jinfo.scan_info = gray_script;
+      im->out.jinfo.num_scans = (int)(sizeof(gray_script) / sizeof(gray_script[0]));
+   } else {
+      jpeg_simple_progression(&(im->out.jinfo));
    }
-   free(im);
 }
 
 /* static internal private-only function; unnecessary to document: */
-static Epeg_Image *_epeg_open_header(Epeg_Image *im)
+static void _epeg_encode_settings_apply(Epeg_Image *im)
 {
-   struct jpeg_marker_struct *m;
+   int h, v;
 
-   im->in.jinfo.err = jpeg_std_error(&(im->jerr.pub));
-   im->jerr.pub.error_exit = _epeg_fatal_error_handler;
+   /* these have to come after jpeg_set_defaults(), which resets them: */
+   switch (im->out.dct_method) {
+      case EPEG_DCT_ISLOW:
+         im->out.jinfo.dct_method = JDCT_ISLOW;
+         break;
 
-   if (setjmp(im->jerr.setjmp_buffer)) {
-      error:
-      epeg_close(im);
-      im = NULL;
-      return NULL;
+      case EPEG_DCT_IFAST:
+         im->out.jinfo.dct_method = JDCT_IFAST;
+         break;
+
+      case EPEG_DCT_FLOAT:
+         im->out.jinfo.dct_method = JDCT_FLOAT;
+         break;
+
+      case EPEG_DCT_AUTO:
+      default:
+         /* the libjpeg default, which the encoder has always ended up with: */
+         im->out.jinfo.dct_method = JDCT_ISLOW;
+         break;
    }
 
-   jpeg_create_decompress(&(im->in.jinfo));
-   jpeg_save_markers(&(im->in.jinfo), (JPEG_APP0 + 7), 1024);
-   jpeg_save_markers(&(im->in.jinfo), JPEG_COM, 65535);
-   jpeg_stdio_src(&(im->in.jinfo), im->in.f);
-   jpeg_read_header(&(im->in.jinfo), TRUE);
-   im->in.w = (int)im->in.jinfo.image_width;
-   im->in.h = (int)im->in.jinfo.image_height;
-   if (im->in.w <= 1) {
-      goto error;
+   /* the tables of an abbreviated image have to match the shared ones: */
+   im->out.jinfo.optimize_coding = ((im->out.optimize && !im->out.abbreviated) ?
+                                    TRUE : FALSE);
+
+   if (im->out.markers & EPEG_MARKER_JFIF) {
+      im->out.jinfo.write_JFIF_header = TRUE;
+   } else {
+      /* a JFIF APP0 is 2 bytes of marker, 2 of length and 14 of data: */
+      im->out.jinfo.write_JFIF_header = FALSE;
+      im->out.stats.markers_saved += 18;
    }
-   if (im->in.h <= 1) {
-      goto error;
+
+   if (im->out.progressive && !im->out.abbreviated) {
+      _epeg_encode_scan_script_set(im);
    }
 
-   im->out.w = im->in.w;
-   im->out.h = im->in.h;
+   switch (im->out.subsampling) {
+      case EPEG_SUBSAMPLING_444:
+         h = 1;
+         v = 1;
+         break;
 
-   im->color_space = (((im->in.color_space = im->in.jinfo.out_color_space) == JCS_GRAYSCALE) ? EPEG_GRAY8 : EPEG_RGB8);
-   if (im->in.color_space == JCS_CMYK) {
-      im->color_space = EPEG_CMYK;
-   }
+      case EPEG_SUBSAMPLING_422:
+         h = 2;
+         v = 1;
+         break;
 
-   for ((m = im->in.jinfo.marker_list); m; (m = m->next)) {
-      if (m->marker == JPEG_COM) {
-         if (im->in.comment) {
-            free(im->in.comment);
-         }
-         im->in.comment = (char *)malloc((size_t)(m->data_length + 1));
-         if (im->in.comment) {
-            memcpy(im->in.comment, m->data, (size_t)m->data_length);
-            im->in.comment[m->data_length] = 0;
-         }
-      } else if (m->marker == (JPEG_APP0 + 7))  {
-         if ((m->data_length > 7) &&
-             (!strncmp((char *)m->data, "Thumb::", (size_t)7))) {
-            char *p, *p2;
+      case EPEG_SUBSAMPLING_420:
+         h = 2;
+         v = 2;
+         break;
 
-            p = (char *)malloc((size_t)(m->data_length + 1));
-            if (p) {
-               memcpy(p, m->data, (size_t)m->data_length);
-               p[m->data_length] = 0;
-               p2 = strchr(p, '\n');
-               if (p2) {
-                  p2[0] = 0;
-                  if (!strcmp(p, "Thumb::URI")) {
-                     im->in.thumb_info.uri = strdup(p2 + 1);
-                  } else if (!strcmp(p, "Thumb::MTime")) {
-                     sscanf((p2 + 1), "%llu", &(im->in.thumb_info.mtime));
-                  } else if (!strcmp(p, "Thumb::Image::Width")) {
-                     im->in.thumb_info.w = atoi(p2 + 1);
-                  } else if (!strcmp(p, "Thumb::Image::Height")) {
-                     im->in.thumb_info.h = atoi(p2 + 1);
-                  } else if (!strcmp(p, "Thumb::Mimetype")) {
-                     im->in.thumb_info.mime = strdup(p2 + 1);
-                  }
-               } /* end "if (p2)" */
-               free(p);
-            } /* end "if (p)" */
+      case EPEG_SUBSAMPLING_AUTO:
+      default:
+         if (im->out.quality < 90) {
+            return;
          }
-      }
-   } /* end for-loop */
-   return im;
+         h = 1;
+         v = 1;
+         break;
+   }
+
+   if ((im->out.jinfo.jpeg_color_space != JCS_YCbCr) ||
+       (im->out.jinfo.num_components != 3)) {
+      return;
+   }
+   im->out.jinfo.comp_info[0].h_samp_factor = h;
+   im->out.jinfo.comp_info[0].v_samp_factor = v;
+   im->out.jinfo.comp_info[1].h_samp_factor = 1;
+   im->out.jinfo.comp_info[1].v_samp_factor = 1;
+   im->out.jinfo.comp_info[2].h_samp_factor = 1;
+   im->out.jinfo.comp_info[2].v_samp_factor = 1;
 }
 
 /* static internal private-only function; unnecessary to document: */
-static int _epeg_decode(Epeg_Image *im)
+static void _epeg_encode_marker_write(Epeg_Image *im, int marker, int flag,
+                                      const char *data)
 {
-   int scale, scalew, scaleh;
-   JDIMENSION y;
+   unsigned int len;
+
+   len = (unsigned int)strlen(data);
+   if ((im->out.markers & flag) && (im->out.head)) {
+      fputc(0xff, im->out.head);
+      fputc(marker, im->out.head);
+      fputc((int)(((len + 2U) >> 8) & 0xff), im->out.head);
+      fputc((int)((len + 2U) & 0xff), im->out.head);
+      fwrite(data, (size_t)len, (size_t)1, im->out.head);
+   } else if (im->out.markers & flag) {
+      jpeg_write_marker(&(im->out.jinfo), marker, (const JOCTET *)data, len);
+   } else {
+      /* 2 bytes of marker and 2 of length on top of the data: */
+      im->out.stats.markers_saved += (int)(len + 4U);
+   }
+}
 
-   if (im->pixels) {
-      return 1;
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_encode_markers_write(Epeg_Image *im)
+{
+   if (im->out.comment) {
+      _epeg_encode_marker_write(im, JPEG_COM, EPEG_MARKER_COMMENT,
+                                im->out.comment);
    }
 
-   scalew = (im->in.w / im->out.w);
-   scaleh = (im->in.h / im->out.h);
+   /* thumbnail comments describe the source image, so a handle made by
+    * epeg_encoder_new() has none to write: */
+   if ((im->out.thumbnail_info) && (im->in.w > 0)) {
+      char buf[8192];
 
-   scale = scalew;
-   if (scaleh < scalew) {
-      scale = scaleh;
+      if (im->in.file) {
+         snprintf(buf, sizeof(buf), "Thumb::URI\nfile://%s", im->in.file);
+         _epeg_encode_marker_write(im, (JPEG_APP0 + 7), EPEG_MARKER_THUMBNAIL,
+                                   buf);
+         snprintf(buf, sizeof(buf), "Thumb::MTime\n%llu",
+#if defined(HAVE_UINTMAX_T) && !defined(__LP64__)
+                  (uintmax_t)im->stat_info.st_mtime);
+#else
+               (unsigned long long int)im->stat_info.st_mtime);
+#endif /* HAVE_UINTMAX_T && !__LP64__ */
+         _epeg_encode_marker_write(im, (JPEG_APP0 + 7), EPEG_MARKER_THUMBNAIL,
+                                   buf);
+      }
+      snprintf(buf, sizeof(buf), "Thumb::Image::Width\n%i", im->in.w);
+      _epeg_encode_marker_write(im, (JPEG_APP0 + 7), EPEG_MARKER_THUMBNAIL,
+                                buf);
+      snprintf(buf, sizeof(buf), "Thumb::Image::Height\n%i", im->in.h);
+      _epeg_encode_marker_write(im, (JPEG_APP0 + 7), EPEG_MARKER_THUMBNAIL,
+                                buf);
+      snprintf(buf, sizeof(buf), "Thumb::Mimetype\nimage/jpeg");
+      _epeg_encode_marker_write(im, (JPEG_APP0 + 7), EPEG_MARKER_THUMBNAIL,
+                                buf);
    }
+}
 
-   if (scale > 8) {
-      scale = 8;
-   } else if (scale < 1) {
-      scale = 1;
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_quality_estimate(Epeg_Image *im, int component)
+{
+   /* the luminance and chrominance tables of the JPEG spec, that
+    * jpeg_set_quality() scales: */
+   static const unsigned int std_luma[DCTSIZE2] = {
+      16, 11, 10, 16, 24, 40, 51, 61,
+      12, 12, 14, 19, 26, 58, 60, 55,
+      14, 13, 16, 24, 40, 57, 69, 56,
+      14, 17, 22, 29, 51, 87, 80, 62,
+      18, 22, 37, 56, 68, 109, 103, 77,
+      24, 35, 55, 64, 81, 104, 113, 92,
+      49, 64, 78, 87, 103, 121, 120, 101,
+      72, 92, 95, 98, 112, 100, 103, 99
+   };
+   static const unsigned int std_chroma[DCTSIZE2] = {
+      17, 18, 24, 47, 99, 99, 99, 99,
+      18, 21, 26, 66, 99, 99, 99, 99,
+      24, 26, 56, 99, 99, 99, 99, 99,
+      47, 66, 99, 99, 99, 99, 99, 99,
+      99, 99, 99, 99, 99, 99, 99, 99,
+      99, 99, 99, 99, 99, 99, 99, 99,
+      99, 99, 99, 99, 99, 99, 99, 99,
+      99, 99, 99, 99, 99, 99, 99, 99
+   };
+   const unsigned int *std;
+   JQUANT_TBL *q;
+   long sum, ref;
+   int i, scale;
+
+   q = NULL;
+   if ((im->in.jinfo.comp_info[component].quant_tbl_no >= 0) &&
+       (im->in.jinfo.comp_info[component].quant_tbl_no < NUM_QUANT_TBLS)) {
+      q = im->in.jinfo.quant_tbl_ptrs[im->in.jinfo.comp_info[component].quant_tbl_no];
    }
+   if (!q) {
+      return 101;
+   }
+   std = ((component > 0) ? std_chroma : std_luma);
+   sum = 0;
+   ref = 0;
+   for ((i = 0); (i < DCTSIZE2); i++) {
+      sum += (long)q->quantval[i];
+      ref += (long)std[i];
+   }
+   /* invert the scaling of jpeg_quality_scaling(): */
+   scale = (int)(((sum * 100L) + (ref / 2L)) / ref);
+   if (scale <= 0) {
+      return 100;
+   }
+   if (scale <= 100) {
+      return ((200 - scale) / 2);
+   }
+   return MAX((5000 / scale), 1);
+}
 
-   im->in.jinfo.scale_num = 1;
-   im->in.jinfo.scale_denom = (unsigned int)scale;
-   im->in.jinfo.do_fancy_upsampling = FALSE;
-   im->in.jinfo.do_block_smoothing = FALSE;
-   im->in.jinfo.dct_method = JDCT_IFAST;
-
-   switch (im->color_space) {
-      case EPEG_GRAY8:
-			 im->in.jinfo.out_color_space = JCS_GRAYSCALE;
-			 im->in.jinfo.output_components = 1;
-			 break;
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_passthrough_check(Epeg_Image *im)
+{
+   if ((!im->out.passthrough) || (!im->in.f) || (im->pixels)) {
+      return 0;
+   }
+   if ((im->out.w != im->in.w) || (im->out.h != im->in.h) ||
+       (im->out.x != 0) || (im->out.y != 0)) {
+      return 0;
+   }
+   if ((im->out.abbreviated) || (im->in.shared_tables)) {
+      return 0;
+   }
+   if ((im->in.file) && (!S_ISREG(im->stat_info.st_mode))) {
+      return 0;
+   }
+   switch (im->in.jinfo.jpeg_color_space) {
+      case JCS_GRAYSCALE:
+         break;
 
-      case EPEG_YUV8:
-			 im->in.jinfo.out_color_space = JCS_YCbCr;
-			 break;
+      case JCS_YCbCr:
+         if (im->color_space == EPEG_GRAY8) {
+            return 0;
+         }
+         break;
 
-      case EPEG_RGB8:
-      case EPEG_BGR8:
-      case EPEG_RGBA8:
-      case EPEG_BGRA8:
-      case EPEG_ARGB32:
-			 im->in.jinfo.out_color_space = JCS_RGB;
-			 break;
+      default:
+         return 0;
+   }
 
-      case EPEG_CMYK:
-			 im->in.jinfo.out_color_space = JCS_CMYK;
-			 im->in.jinfo.output_components = 4;
-			 break;
+   /* a re-encode would write the source markers that these flags keep: */
+   if ((im->out.markers & EPEG_MARKER_JFIF) &&
+       (!im->in.jinfo.saw_JFIF_marker)) {
+      return 0;
+   }
 
-      default:
-			 break;
+   /* nor would it change the layout of the scans: */
+   if (im->in.jinfo.num_components == 3) {
+      int h, v;
+
+      switch (im->out.subsampling) {
+         case EPEG_SUBSAMPLING_444:
+            h = 1;
+            v = 1;
+            break;
+
+         case EPEG_SUBSAMPLING_422:
+            h = 2;
+            v = 1;
+            break;
+
+         case EPEG_SUBSAMPLING_AUTO:
+            if (im->out.quality >= 90) {
+               h = 1;
+               v = 1;
+               break;
+            }
+            /* fall through */
+         case EPEG_SUBSAMPLING_420:
+         default:
+            h = 2;
+            v = 2;
+            break;
+      }
+      if ((im->in.jinfo.comp_info[0].h_samp_factor != h) ||
+          (im->in.jinfo.comp_info[0].v_samp_factor != v) ||
+          (im->in.jinfo.comp_info[1].h_samp_factor != 1) ||
+          (im->in.jinfo.comp_info[1].v_samp_factor != 1) ||
+          (im->in.jinfo.comp_info[2].h_samp_factor != 1) ||
+          (im->in.jinfo.comp_info[2].v_samp_factor != 1)) {
+         return 0;
+      }
+   }
+   /* _epeg_encode_scan_script_set() keeps small images sequential: */
+   if (((im->out.progressive) &&
+        (((long)im->in.w * (long)im->in.h) >= (128L * 128L))) !=
+       (im->in.jinfo.progressive_mode ? 1 : 0)) {
+      return 0;
+   }
+   if ((im->out.optimize) && (!_epeg_passthrough_optimized(im))) {
+      return 0;
    }
 
-   im->out.jinfo.err = jpeg_std_error(&(im->jerr.pub));
-   im->jerr.pub.error_exit = _epeg_fatal_error_handler;
+   if (_epeg_quality_estimate(im, 0) > im->out.quality) {
+      return 0;
+   }
+   if ((im->in.jinfo.num_components == 3) &&
+       (_epeg_quality_estimate(im, 1) > im->out.quality)) {
+      return 0;
+   }
+   return 1;
+}
 
-   if (setjmp(im->jerr.setjmp_buffer)) {
-      epeg_close(im);
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_passthrough_optimized(Epeg_Image *im)
+{
+   /* the code lengths of the luminance tables of the JPEG spec, which is
+    * what a baseline source without optimised tables is coded with: */
+   static const UINT8 std_dc_bits[16] = {
+      0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0
+   };
+   static const UINT8 std_ac_bits[16] = {
+      0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d
+   };
+   JHUFF_TBL *dc, *ac;
+
+   /* libjpeg codes progressive scans with tables made for them: */
+   if (im->in.jinfo.progressive_mode) {
       return 1;
    }
+   dc = im->in.jinfo.dc_huff_tbl_ptrs[0];
+   ac = im->in.jinfo.ac_huff_tbl_ptrs[0];
+   if ((!dc) || (!ac)) {
+      return 0;
+   }
+   return ((memcmp((dc->bits + 1), std_dc_bits, sizeof(std_dc_bits)) != 0) ||
+           (memcmp((ac->bits + 1), std_ac_bits, sizeof(std_ac_bits)) != 0));
+}
 
-   jpeg_calc_output_dimensions(&(im->in.jinfo));
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_passthrough_scan(const unsigned char *d, size_t len,
+                                  size_t *sos)
+{
+   size_t pos;
 
-   im->pixels = (unsigned char *)malloc((size_t)(im->in.jinfo.output_width * im->in.jinfo.output_height * (unsigned int)im->in.jinfo.output_components));
-   if (!im->pixels) {
-      return 1;
+   if ((len < 2) || (d[0] != 0xff) || (d[1] != 0xd8)) {
+      return -1;
    }
+   pos = 2;
+   for (;;) {
+      size_t seg;
 
-   im->lines = (unsigned char **)malloc(im->in.jinfo.output_height * sizeof(char *));
-   if (!im->lines) {
-      free(im->pixels);
-      im->pixels = NULL;
+      if ((pos + 4) > len) {
+         return 1;
+      }
+      if (d[pos] != 0xff) {
+         return -1;
+      }
+      if (d[pos + 1] == 0xff) {
+         /* fill byte: */
+         pos++;
+         continue;
+      }
+      if (d[pos + 1] == 0xda) {
+         *sos = pos;
+         return 0;
+      }
+      seg = (size_t)((d[pos + 2] << 8) | d[pos + 3]);
+      if (seg < 2) {
+         return -1;
+      }
+      pos += (2 + seg);
+   }
+}
+
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_passthrough_write(Epeg_Image *im, const unsigned char *data,
+                                   size_t len)
+{
+   size_t left;
+
+   if (im->out.file) {
+      if (_epeg_fd_write(im->out.fd, data, len) != 0) {
+         return 1;
+      }
+   } else if (im->out.cb.func) {
+      /* in pieces of the chunk size, as the encoder would hand them over: */
+      for ((left = len); (left > 0); ) {
+         size_t n;
+
+         n = MIN(left, (size_t)im->out.cb.chunk);
+         if (im->out.cb.func(im->out.cb.data, data, (int)n) != 0) {
+            return 1;
+         }
+         data += n;
+         left -= n;
+      }
+   } else if (fwrite(data, len, (size_t)1, im->out.f) != 1) {
       return 1;
    }
+   /* only what actually went out counts towards the stats: */
+   im->out.stats.size += (int)len;
+   return 0;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_passthrough(Epeg_Image *im)
+{
+   unsigned char *src, *head_data;
+   size_t src_len, have, sos, pos, head_len;
+   void *head_buf;
+   int fd, ret, done;
+
+   src = NULL;
+   src_len = 0;
+   sos = 0;
+   fd = -1;
+   if (im->in.file) {
+      /* only the markers up to the scan are needed in memory: */
+      fd = fileno(im->in.f);
+      src_len = (size_t)im->stat_info.st_size;
+      have = 0;
+      for (;;) {
+         unsigned char *tmp;
+         ssize_t n;
+
+         if (have >= src_len) {
+            free(src);
+            return -1;
+         }
+         tmp = realloc(src, (have + EPEG_DEST_BUFFER_SIZE));
+         if (!tmp) {
+            free(src);
+            return -1;
+         }
+         src = tmp;
+         n = pread(fd, (src + have), EPEG_DEST_BUFFER_SIZE, (off_t)have);
+         if (n <= 0) {
+            free(src);
+            return -1;
+         }
+         have += (size_t)n;
+         done = _epeg_passthrough_scan(src, have, &sos);
+         if (done < 0) {
+            free(src);
+            return -1;
+         }
+         if (done == 0) {
+            break;
+         }
+      }
+   } else {
+      src = im->in.mem.data;
+      src_len = (size_t)im->in.mem.size;
+      if (_epeg_passthrough_scan(src, src_len, &sos) != 0) {
+         return -1;
+      }
+   }
+
+   /* the new header: the source markers with the application markers
+    * trimmed down to the ones a re-encode would write, and the comment and
+    * thumbnail markers replaced by its own: */
+   im->out.stats.size = 0;
+   im->out.stats.markers_saved = 0;
+   head_buf = NULL;
+   head_len = 0;
+   im->out.head = _epeg_memfile_write_open(&head_buf, &head_len);
+   if (!im->out.head) {
+      if (im->in.file) {
+         free(src);
+      }
+      return -1;
+   }
+   fwrite(src, (size_t)2, (size_t)1, im->out.head);
+   done = 0;
+   for ((pos = 2); (pos < sos); ) {
+      size_t seg;
+      int marker;
+
+      marker = src[pos + 1];
+      if (marker == 0xff) {
+         pos++;
+         continue;
+      }
+      seg = (2 + (size_t)((src[pos + 2] << 8) | src[pos + 3]));
+      if ((!done) && ((marker < JPEG_APP0) || (marker > (JPEG_APP0 + 15)))) {
+         _epeg_encode_markers_write(im);
+         done = 1;
+      }
+      if ((marker == JPEG_COM) ||
+          ((marker > JPEG_APP0) && (marker <= (JPEG_APP0 + 15)) &&
+           ((marker != (JPEG_APP0 + 14)) || (seg < 9) ||
+            (memcmp((src + pos + 4), "Adobe", (size_t)5))))) {
+         /* Exif, ICC profiles and the like are not re-encoded either,
+          * only the Adobe marker that says how to read the scans is: */
+      } else if ((marker == JPEG_APP0) &&
+                 ((!(im->out.markers & EPEG_MARKER_JFIF)) || (seg < 9) ||
+                  (memcmp((src + pos + 4), "JFIF", (size_t)5)))) {
+         if ((seg >= 9) && (!memcmp((src + pos + 4), "JFIF", (size_t)5))) {
+            im->out.stats.markers_saved += (int)seg;
+         }
+      } else {
+         fwrite((src + pos), seg, (size_t)1, im->out.head);
+      }
+      pos += seg;
+   }
+   if (!done) {
+      _epeg_encode_markers_write(im);
+   }
+   _epeg_memfile_write_close(im->out.head);
+   im->out.head = NULL;
+   head_data = (unsigned char *)head_buf;
+
+   ret = -1;
+   if ((head_data) && ((ret = _epeg_encode_output_open(im)) == 0)) {
+      ret = _epeg_passthrough_write(im, head_data, head_len);
+      if ((ret == 0) && (im->in.file) && (im->out.file)) {
+         ret = _epeg_fd_copy(im->out.fd, fd, (off_t)sos, (src_len - sos));
+         if (ret == 0) {
+            im->out.stats.size += (int)(src_len - sos);
+         }
+      } else if ((ret == 0) && (im->in.file)) {
+         /* reuse the header buffer to copy through to memory: */
+         for ((pos = sos); ((ret == 0) && (pos < src_len)); ) {
+            ssize_t n;
+
+            n = pread(fd, src, MIN((src_len - pos), EPEG_DEST_BUFFER_SIZE),
+                      (off_t)pos);
+            if (n <= 0) {
+               ret = 1;
+               break;
+            }
+            ret = _epeg_passthrough_write(im, src, (size_t)n);
+            pos += (size_t)n;
+         }
+      } else if (ret == 0) {
+         ret = _epeg_passthrough_write(im, (src + sos), (src_len - sos));
+      }
+      if (ret == 0) {
+         ret = _epeg_encode_output_close(im);
+      } else {
+         _epeg_encode_abort(im);
+         im->error = 1;
+      }
+   }
 
-   jpeg_start_decompress(&(im->in.jinfo));
-
-   for ((y = 0U); (y < im->in.jinfo.output_height); y++) {
-	   im->lines[y] = (im->pixels +
-                      ((y * im->in.jinfo.output_components) * im->in.jinfo.output_width));
+   if (head_data) {
+      free(head_data);
    }
-
-   while (im->in.jinfo.output_scanline < im->in.jinfo.output_height) {
-	   jpeg_read_scanlines(&(im->in.jinfo),
-                          &(im->lines[im->in.jinfo.output_scanline]),
-                          (JDIMENSION)im->in.jinfo.rec_outbuf_height);
+   if (im->in.file) {
+      free(src);
    }
-
-   jpeg_finish_decompress(&(im->in.jinfo));
-
-   return 0;
+   return ret;
 }
 
 /* static internal private-only function; unnecessary to document: */
-static int _epeg_scale(Epeg_Image *im)
+static unsigned char *_epeg_pixels_planar_get(Epeg_Image *im, int x, int y,
+                                              int w, int h, int x0, int y0,
+                                              int x1, int y1)
 {
-   unsigned char *dst, *row, *src;
-   int            x, y, w, h, i;
+   const unsigned char *s, *t;
+   unsigned char *pix, *u, *v;
+   int cw, ch, bpp, step, xx, yy, sx, sy, sx2, sy2;
 
-   if ((im->in.w == im->out.w) && (im->in.h == im->out.h)) {
-      return 1;
+   if (im->color_space == EPEG_YUV444P) {
+      cw = w;
+      ch = h;
+   } else {
+      cw = ((w + 1) / 2);
+      ch = ((h + 1) / 2);
    }
-   if (im->scaled) {
-      return 1;
+   pix = (unsigned char *)malloc(((size_t)w * (size_t)h) +
+                                 (2 * (size_t)cw * (size_t)ch));
+   if (!pix) {
+      return NULL;
+   }
+   u = (pix + ((size_t)w * (size_t)h));
+   if (im->color_space == EPEG_NV12) {
+      v = (u + 1);
+      step = 2;
+   } else {
+      v = (u + ((size_t)cw * (size_t)ch));
+      step = 1;
    }
 
-   im->scaled = 1;
-   w = im->out.w;
-   h = im->out.h;
-   for ((y = 0); (y < h); y++) {
-      row = (im->pixels +
-             ((((unsigned int)y * im->in.jinfo.output_height) / (unsigned int)h) * (unsigned int)im->in.jinfo.output_components * im->in.jinfo.output_width));
-      dst = (im->pixels +
-             ((unsigned int)(y * im->in.jinfo.output_components) * im->in.jinfo.output_width));
-
-      for ((x = 0); (x < im->out.w); x++) {
-         src = (row +
-                ((((unsigned int)x * im->in.jinfo.output_width) / (unsigned int)w) * (unsigned int)im->in.jinfo.output_components));
-
-         for ((i = 0); (i < im->in.jinfo.output_components); i++) {
-            dst[i] = src[i];
-         } /* end inmost for-loop */
+   /* [x0, x1) by [y0, y1) is the part of the rectangle inside the image;
+    * samples outside of it repeat its edge: */
+   bpp = ((im->in.raw.on) ? 1 : im->in.jinfo.output_components);
+   for ((yy = 0); (yy < h); yy++) {
+      sy = MIN(MAX((y + yy), y0), (y1 - 1));
+      s = ((im->in.raw.on) ?
+           (im->in.raw.plane[0] + ((size_t)sy * (size_t)im->in.raw.stride[0])) :
+           im->lines[sy]);
+      for ((xx = 0); (xx < w); xx++) {
+         sx = MIN(MAX((x + xx), x0), (x1 - 1));
+         pix[(yy * w) + xx] = s[sx * bpp];
+      }
+   }
 
-         dst += im->in.jinfo.output_components;
-      } /* end inner for-loop */
-   } /* end outer for-loop */
-   return 0;
+   if ((im->in.raw.on) && (im->in.raw.full)) {
+      /* chroma that was decoded at the full size is averaged down over
+       * each 2x2 block: */
+      for ((yy = 0); (yy < ch); yy++) {
+         size_t a, b;
+
+         sy = MIN(MAX((y + (2 * yy)), y0), (y1 - 1));
+         sy2 = MIN(MAX((y + (2 * yy) + 1), y0), (y1 - 1));
+         a = ((size_t)sy * (size_t)im->in.raw.stride[1]);
+         b = ((size_t)sy2 * (size_t)im->in.raw.stride[1]);
+         s = im->in.raw.plane[1];
+         t = im->in.raw.plane[2];
+         for ((xx = 0); (xx < cw); xx++) {
+            sx = MIN(MAX((x + (2 * xx)), x0), (x1 - 1));
+            sx2 = MIN(MAX((x + (2 * xx) + 1), x0), (x1 - 1));
+            u[((yy * cw) + xx) * step] =
+               (unsigned char)((s[a + sx] + s[a + sx2] + s[b + sx] +
+                                s[b + sx2] + 2) >> 2);
+            v[((yy * cw) + xx) * step] =
+               (unsigned char)((t[a + sx] + t[a + sx2] + t[b + sx] +
+                                t[b + sx2] + 2) >> 2);
+         }
+      }
+   } else if (bpp == 1) {
+      if (im->in.raw.on) {
+         /* the chroma planes as decoded, at half size already: */
+         for ((yy = 0); (yy < ch); yy++) {
+            sy = (MIN(MAX((y + (2 * yy)), y0), (y1 - 1)) / 2);
+            s = (im->in.raw.plane[1] +
+                 ((size_t)sy * (size_t)im->in.raw.stride[1]));
+            t = (im->in.raw.plane[2] +
+                 ((size_t)sy * (size_t)im->in.raw.stride[2]));
+            for ((xx = 0); (xx < cw); xx++) {
+               sx = (MIN(MAX((x + (2 * xx)), x0), (x1 - 1)) / 2);
+               u[((yy * cw) + xx) * step] = s[sx];
+               v[((yy * cw) + xx) * step] = t[sx];
+            }
+         }
+      } else {
+         /* a greyscale image has no colour to give: */
+         memset(u, 0x80, (2 * (size_t)cw * (size_t)ch));
+      }
+   } else if (im->color_space == EPEG_YUV444P) {
+      for ((yy = 0); (yy < h); yy++) {
+         sy = MIN(MAX((y + yy), y0), (y1 - 1));
+         s = im->lines[sy];
+         for ((xx = 0); (xx < w); xx++) {
+            sx = MIN(MAX((x + xx), x0), (x1 - 1));
+            u[(yy * w) + xx] = s[(sx * bpp) + 1];
+            v[(yy * w) + xx] = s[(sx * bpp) + 2];
+         }
+      }
+   } else {
+      /* chroma that libjpeg upsampled, or never had subsampled, is
+       * averaged back down over each 2x2 block: */
+      for ((yy = 0); (yy < ch); yy++) {
+         sy = MIN(MAX((y + (2 * yy)), y0), (y1 - 1));
+         sy2 = MIN(MAX((y + (2 * yy) + 1), y0), (y1 - 1));
+         s = im->lines[sy];
+         t = im->lines[sy2];
+         for ((xx = 0); (xx < cw); xx++) {
+            sx = (bpp * MIN(MAX((x + (2 * xx)), x0), (x1 - 1)));
+            sx2 = (bpp * MIN(MAX((x + (2 * xx) + 1), x0), (x1 - 1)));
+            u[((yy * cw) + xx) * step] =
+               (unsigned char)((s[sx + 1] + s[sx2 + 1] + t[sx + 1] +
+                                t[sx2 + 1] + 2) >> 2);
+            v[((yy * cw) + xx) * step] =
+               (unsigned char)((s[sx + 2] + s[sx2 + 2] + t[sx + 2] +
+                                t[sx2 + 2] + 2) >> 2);
+         }
+      }
+   }
+   return pix;
 }
 
 /* static internal private-only function; unnecessary to document: */
-static int _epeg_decode_for_trim(Epeg_Image *im)
+static const unsigned char *_epeg_rows_pack(Epeg_Image *im,
+                                            const unsigned char *s, int bpp,
+                                            unsigned char *p, int w, int y)
 {
-   JDIMENSION y;
-
-   if (im->pixels) {
-      return 1;
-   }
-
-   im->in.jinfo.scale_num = 1;
-   im->in.jinfo.scale_denom = 1;
-   im->in.jinfo.do_fancy_upsampling = FALSE;
-   im->in.jinfo.do_block_smoothing = FALSE;
-   im->in.jinfo.dct_method = JDCT_ISLOW;
+   unsigned int *q;
+   int x;
 
    switch (im->color_space) {
       case EPEG_GRAY8:
-		   im->in.jinfo.out_color_space = JCS_GRAYSCALE;
-		   im->in.jinfo.output_components = 1;
-		   break;
+			 if (bpp == 1) {
+				 return s;
+			 }
+			 for ((x = 0); (x < w); x++) {
+				 p[x] = s[x * bpp];
+			 }
+			 break;
 
       case EPEG_YUV8:
-		   im->in.jinfo.out_color_space = JCS_YCbCr;
-		   break;
-
       case EPEG_RGB8:
+			 if (bpp == 3) {
+				 return s;
+			 }
+			 for ((x = 0); (x < w); x++) {
+				 p[(x * 3)] = s[(x * bpp)];
+				 p[(x * 3) + 1] = s[(x * bpp) + 1];
+				 p[(x * 3) + 2] = s[(x * bpp) + 2];
+			 }
+			 break;
+
       case EPEG_BGR8:
+			 for ((x = 0); (x < w); x++) {
+				 p[(x * 3)] = s[(x * bpp) + 2];
+				 p[(x * 3) + 1] = s[(x * bpp) + 1];
+				 p[(x * 3) + 2] = s[(x * bpp)];
+			 }
+			 break;
+
       case EPEG_RGBA8:
+      case EPEG_RGBX8:
+			 if ((bpp == 4) && (im->color_space == EPEG_RGBX8)) {
+				 /* libjpeg filled in the 0xff already: */
+				 return s;
+			 }
+			 for ((x = 0); (x < w); x++) {
+				 p[(x * 4)] = s[(x * bpp)];
+				 p[(x * 4) + 1] = s[(x * bpp) + 1];
+				 p[(x * 4) + 2] = s[(x * bpp) + 2];
+				 p[(x * 4) + 3] = 0xff;
+			 }
+			 break;
+
       case EPEG_BGRA8:
+			 for ((x = 0); (x < w); x++) {
+				 p[(x * 4)] = 0xff;
+				 p[(x * 4) + 1] = s[(x * bpp) + 2];
+				 p[(x * 4) + 2] = s[(x * bpp) + 1];
+				 p[(x * 4) + 3] = s[(x * bpp)];
+			 }
+			 break;
+
       case EPEG_ARGB32:
-		   im->in.jinfo.out_color_space = JCS_RGB;
-		   break;
+			 q = (unsigned int *)p;
+			 for ((x = 0); (x < w); x++) {
+				 q[x] = (0xff000000 | (unsigned int)(s[(x * bpp)] << 16) |
+				         (unsigned int)(s[(x * bpp) + 1] << 8) |
+				         s[(x * bpp) + 2]);
+			 }
+			 break;
 
       case EPEG_CMYK:
-		   im->in.jinfo.out_color_space = JCS_CMYK;
-		   im->in.jinfo.output_components = 4;
-		   break;
+			 return s;
+
+      case EPEG_RGB565:
+			 if (bpp == 2) {
+				 /* libjpeg packed them already: */
+				 return s;
+			 }
+			 _epeg_rgb565_row_pack(s, p, w, bpp, 0, y, im->in.dither);
+			 break;
 
       default:
-		   break;
-   }
-
-   im->out.jinfo.err = jpeg_std_error(&(im->jerr.pub));
-   im->jerr.pub.error_exit = _epeg_fatal_error_handler;
-
-   if (setjmp(im->jerr.setjmp_buffer)) {
-      return 1;
-   }
-
-   jpeg_calc_output_dimensions(&(im->in.jinfo));
-
-   im->pixels = (unsigned char *)malloc((size_t)(im->in.jinfo.output_width * im->in.jinfo.output_height * (unsigned int)im->in.jinfo.output_components));
-   if (!im->pixels) {
-      return 1;
-   }
-
-   im->lines = (unsigned char **)malloc(im->in.jinfo.output_height * sizeof(char *));
-   if (!im->lines) {
-      free(im->pixels);
-      im->pixels = NULL;
-      return 1;
-   }
-
-   jpeg_start_decompress(&(im->in.jinfo));
-
-   for ((y = 0U); (y < im->in.jinfo.output_height); y++) {
-      im->lines[y] = (im->pixels +
-                      ((y * im->in.jinfo.output_components) * im->in.jinfo.output_width));
-   }
-
-   while (im->in.jinfo.output_scanline < im->in.jinfo.output_height) {
-      jpeg_read_scanlines(&(im->in.jinfo),
-                          &(im->lines[im->in.jinfo.output_scanline]),
-                          (JDIMENSION)im->in.jinfo.rec_outbuf_height);
+			 break;
    }
-
-   jpeg_finish_decompress(&(im->in.jinfo));
-
-   return 0;
+   return p;
 }
 
 /* static internal private-only function; unnecessary to document: */
-static int _epeg_trim(Epeg_Image *im)
+static int _epeg_placeholder_row(Epeg_Image *im, const unsigned char *src,
+                                 unsigned char *dst, int w)
 {
-   int y, a, b, w, h;
+   int x, bpp;
+
+   bpp = _epeg_pixel_size(im);
+   switch (im->in.jinfo.out_color_space) {
+      case JCS_GRAYSCALE:
+			 for ((x = 0); (x < w); x++) {
+				 dst[(x * 3)] = src[x];
+				 dst[(x * 3) + 1] = src[x];
+				 dst[(x * 3) + 2] = src[x];
+			 }
+			 return 0;
+
+      case JCS_YCbCr:
+			 for ((x = 0); (x < w); x++) {
+				 int l, cb, cr, v[3], c;
+
+				 /* JFIF's full range conversion, in 16 bit fixed point: */
+				 l = src[(x * 3)];
+				 cb = (src[(x * 3) + 1] - 128);
+				 cr = (src[(x * 3) + 2] - 128);
+				 v[0] = (l + (((91881 * cr) + 32768) >> 16));
+				 v[1] = (l - (((22554 * cb) + (46802 * cr) + 32768) >> 16));
+				 v[2] = (l + (((116130 * cb) + 32768) >> 16));
+				 for ((c = 0); (c < 3); c++) {
+					 dst[(x * 3) + c] = (unsigned char)MIN(MAX(v[c], 0), 255);
+				 }
+			 }
+			 return 0;
+
+      case JCS_CMYK:
+			 /* what is left as CMYK is only ever so for EPEG_CMYK: */
+			 _epeg_cmyk_row_convert(src, dst, w, im->in.cmyk_inverted);
+			 return 0;
+
+      case JCS_YCCK:
+			 return 1;
 
-   if ((im->in.w == im->out.w) && (im->in.h == im->out.h)) {
-      return 1;
-   }
-   if (im->scaled) {
-      return 1;
+      default:
+			 break;
    }
-
-   im->scaled = 1;
-   w = im->out.w;
-   h = im->out.h;
-   a = im->out.x;
-   b = im->out.y;
-
-   /* dummy condition to use value stored to 'w': */
-   if (w == 0) {
-	   ;
+   if (bpp == 2) {
+      _epeg_pixels_row_convert(src, dst, w, EPEG_RGB565);
+      return 0;
    }
-
-   for ((y = 0); (y < h); y++) {
-	   im->lines[y] = (im->pixels +
-                      ((unsigned int)((y + b) * im->in.jinfo.output_components) * im->in.jinfo.output_width)
-                      + (a * im->in.jinfo.output_components));
+   /* RGB, and RGBA for EPEG_RGBX8: */
+   for ((x = 0); (x < w); x++) {
+      dst[(x * 3)] = src[(x * bpp)];
+      dst[(x * 3) + 1] = src[(x * bpp) + 1];
+      dst[(x * 3) + 2] = src[(x * bpp) + 2];
    }
-
    return 0;
 }
 
 /* static internal private-only function; unnecessary to document: */
-static int _epeg_encode(Epeg_Image *im)
+static void _epeg_blurhash(const unsigned char *rgb, int w, int h,
+                           char *hash)
 {
-   void  *data = NULL;
-   size_t size = 0;
-
-   if (im->out.f) {
-      return 1;
+   static const char digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                "abcdefghijklmnopqrstuvwxyz#$%*+,-.:;=?@[]^_{|}~";
+   double linear[256], factors[4 * 4][3], max, v, scale;
+   int nx, ny, i, j, x, y, c, n, q, value, len;
+
+   /* the layout of https://github.com/woltapp/blurhash, whose decoders work
+    * out the number of components from the hash itself: */
+   nx = ((w >= h) ? 4 : 3);
+   ny = ((w >= h) ? 3 : 4);
+   for ((i = 0); (i < 256); i++) {
+      v = ((double)i / 255.0);
+      linear[i] = ((v <= 0.04045) ? (v / 12.92) :
+                   pow(((v + 0.055) / 1.055), 2.4));
+   }
+   for ((j = 0); (j < ny); j++) {
+      for ((i = 0); (i < nx); i++) {
+         double *f;
+
+         f = factors[(j * nx) + i];
+         f[0] = f[1] = f[2] = 0.0;
+         for ((y = 0); (y < h); y++) {
+            for ((x = 0); (x < w); x++) {
+               const unsigned char *p;
+               double basis;
+
+               p = (rgb + (((y * w) + x) * 3));
+               basis = (cos((M_PI * i * x) / w) * cos((M_PI * j * y) / h));
+               for ((c = 0); (c < 3); c++) {
+                  f[c] += (basis * linear[p[c]]);
+               }
+            }
+         }
+         scale = ((((i == 0) && (j == 0)) ? 1.0 : 2.0) / (double)(w * h));
+         for ((c = 0); (c < 3); c++) {
+            f[c] *= scale;
+         }
+      }
    }
 
-   if (im->out.file) {
-      im->out.f = fopen(im->out.file, "wb");
-   } else {
-      im->out.f = _epeg_memfile_write_open(&data, &size);
+   n = (nx * ny);
+   max = 0.0;
+   for ((i = 1); (i < n); i++) {
+      for ((c = 0); (c < 3); c++) {
+         max = MAX(max, fabs(factors[i][c]));
+      }
    }
-   if (!im->out.f) {
-      im->error = 1;
-      return 1;
+   q = (int)MIN(MAX(floor((max * 166.0) - 0.5), 0.0), 82.0);
+   max = ((q + 1) / 166.0);
+
+   len = 0;
+   hash[len++] = digits[(nx - 1) + ((ny - 1) * 9)];
+   hash[len++] = digits[q];
+   value = 0;
+   for ((c = 0); (c < 3); c++) {
+      v = MIN(MAX(factors[0][c], 0.0), 1.0);
+      v = ((v <= 0.0031308) ? (v * 12.92) :
+           ((1.055 * pow(v, (1.0 / 2.4))) - 0.055));
+      value = ((value << 8) | (int)((v * 255.0) + 0.5));
    }
-
-   im->out.jinfo.err = jpeg_std_error(&(im->jerr.pub));
-   im->jerr.pub.error_exit = _epeg_fatal_error_handler;
-
-   if (setjmp(im->jerr.setjmp_buffer)) {
-      return 1;
+   for ((i = 3); (i >= 0); i--) {
+      hash[len + i] = digits[value % 83];
+      value /= 83;
    }
-
-   jpeg_create_compress(&(im->out.jinfo));
-   jpeg_stdio_dest(&(im->out.jinfo), im->out.f);
-   im->out.jinfo.image_width = (JDIMENSION)im->out.w;
-   im->out.jinfo.image_height = (JDIMENSION)im->out.h;
-   im->out.jinfo.input_components = im->in.jinfo.output_components;
-   im->out.jinfo.in_color_space = im->in.jinfo.out_color_space;
-   im->out.jinfo.dct_method = JDCT_IFAST;
-   im->out.jinfo.dct_method = im->in.jinfo.dct_method;
-   jpeg_set_defaults(&(im->out.jinfo));
-   jpeg_set_quality(&(im->out.jinfo), im->out.quality, TRUE);
-
-   if (im->out.quality >= 90) {
-      im->out.jinfo.comp_info[0].h_samp_factor = 1;
-      im->out.jinfo.comp_info[0].v_samp_factor = 1;
-      im->out.jinfo.comp_info[1].h_samp_factor = 1;
-      im->out.jinfo.comp_info[1].v_samp_factor = 1;
-      im->out.jinfo.comp_info[2].h_samp_factor = 1;
-      im->out.jinfo.comp_info[2].v_samp_factor = 1;
+   len += 4;
+   for ((i = 1); (i < n); i++) {
+      value = 0;
+      for ((c = 0); (c < 3); c++) {
+         v = (factors[i][c] / max);
+         v = (((v < 0.0) ? -sqrt(-v) : sqrt(v)) * 9.0);
+         value = ((value * 19) + (int)MIN(MAX(floor(v + 9.5), 0.0), 18.0));
+      }
+      hash[len++] = digits[value / 83];
+      hash[len++] = digits[value % 83];
    }
-   jpeg_start_compress(&(im->out.jinfo), TRUE);
+   hash[len] = '\0';
+}
 
-   if (im->out.comment) {
-      jpeg_write_marker(&(im->out.jinfo), JPEG_COM,
-                        (const JOCTET *)im->out.comment,
-                        (unsigned int)strlen(im->out.comment));
-   }
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_pixels_row_convert(const unsigned char *src,
+                                     unsigned char *dst, int w,
+                                     Epeg_Colorspace format)
+{
+   int x;
 
-   if (im->out.thumbnail_info) {
-      char buf[8192];
+   /* the inverse of the packing done by epeg_pixels_get(): */
+   switch (format) {
+      case EPEG_BGR8:
+         for ((x = 0); (x < w); x++) {
+            dst[0] = src[2];
+            dst[1] = src[1];
+            dst[2] = src[0];
+            dst += 3;
+            src += 3;
+         }
+         break;
 
-      if (im->in.file) {
-         snprintf(buf, sizeof(buf), "Thumb::URI\nfile://%s", im->in.file);
-         jpeg_write_marker(&(im->out.jinfo), (JPEG_APP0 + 7),
-                           (const JOCTET *)buf, (unsigned int)strlen(buf));
-         snprintf(buf, sizeof(buf), "Thumb::MTime\n%llu",
-#if defined(HAVE_UINTMAX_T) && !defined(__LP64__)
-                  (uintmax_t)im->stat_info.st_mtime);
-#else
-               (unsigned long long int)im->stat_info.st_mtime);
-#endif /* HAVE_UINTMAX_T && !__LP64__ */
-      }
-      jpeg_write_marker(&(im->out.jinfo), (JPEG_APP0 + 7), (const JOCTET *)buf,
-                        (unsigned int)strlen(buf));
-      snprintf(buf, sizeof(buf), "Thumb::Image::Width\n%i", im->in.w);
-      jpeg_write_marker(&(im->out.jinfo), (JPEG_APP0 + 7), (const JOCTET *)buf,
-                        (unsigned int)strlen(buf));
-      snprintf(buf, sizeof(buf), "Thumb::Image::Height\n%i", im->in.h);
-      jpeg_write_marker(&(im->out.jinfo), (JPEG_APP0 + 7), (const JOCTET *)buf,
-                        (unsigned int)strlen(buf));
-      snprintf(buf, sizeof(buf), "Thumb::Mimetype\nimage/jpeg");
-      jpeg_write_marker(&(im->out.jinfo), (JPEG_APP0 + 7), (const JOCTET *)buf,
-                        (unsigned int)strlen(buf));
-   }
+      case EPEG_RGBA8:
+         for ((x = 0); (x < w); x++) {
+            dst[0] = src[0];
+            dst[1] = src[1];
+            dst[2] = src[2];
+            dst += 3;
+            src += 4;
+         }
+         break;
 
-   while (im->out.jinfo.next_scanline < im->out.h) {
-      jpeg_write_scanlines(&(im->out.jinfo),
-                           &(im->lines[im->out.jinfo.next_scanline]), 1);
-   }
+      case EPEG_BGRA8:
+         for ((x = 0); (x < w); x++) {
+            dst[0] = src[3];
+            dst[1] = src[2];
+            dst[2] = src[1];
+            dst += 3;
+            src += 4;
+         }
+         break;
 
-   jpeg_finish_compress(&(im->out.jinfo));
+      case EPEG_ARGB32:
+         for ((x = 0); (x < w); x++) {
+            unsigned int v;
+
+            memcpy(&v, src, sizeof(v));
+            dst[0] = (unsigned char)((v >> 16) & 0xff);
+            dst[1] = (unsigned char)((v >> 8) & 0xff);
+            dst[2] = (unsigned char)(v & 0xff);
+            dst += 3;
+            src += 4;
+         }
+         break;
+
+      case EPEG_RGB565:
+         for ((x = 0); (x < w); x++) {
+            unsigned short v;
+            unsigned int c;
+
+            /* the top bits of each channel repeat into the bottom ones,
+             * so that full scale stays full scale: */
+            memcpy(&v, src, sizeof(v));
+            c = ((v >> 11) & 0x1fU);
+            dst[0] = (unsigned char)((c << 3) | (c >> 2));
+            c = ((v >> 5) & 0x3fU);
+            dst[1] = (unsigned char)((c << 2) | (c >> 4));
+            c = (v & 0x1fU);
+            dst[2] = (unsigned char)((c << 3) | (c >> 2));
+            dst += 3;
+            src += 2;
+         }
+         break;
+
+      case EPEG_RGBX8:
+         for ((x = 0); (x < w); x++) {
+            dst[0] = src[0];
+            dst[1] = src[1];
+            dst[2] = src[2];
+            dst += 3;
+            src += 4;
+         }
+         break;
 
-   if (im->in.f) {
-      jpeg_destroy_decompress(&(im->in.jinfo));
-   }
-   if ((im->in.f) && (im->in.file)) {
-      fclose(im->in.f);
-   }
-   if ((im->in.f) && (!im->in.file)) {
-      _epeg_memfile_read_close(im->in.f);
-   }
-   if (im->out.f) {
-      jpeg_destroy_compress(&(im->out.jinfo));
-   }
-   if ((im->out.f) && (im->out.file)) {
-      fclose(im->out.f);
-   }
-   if ((im->out.f) && (!im->out.file)) {
-      _epeg_memfile_write_close(im->out.f);
+      default:
+         memcpy(dst, src, (size_t)w * 3);
+         break;
    }
-   im->in.f = NULL;
-   im->out.f = NULL;
+}
 
-   if (im->out.mem.data) {
-	   *(im->out.mem.data) = (unsigned char *)data;
-   }
-   if (im->out.mem.size) {
-	   *(im->out.mem.size) = (int)size;
+/* static internal private-only function; unnecessary to document: */
+static int _epeg_pixel_size(Epeg_Image *im)
+{
+#ifdef EPEG_HAVE_JCS_RGB565
+   if (im->in.jinfo.out_color_space == JCS_RGB565) {
+      return 2;
    }
+#endif /* EPEG_HAVE_JCS_RGB565 */
+   return im->in.jinfo.output_components;
+}
 
-   return 0;
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_rgb565_row_pack(const unsigned char *src,
+                                  unsigned char *dst, int w, int bpp, int x,
+                                  int y, int dither)
+{
+   static const unsigned char bayer[4][4] = {
+      {  0,  8,  2, 10 },
+      { 12,  4, 14,  6 },
+      {  3, 11,  1,  9 },
+      { 15,  7, 13,  5 }
+   };
+   unsigned int r, g, b, d;
+   unsigned short v;
+   int i;
+
+   /* for libjpeg builds that cannot do it themselves, and for the RGB that
+    * _epeg_decode_cmyk() makes; the dither goes by the position in the
+    * image, so that neighbouring blocks line up: */
+   for ((i = 0); (i < w); i++) {
+      d = ((dither) ? bayer[y & 3][(x + i) & 3] : 0U);
+      r = MIN(255U, (src[0] + (d >> 1)));
+      g = MIN(255U, (src[1] + (d >> 2)));
+      b = MIN(255U, (src[2] + (d >> 1)));
+      v = (unsigned short)(((r & 0xf8U) << 8) | ((g & 0xfcU) << 3) | (b >> 3));
+      memcpy(dst, &v, sizeof(v));
+      dst += 2;
+      src += bpp;
+   }
 }
 
 /* static internal private-only function; unnecessary to document: */
@@ -1359,10 +5455,64 @@ static void _epeg_fatal_error_handler(j_common_ptr cinfo)
    return;
 }
 
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_warning_handler(j_common_ptr cinfo, int msg_level)
+{
+   emptr errmgr;
+
+   errmgr = (emptr)cinfo->err;
+   if (msg_level >= 0) {
+      if (errmgr->pub.trace_level >= msg_level) {
+         (*errmgr->pub.output_message)(cinfo);
+      }
+      return;
+   }
+
+   /* a corrupt-data warning; shown and counted as libjpeg itself does: */
+   if ((errmgr->pub.num_warnings == 0) || (errmgr->pub.trace_level >= 3)) {
+      (*errmgr->pub.output_message)(cinfo);
+   }
+   errmgr->pub.num_warnings++;
+   if ((errmgr->watch) && (errmgr->warning_row < 0) &&
+       (cinfo->is_decompressor)) {
+      errmgr->warning_row =
+         (long)((j_decompress_ptr)cinfo)->output_scanline;
+   }
+   /* a marker in the middle of the scan ends it just as the end of the
+    * data does, unless it is a restart marker that it can resync at: */
+   if ((errmgr->pub.msg_code == JWRN_JPEG_EOF) ||
+       ((errmgr->pub.msg_code == JWRN_HIT_MARKER) &&
+        (cinfo->is_decompressor) &&
+        ((((j_decompress_ptr)cinfo)->unread_marker < (int)JPEG_RST0) ||
+         (((j_decompress_ptr)cinfo)->unread_marker > (int)JPEG_RST0 + 7)))) {
+      errmgr->truncated = 1;
+   }
+   if ((errmgr->warnings_max > 0) &&
+       (errmgr->pub.num_warnings > errmgr->warnings_max)) {
+      errmgr->exceeded = 1;
+      longjmp(errmgr->setjmp_buffer, 1);
+   }
+}
+
 /* silence '-Wunused-macros' warnings: */
 #ifdef MAX
 # undef MAX
 #endif /* MAX */
+#ifdef DIV255
+# undef DIV255
+#endif /* DIV255 */
+#ifdef EPEG_DCT_SCALED_W
+# undef EPEG_DCT_SCALED_W
+#endif /* EPEG_DCT_SCALED_W */
+#ifdef EPEG_DCT_SCALED_H
+# undef EPEG_DCT_SCALED_H
+#endif /* EPEG_DCT_SCALED_H */
+#ifdef EPEG_HAVE_CROP_SCANLINE
+# undef EPEG_HAVE_CROP_SCANLINE
+#endif /* EPEG_HAVE_CROP_SCANLINE */
+#ifdef EPEG_HAVE_JCS_RGB565
+# undef EPEG_HAVE_JCS_RGB565
+#endif /* EPEG_HAVE_JCS_RGB565 */
 
 /* various text editor settings:
  * # Emacs: -*-
@@ -34,6 +34,10 @@
 #endif /* HAVE_STDINT_H */
 
 /* if it starts with an underscore, it is private and goes in this file. */
+/* size and alignment of the buffer file output is written from: */
+#define EPEG_DEST_BUFFER_SIZE  65536
+#define EPEG_DEST_BUFFER_ALIGN 4096
+
 /* structures: */
 typedef struct _epeg_error_mgr *emptr;
 
@@ -41,6 +45,11 @@ struct _epeg_error_mgr
 {
 	struct jpeg_error_mgr pub;
 	jmp_buf setjmp_buffer;
+	long warnings_max;
+	long warning_row;
+	char watch : 1;
+	char truncated : 1;
+	char exceeded : 1;
 };
 
 struct _Epeg_Image
@@ -61,6 +70,53 @@ struct _Epeg_Image
 		int w, h;
 		char *comment;
 		FILE *f;
+		struct {
+			unsigned char *data;
+			int size;
+		} mem;
+		struct {
+			Epeg_Input_Cb func;
+			void *data;
+			int size;
+		} cb;
+		struct {
+			unsigned char *buf;
+			size_t alloc;
+			int stage;
+			char on : 1;
+		} feed;
+		struct {
+			int num;
+			int cache;
+			char on : 1;
+		} fd;
+		struct {
+			unsigned char *plane[3];
+			int stride[3];
+			int w[3], h[3];
+			char on : 1;
+			char full : 1;
+		} raw;
+		struct {
+			unsigned int *sum;
+			JSAMPROW *strip;
+			int k;
+			int w, h;
+			int rows;
+		} box;
+		struct {
+			int x, y, w, h;
+			int top, rows;
+			int out_w, out_h;
+			char on : 1;
+		} crop;
+		unsigned char *tables;
+		int tables_size;
+		char shared_tables : 1;
+		char tolerant : 1;
+		char cmyk_inverted : 1;
+		char dither : 1;
+		int rows_valid;
 		J_COLOR_SPACE color_space;
 		struct jpeg_decompress_struct jinfo;
 		struct {
@@ -79,22 +135,90 @@ struct _Epeg_Image
 		struct {
 			unsigned char **data;
 			int *size;
+			void *buf;
+			size_t len;
 		} mem;
+		struct {
+			Epeg_Output_Cb func;
+			void *data;
+			int chunk;
+		} cb;
 		int x, y;
 		int w, h;
 		char *comment;
 		FILE *f;
+		FILE *head;
+		int fd;
+		char *tmp;
+		Epeg_Sync *sync;
 		struct jpeg_compress_struct jinfo;
 		int quality;
 		char thumbnail_info : 1;
+		char optimize : 1;
+		char progressive : 1;
+		char abbreviated : 1;
+		char ready : 1;
+		char atomic : 1;
+		char passthrough : 1;
+		char mmap : 1;
+		Epeg_Dct_Method dct_method;
+		Epeg_Subsampling subsampling;
+		int batch;
+		int markers;
+		struct {
+			int size;
+			int markers_saved;
+		} stats;
 	} out;
 };
 
+struct _Epeg_Sync
+{
+	int files;
+	int msec;
+	struct {
+		char *tmp;
+		char *path;
+	} *pending;
+	int count, alloc;
+	long long start;
+	char failed : 1;
+};
+
+/* what a look at a small decode of the image has to put back afterwards: */
+struct _epeg_decode_settings
+{
+	Epeg_Colorspace color_space;
+	int x, y, w, h;
+	int crop_x, crop_y, crop_w, crop_h;
+	char crop_on : 1;
+};
+
 /* prototypes: */
 FILE *_epeg_memfile_read_open(void *data, size_t size);
 void _epeg_memfile_read_close(FILE *f);
 FILE *_epeg_memfile_write_open(void **data, size_t *size);
 void _epeg_memfile_write_close(FILE *f);
+void _epeg_fd_dest(j_compress_ptr cinfo, int fd);
+long _epeg_fd_dest_written(j_compress_ptr cinfo);
+void _epeg_mmap_dest(j_compress_ptr cinfo, int fd, size_t hint);
+void _epeg_fd_dest_release(j_compress_ptr cinfo);
+void _epeg_callback_dest(j_compress_ptr cinfo, Epeg_Output_Cb func,
+                         void *data, int chunk);
+void _epeg_callback_src(j_decompress_ptr cinfo, Epeg_Input_Cb func,
+                        void *data, int size);
+void _epeg_feed_src(j_decompress_ptr cinfo);
+Epeg_Check _epeg_fd_check(int fd, off_t start, off_t size, int eoi);
+void _epeg_fd_src(j_decompress_ptr cinfo, int fd, int cache);
+void _epeg_fd_src_release(j_decompress_ptr cinfo);
+int _epeg_fd_src_rewind(j_decompress_ptr cinfo);
+int _epeg_feed_src_append(j_decompress_ptr cinfo, unsigned char **buf,
+                          size_t *alloc, const unsigned char *data,
+                          size_t len);
+int _epeg_fd_write(int fd, const unsigned char *data, size_t len);
+int _epeg_fd_copy(int out, int in, off_t off, size_t len);
+int _epeg_atomic_open(const char *path, char **tmp);
+int _epeg_atomic_commit(Epeg_Sync *sync, char *tmp, const char *path);
 
 #endif /* !_EPEG_PRIVATE_H */
 
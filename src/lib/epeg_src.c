@@ -0,0 +1,453 @@
+/* epeg_src.c */
+/* gets built into the libepeg library */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE 1 /* need this for O_DIRECT */
+#endif /* !_GNU_SOURCE */
+#include <stdio.h>
+#include <errno.h>
+#include <jerror.h>
+#include "Epeg.h"
+#include "epeg_private.h"
+
+/* internal private-only struct and typedef; unnecessary to document: */
+typedef struct _epeg_callback_src_mgr epeg_callback_src_mgr;
+struct _epeg_callback_src_mgr
+{
+   struct jpeg_source_mgr pub;
+   Epeg_Input_Cb func;
+   void *data;
+   JOCTET *buffer;
+   size_t size;
+   boolean start_of_file;
+};
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_callback_init_source(j_decompress_ptr cinfo)
+{
+   epeg_callback_src_mgr *src;
+
+   src = (epeg_callback_src_mgr *)cinfo->src;
+   src->start_of_file = TRUE;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static boolean _epeg_callback_fill_input_buffer(j_decompress_ptr cinfo)
+{
+   epeg_callback_src_mgr *src;
+   int n;
+
+   src = (epeg_callback_src_mgr *)cinfo->src;
+   n = src->func(src->data, src->buffer, (int)src->size);
+   if (n < 0) {
+      ERREXIT(cinfo, JERR_FILE_READ);
+   }
+   if (n == 0) {
+      if (src->start_of_file) {
+         ERREXIT(cinfo, JERR_INPUT_EMPTY);
+      }
+      /* same as jpeg_stdio_src(): end a short stream with a fake EOI */
+      WARNMS(cinfo, JWRN_JPEG_EOF);
+      src->buffer[0] = (JOCTET)0xff;
+      src->buffer[1] = (JOCTET)JPEG_EOI;
+      n = 2;
+   }
+   src->pub.next_input_byte = src->buffer;
+   src->pub.bytes_in_buffer = (size_t)n;
+   src->start_of_file = FALSE;
+   return TRUE;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_callback_skip_input_data(j_decompress_ptr cinfo,
+                                           long num_bytes)
+{
+   struct jpeg_source_mgr *src;
+
+   src = cinfo->src;
+   if (num_bytes <= 0) {
+      return;
+   }
+   while (num_bytes > (long)src->bytes_in_buffer) {
+      num_bytes -= (long)src->bytes_in_buffer;
+      (void)(*src->fill_input_buffer)(cinfo);
+   }
+   src->next_input_byte += (size_t)num_bytes;
+   src->bytes_in_buffer -= (size_t)num_bytes;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_callback_term_source(j_decompress_ptr cinfo)
+{
+   (void)cinfo;
+}
+
+/* internal private-only function; unnecessary to document: */
+void _epeg_callback_src(j_decompress_ptr cinfo, Epeg_Input_Cb func,
+                        void *data, int size)
+{
+   epeg_callback_src_mgr *src;
+
+   src = (epeg_callback_src_mgr *)
+      (*cinfo->mem->alloc_small)((j_common_ptr)cinfo, JPOOL_PERMANENT,
+                                 sizeof(epeg_callback_src_mgr));
+   src->size = (size_t)size;
+   src->buffer = (JOCTET *)
+      (*cinfo->mem->alloc_large)((j_common_ptr)cinfo, JPOOL_PERMANENT,
+                                 src->size);
+   src->func = func;
+   src->data = data;
+   src->start_of_file = TRUE;
+   src->pub.init_source = _epeg_callback_init_source;
+   src->pub.fill_input_buffer = _epeg_callback_fill_input_buffer;
+   src->pub.skip_input_data = _epeg_callback_skip_input_data;
+   src->pub.resync_to_restart = jpeg_resync_to_restart;
+   src->pub.term_source = _epeg_callback_term_source;
+   /* empty, so that the first read pulls from the callback: */
+   src->pub.bytes_in_buffer = 0;
+   src->pub.next_input_byte = NULL;
+   cinfo->src = (struct jpeg_source_mgr *)src;
+}
+
+/* internal private-only struct and typedef; unnecessary to document: */
+typedef struct _epeg_feed_src_mgr epeg_feed_src_mgr;
+struct _epeg_feed_src_mgr
+{
+   struct jpeg_source_mgr pub;
+   size_t skip;
+};
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_feed_init_source(j_decompress_ptr cinfo)
+{
+   (void)cinfo;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static boolean _epeg_feed_fill_input_buffer(j_decompress_ptr cinfo)
+{
+   /* suspend: libjpeg backs up to where it can resume once there is more */
+   (void)cinfo;
+   return FALSE;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_feed_skip_input_data(j_decompress_ptr cinfo, long num_bytes)
+{
+   epeg_feed_src_mgr *src;
+
+   src = (epeg_feed_src_mgr *)cinfo->src;
+   if (num_bytes <= 0) {
+      return;
+   }
+   if ((size_t)num_bytes > src->pub.bytes_in_buffer) {
+      /* the rest gets dropped from data that is yet to come: */
+      src->skip += ((size_t)num_bytes - src->pub.bytes_in_buffer);
+      src->pub.next_input_byte += src->pub.bytes_in_buffer;
+      src->pub.bytes_in_buffer = 0;
+   } else {
+      src->pub.next_input_byte += (size_t)num_bytes;
+      src->pub.bytes_in_buffer -= (size_t)num_bytes;
+   }
+}
+
+/* internal private-only function; unnecessary to document: */
+void _epeg_feed_src(j_decompress_ptr cinfo)
+{
+   epeg_feed_src_mgr *src;
+
+   src = (epeg_feed_src_mgr *)
+      (*cinfo->mem->alloc_small)((j_common_ptr)cinfo, JPOOL_PERMANENT,
+                                 sizeof(epeg_feed_src_mgr));
+   src->skip = 0;
+   src->pub.init_source = _epeg_feed_init_source;
+   src->pub.fill_input_buffer = _epeg_feed_fill_input_buffer;
+   src->pub.skip_input_data = _epeg_feed_skip_input_data;
+   src->pub.resync_to_restart = jpeg_resync_to_restart;
+   src->pub.term_source = _epeg_feed_init_source;
+   src->pub.bytes_in_buffer = 0;
+   src->pub.next_input_byte = NULL;
+   cinfo->src = (struct jpeg_source_mgr *)src;
+}
+
+/* internal private-only function; unnecessary to document: */
+int _epeg_feed_src_append(j_decompress_ptr cinfo, unsigned char **buf,
+                          size_t *alloc, const unsigned char *data,
+                          size_t len)
+{
+   epeg_feed_src_mgr *src;
+   size_t keep, n;
+
+   src = (epeg_feed_src_mgr *)cinfo->src;
+   n = ((src->skip < len) ? src->skip : len);
+   src->skip -= n;
+   data += n;
+   len -= n;
+
+   /* what libjpeg has not used up yet has to stay in front of the new data,
+    * since it rereads from there after a suspension: */
+   keep = src->pub.bytes_in_buffer;
+   if ((keep > 0) && (src->pub.next_input_byte != *buf)) {
+      memmove(*buf, src->pub.next_input_byte, keep);
+   }
+   if ((keep + len) > *alloc) {
+      unsigned char *tmp;
+      size_t size;
+
+      size = ((*alloc > 0) ? (*alloc * 2) : 16384);
+      if (size < (keep + len)) {
+         size = (keep + len);
+      }
+      tmp = realloc(*buf, size);
+      if (!tmp) {
+         return 1;
+      }
+      *buf = tmp;
+      *alloc = size;
+   }
+   if (len > 0) {
+      memcpy((*buf + keep), data, len);
+   }
+   src->pub.next_input_byte = *buf;
+   src->pub.bytes_in_buffer = (keep + len);
+   return 0;
+}
+
+/* internal private-only struct and typedef; unnecessary to document: */
+typedef struct _epeg_fd_src_mgr epeg_fd_src_mgr;
+struct _epeg_fd_src_mgr
+{
+   struct jpeg_source_mgr pub;
+   int fd;
+   int cache;
+   int flags;
+   JOCTET *buffer;
+   size_t size;
+   size_t lead;
+   off_t start, pos;
+   boolean seek;
+   boolean direct;
+   boolean start_of_file;
+};
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_fd_init_source(j_decompress_ptr cinfo)
+{
+   epeg_fd_src_mgr *src;
+
+   src = (epeg_fd_src_mgr *)cinfo->src;
+   src->start_of_file = TRUE;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_fd_src_seek(epeg_fd_src_mgr *src, off_t off)
+{
+   /* direct reads have to start on a block boundary, so start at the one
+    * before and throw away what lies in front of @p off: */
+   src->lead = 0;
+   if (src->direct) {
+      src->lead = (size_t)(off % EPEG_DEST_BUFFER_ALIGN);
+   }
+   src->pos = (off - (off_t)src->lead);
+}
+
+/* static internal private-only function; unnecessary to document: */
+static boolean _epeg_fd_fill_input_buffer(j_decompress_ptr cinfo)
+{
+   epeg_fd_src_mgr *src;
+   size_t lead;
+   ssize_t n;
+
+   src = (epeg_fd_src_mgr *)cinfo->src;
+   for (;;) {
+      if (src->seek) {
+         n = pread(src->fd, src->buffer, src->size, src->pos);
+      } else {
+         n = read(src->fd, src->buffer, src->size);
+      }
+      if (n >= 0) {
+         break;
+      }
+      if (errno == EINTR) {
+         continue;
+      }
+#ifdef O_DIRECT
+      if ((src->direct) && (errno == EINVAL)) {
+         /* the file system takes O_DIRECT but not this read; go on
+          * through the page cache: */
+         fcntl(src->fd, F_SETFL, src->flags);
+         src->direct = FALSE;
+         continue;
+      }
+#endif /* O_DIRECT */
+      ERREXIT(cinfo, JERR_FILE_READ);
+   }
+   src->pos += (off_t)n;
+
+   lead = (((size_t)n < src->lead) ? (size_t)n : src->lead);
+   src->lead -= lead;
+   n -= (ssize_t)lead;
+   if (n == 0) {
+      if (src->start_of_file) {
+         ERREXIT(cinfo, JERR_INPUT_EMPTY);
+      }
+      /* same as jpeg_stdio_src(): end a short file with a fake EOI */
+      WARNMS(cinfo, JWRN_JPEG_EOF);
+      src->buffer[0] = (JOCTET)0xff;
+      src->buffer[1] = (JOCTET)JPEG_EOI;
+      lead = 0;
+      n = 2;
+   }
+   src->pub.next_input_byte = (src->buffer + lead);
+   src->pub.bytes_in_buffer = (size_t)n;
+   src->start_of_file = FALSE;
+   return TRUE;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_fd_skip_input_data(j_decompress_ptr cinfo, long num_bytes)
+{
+   epeg_fd_src_mgr *src;
+
+   src = (epeg_fd_src_mgr *)cinfo->src;
+   if (num_bytes <= 0) {
+      return;
+   }
+   if ((size_t)num_bytes <= src->pub.bytes_in_buffer) {
+      src->pub.next_input_byte += (size_t)num_bytes;
+      src->pub.bytes_in_buffer -= (size_t)num_bytes;
+      return;
+   }
+   if (!src->seek) {
+      while (num_bytes > (long)src->pub.bytes_in_buffer) {
+         num_bytes -= (long)src->pub.bytes_in_buffer;
+         (void)_epeg_fd_fill_input_buffer(cinfo);
+      }
+      src->pub.next_input_byte += (size_t)num_bytes;
+      src->pub.bytes_in_buffer -= (size_t)num_bytes;
+      return;
+   }
+   /* no need to read what gets skipped: */
+   _epeg_fd_src_seek(src, (src->pos - (off_t)src->pub.bytes_in_buffer +
+                           (off_t)num_bytes));
+   src->pub.next_input_byte = NULL;
+   src->pub.bytes_in_buffer = 0;
+}
+
+/* internal private-only function; unnecessary to document: */
+void _epeg_fd_src(j_decompress_ptr cinfo, int fd, int cache)
+{
+   epeg_fd_src_mgr *src;
+   JOCTET *buffer;
+   size_t pad;
+
+   src = (epeg_fd_src_mgr *)
+      (*cinfo->mem->alloc_small)((j_common_ptr)cinfo, JPOOL_PERMANENT,
+                                 sizeof(epeg_fd_src_mgr));
+   src->size = EPEG_DEST_BUFFER_SIZE;
+   buffer = (JOCTET *)
+      (*cinfo->mem->alloc_large)((j_common_ptr)cinfo, JPOOL_PERMANENT,
+                                 (src->size + EPEG_DEST_BUFFER_ALIGN));
+   pad = (size_t)((EPEG_DEST_BUFFER_ALIGN -
+                   ((size_t)buffer % EPEG_DEST_BUFFER_ALIGN)) %
+                  EPEG_DEST_BUFFER_ALIGN);
+   src->buffer = (buffer + pad);
+   src->fd = fd;
+   src->cache = cache;
+   src->flags = -1;
+   src->direct = FALSE;
+   src->start_of_file = TRUE;
+
+   /* read from where the descriptor is, without moving it, unless it is a
+    * pipe or such that cannot be read at an offset: */
+   src->start = lseek(fd, (off_t)0, SEEK_CUR);
+   src->seek = (src->start >= 0);
+   if (!src->seek) {
+      src->start = 0;
+      src->cache = 0;
+   }
+#ifdef O_DIRECT
+   if (src->cache & EPEG_CACHE_DIRECT) {
+      src->flags = fcntl(fd, F_GETFL);
+      if ((src->flags != -1) &&
+          (fcntl(fd, F_SETFL, (src->flags | O_DIRECT)) == 0)) {
+         src->direct = TRUE;
+      }
+   }
+#endif /* O_DIRECT */
+   _epeg_fd_src_seek(src, src->start);
+#if defined(_POSIX_ADVISORY_INFO) && (_POSIX_ADVISORY_INFO > 0)
+   if (src->cache & EPEG_CACHE_SEQUENTIAL) {
+      posix_fadvise(fd, src->start, (off_t)0, POSIX_FADV_SEQUENTIAL);
+   }
+   if (src->cache & EPEG_CACHE_WILLNEED) {
+      posix_fadvise(fd, src->start, (off_t)0, POSIX_FADV_WILLNEED);
+   }
+#endif /* _POSIX_ADVISORY_INFO */
+
+   src->pub.init_source = _epeg_fd_init_source;
+   src->pub.fill_input_buffer = _epeg_fd_fill_input_buffer;
+   src->pub.skip_input_data = _epeg_fd_skip_input_data;
+   src->pub.resync_to_restart = jpeg_resync_to_restart;
+   src->pub.term_source = _epeg_callback_term_source;
+   src->pub.bytes_in_buffer = 0;
+   src->pub.next_input_byte = NULL;
+   cinfo->src = (struct jpeg_source_mgr *)src;
+}
+
+/* internal private-only function; unnecessary to document: */
+int _epeg_fd_src_rewind(j_decompress_ptr cinfo)
+{
+   epeg_fd_src_mgr *src;
+
+   if ((!cinfo->src) || (cinfo->src->init_source != _epeg_fd_init_source)) {
+      return 1;
+   }
+   src = (epeg_fd_src_mgr *)cinfo->src;
+   if (!src->seek) {
+      return 1;
+   }
+   _epeg_fd_src_seek(src, src->start);
+   src->start_of_file = TRUE;
+   src->pub.bytes_in_buffer = 0;
+   src->pub.next_input_byte = NULL;
+   return 0;
+}
+
+/* internal private-only function; unnecessary to document: */
+void _epeg_fd_src_release(j_decompress_ptr cinfo)
+{
+   epeg_fd_src_mgr *src;
+
+   if ((!cinfo->src) || (cinfo->src->init_source != _epeg_fd_init_source)) {
+      return;
+   }
+   src = (epeg_fd_src_mgr *)cinfo->src;
+#ifdef O_DIRECT
+   if (src->direct) {
+      /* the descriptor is the caller's, so leave it as it came: */
+      fcntl(src->fd, F_SETFL, src->flags);
+      src->direct = FALSE;
+   }
+#endif /* O_DIRECT */
+#if defined(_POSIX_ADVISORY_INFO) && (_POSIX_ADVISORY_INFO > 0)
+   if ((src->cache & EPEG_CACHE_DONTNEED) && (src->pos > src->start)) {
+      posix_fadvise(src->fd, src->start, (src->pos - src->start),
+                    POSIX_FADV_DONTNEED);
+   }
+#endif /* _POSIX_ADVISORY_INFO */
+   src->cache = 0;
+}
+
+/* various text editor settings:
+ * # Emacs: -*-
+ * coding: utf-8;
+ * mode: C;
+ * tab-width: 3;
+ * indent-tabs-mode: nil;
+ * c-basic-offset: 3
+ * # -*-
+ * # Vi:
+ * # vim:fenc=utf-8:ft=C:et:sw=3:ts=3:sts=3
+ */
+/* EOF */
@@ -0,0 +1,307 @@
+/* epeg_sync.c */
+/* gets built into the libepeg library */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE 1 /* need this for syncfs */
+#endif /* !_GNU_SOURCE */
+#include <stdio.h>
+#include <errno.h>
+#include "Epeg.h"
+#include "epeg_private.h"
+
+static void _epeg_sync_wave(Epeg_Sync *sync);
+
+/* static internal private-only function; unnecessary to document: */
+static long long _epeg_sync_now(void)
+{
+#ifdef CLOCK_MONOTONIC
+   struct timespec ts;
+
+   if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+      return (((long long)ts.tv_sec * 1000LL) + (ts.tv_nsec / 1000000L));
+   }
+#endif /* CLOCK_MONOTONIC */
+   return ((long long)time(NULL) * 1000LL);
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_sync_dir(const char *path, char *dir, size_t len)
+{
+   const char *p;
+
+   p = strrchr(path, '/');
+   if (!p) {
+      snprintf(dir, len, ".");
+   } else if (p == path) {
+      snprintf(dir, len, "/");
+   } else {
+      snprintf(dir, len, "%.*s", (int)(p - path), path);
+   }
+}
+
+/**
+ * Create a group commit for atomic file output.
+ * @param files The number of files per sync wave, or 0 for no limit.
+ * @param msec The longest time in milliseconds a file waits for its wave,
+ *             or 0 for no limit.
+ * @return A handle to the group commit, or NULL on failure.
+ *
+ * Images given this handle with epeg_file_output_sync_set() are written to a
+ * temporary file next to their destination as usual, but are only renamed
+ * into place by the next sync wave. A wave makes all the waiting files
+ * durable at once (with one syncfs() per filesystem where the system has it,
+ * otherwise with one fsync() per file), renames them and then syncs the
+ * directories they went into. This costs one flush per wave instead of one
+ * per image, while a crash can still never leave a truncated file at a
+ * destination path.
+ *
+ * A wave runs once @p files images are waiting, or when an image finishes
+ * @p msec milliseconds or more after the oldest waiting one; there is no
+ * background thread, so the time limit is only checked as images finish.
+ * Until its wave has run a file is not visible under its final name. The
+ * handle is not thread safe.
+ *
+ * See also: epeg_sync_flush(), epeg_sync_free(), epeg_file_output_sync_set()
+ */
+extern Epeg_Sync *epeg_sync_new(int files, int msec)
+{
+   Epeg_Sync *sync;
+
+   sync = calloc(1, sizeof(Epeg_Sync));
+   if (!sync) {
+      return NULL;
+   }
+   sync->files = ((files > 0) ? files : 0);
+   sync->msec = ((msec > 0) ? msec : 0);
+   return sync;
+}
+
+/**
+ * Commit all files that are waiting on a group commit.
+ * @param sync A handle to a group commit.
+ * @return 1 if something failed since the last call, otherwise 0.
+ *
+ * This runs a sync wave right away for any waiting files. Errors of waves
+ * that ran on their own as images finished are reported here as well, since
+ * the image that set off a wave is not the only one it commits.
+ *
+ * See also: epeg_sync_new(), epeg_sync_free()
+ */
+extern int epeg_sync_flush(Epeg_Sync *sync)
+{
+   int failed;
+
+   if (sync->count > 0) {
+      _epeg_sync_wave(sync);
+   }
+   failed = sync->failed;
+   sync->failed = 0;
+   return (failed ? 1 : 0);
+}
+
+/**
+ * Commit any waiting files and free a group commit.
+ * @param sync A handle to a group commit.
+ * @return Nothing.
+ *
+ * This flushes @p sync like epeg_sync_flush() and then frees it. No image
+ * that still uses it as its output sync may be encoded afterwards. A NULL
+ * @p sync is ignored.
+ *
+ * See also: epeg_sync_new(), epeg_sync_flush()
+ */
+extern void epeg_sync_free(Epeg_Sync *sync)
+{
+   if (!sync) {
+      return;
+   }
+   epeg_sync_flush(sync);
+   if (sync->pending) {
+      free(sync->pending);
+   }
+   free(sync);
+}
+
+/* internal private-only function; unnecessary to document: */
+int _epeg_atomic_open(const char *path, char **tmp)
+{
+   static unsigned int serial = 0;
+   char *name;
+   size_t len;
+   int flags, fd, i;
+
+   len = (strlen(path) + 64);
+   name = malloc(len);
+   if (!name) {
+      return -1;
+   }
+   /* readable too, which mmap() output needs: */
+   flags = (O_RDWR | O_CREAT | O_EXCL);
+#ifdef O_CLOEXEC
+   flags |= O_CLOEXEC;
+#endif /* O_CLOEXEC */
+#ifdef O_BINARY
+   flags |= O_BINARY;
+#endif /* O_BINARY */
+   /* same directory as the destination, so that rename() stays atomic: */
+   for ((i = 0); (i < 100); i++) {
+      snprintf(name, len, "%s.%ld.%u.tmp", path, (long)getpid(), serial++);
+      fd = open(name, flags, 0666);
+      if (fd >= 0) {
+         *tmp = name;
+         return fd;
+      }
+      if (errno != EEXIST) {
+         break;
+      }
+   }
+   free(name);
+   return -1;
+}
+
+/* internal private-only function; unnecessary to document: */
+int _epeg_atomic_commit(Epeg_Sync *sync, char *tmp, const char *path)
+{
+   long long now;
+   char *dst;
+
+   if (!sync) {
+      if (rename(tmp, path) != 0) {
+         unlink(tmp);
+         free(tmp);
+         return 1;
+      }
+      free(tmp);
+      return 0;
+   }
+
+   if (sync->count == sync->alloc) {
+      void *pending;
+      int alloc;
+
+      alloc = ((sync->alloc > 0) ? (sync->alloc * 2) : 16);
+      pending = realloc(sync->pending, (alloc * sizeof(*(sync->pending))));
+      if (!pending) {
+         unlink(tmp);
+         free(tmp);
+         return 1;
+      }
+      sync->pending = pending;
+      sync->alloc = alloc;
+   }
+   dst = strdup(path);
+   if (!dst) {
+      unlink(tmp);
+      free(tmp);
+      return 1;
+   }
+
+   now = _epeg_sync_now();
+   if (sync->count == 0) {
+      sync->start = now;
+   }
+   sync->pending[sync->count].tmp = tmp;
+   sync->pending[sync->count].path = dst;
+   sync->count++;
+
+   if (((sync->files > 0) && (sync->count >= sync->files)) ||
+       ((sync->msec > 0) && ((now - sync->start) >= sync->msec))) {
+      _epeg_sync_wave(sync);
+   }
+   return 0;
+}
+
+/* static internal private-only function; unnecessary to document: */
+static void _epeg_sync_wave(Epeg_Sync *sync)
+{
+   char dir[PATH_MAX], last[PATH_MAX];
+#ifdef __linux__
+   dev_t *devs;
+   int ndevs, j;
+#endif /* __linux__ */
+   int i, fd;
+
+   /* first the data of every waiting file: */
+#ifdef __linux__
+   devs = malloc(sync->count * sizeof(dev_t));
+   ndevs = 0;
+#endif /* __linux__ */
+   for ((i = 0); (i < sync->count); i++) {
+      fd = open(sync->pending[i].tmp, O_RDONLY);
+      if (fd < 0) {
+         sync->failed = 1;
+         continue;
+      }
+#ifdef __linux__
+      if (devs) {
+         struct stat st;
+
+         if (fstat(fd, &st) != 0) {
+            sync->failed = 1;
+            close(fd);
+            continue;
+         }
+         for ((j = 0); (j < ndevs); j++) {
+            if (devs[j] == st.st_dev) {
+               break;
+            }
+         }
+         if (j == ndevs) {
+            if (syncfs(fd) != 0) {
+               sync->failed = 1;
+            }
+            devs[ndevs++] = st.st_dev;
+         }
+      } else if (fsync(fd) != 0) {
+         sync->failed = 1;
+      }
+#else
+      if (fsync(fd) != 0) {
+         sync->failed = 1;
+      }
+#endif /* __linux__ */
+      close(fd);
+   }
+#ifdef __linux__
+   if (devs) {
+      free(devs);
+   }
+#endif /* __linux__ */
+
+   /* then the names, and the directories that hold them: */
+   last[0] = 0;
+   for ((i = 0); (i < sync->count); i++) {
+      if (rename(sync->pending[i].tmp, sync->pending[i].path) != 0) {
+         unlink(sync->pending[i].tmp);
+         sync->failed = 1;
+      } else {
+         _epeg_sync_dir(sync->pending[i].path, dir, sizeof(dir));
+         if (strcmp(dir, last) != 0) {
+            fd = open(dir, O_RDONLY);
+            if ((fd < 0) || (fsync(fd) != 0)) {
+               sync->failed = 1;
+            }
+            if (fd >= 0) {
+               close(fd);
+            }
+            strcpy(last, dir);
+         }
+      }
+      free(sync->pending[i].tmp);
+      free(sync->pending[i].path);
+   }
+   sync->count = 0;
+}
+
+/* various text editor settings:
+ * # Emacs: -*-
+ * coding: utf-8;
+ * mode: C;
+ * tab-width: 3;
+ * indent-tabs-mode: nil;
+ * c-basic-offset: 3
+ * # -*-
+ * # Vi:
+ * # vim:fenc=utf-8:ft=C:et:sw=3:ts=3:sts=3
+ */
+/* EOF */